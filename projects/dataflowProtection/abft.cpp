@@ -0,0 +1,240 @@
+/*
+ * abft.cpp
+ *
+ * This file contains the logic for protecting matrix multiply kernels with
+ *  checksums instead of replication (algorithm-based fault tolerance).
+ * A kernel marked with __xMR_ABFT or -abftFns is called once, like
+ *  skipLibCalls, so it costs the same as the unprotected code.  After the
+ *  call, the row and column sums of the result are checked against sums
+ *  computed from the inputs, which only takes O(n^2) work.  A single wrong
+ *  element is corrected, and anything else is reported as a fault.  The
+ *  result is then copied to its copies, so the rest of the code can go on
+ *  using them like normal.
+ * The kernel only reads the original inputs, so before the call they are voted
+ *  on with their copies, or compared with them for DWC.
+ * The checks are done by the __COAST_abft_* functions in COAST_abft.h.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> ReportErrorsFlag;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::string fault_function_name;
+extern std::string tmr_global_count_name;
+
+
+/*
+ * The kernel must take the two inputs and the result, in that order, as pointers to
+ *  rows of integers.  Returns the row type of each, or fails if it doesn't fit.
+ */
+static bool getMatrixRows(Function* F, std::vector<ArrayType*>& rows) {
+	if (F->arg_size() != 3)
+		return false;
+	for (auto & arg : F->args()) {
+		PointerType* ptrTy = dyn_cast<PointerType>(arg.getType());
+		ArrayType* rowTy = ptrTy ? dyn_cast<ArrayType>(ptrTy->getElementType()) : nullptr;
+		if (!rowTy || !rowTy->getElementType()->isIntegerTy())
+			return false;
+		rows.push_back(rowTy);
+	}
+	// (n x m) * (m x p) = (n x p)
+	return (rows[0]->getElementType() == rows[1]->getElementType()) &&
+		   (rows[1]->getElementType() == rows[2]->getElementType()) &&
+		   (rows[1]->getNumElements() == rows[2]->getNumElements());
+}
+
+
+/*
+ * Find how many rows the matrix passed at a call has, from the global or local it points to.
+ * Returns 0 if it doesn't point to the start of a whole matrix.
+ */
+static uint64_t getNumRows(Value* arg, ArrayType* rowTy, const DataLayout& DL) {
+	Value* obj = GetUnderlyingObject(arg, DL);
+	if (arg->stripPointerCasts() != obj)
+		return 0;
+
+	Type* objTy = nullptr;
+	if (GlobalVariable* GV = dyn_cast<GlobalVariable>(obj))
+		objTy = GV->getValueType();
+	else if (AllocaInst* AI = dyn_cast<AllocaInst>(obj))
+		objTy = AI->getAllocatedType();
+
+	ArrayType* matrixTy = dyn_cast_or_null<ArrayType>(objTy);
+	if (!matrixTy || (matrixTy->getElementType() != rowTy))
+		return 0;
+	return matrixTy->getNumElements();
+}
+
+
+/*
+ * Check the result of each call to a kernel marked for ABFT, and copy it to its copies.
+ * Must be called after the error function is inserted and the sync points are done,
+ *  so the calls to the checking functions aren't synchronized.
+ */
+void dataflowProtection::insertAbftChecks(Module& M) {
+	if (abftFns.empty())
+		return;
+
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	Type* intPtrTy = DL.getIntPtrType(C);
+	Type* i32Ty = Type::getInt32Ty(C);
+	Function* errFn = M.getFunction(fault_function_name);
+	assert(errFn && "error function exists");
+	unsigned numChecked = 0;
+
+	for (auto F : abftFns) {
+		std::vector<ArrayType*> rows;
+		if (!getMatrixRows(F, rows)) {
+			errs() << err_string << " '" << F->getName() << "' can't be protected with ABFT, it must take "
+				   << "two input matrices and a result matrix of integers, like int A[][m], int B[][p], int C[][p]\n";
+			exit(-1);
+		}
+		IntegerType* elemTy = cast<IntegerType>(rows[0]->getElementType());
+		unsigned elemBits = elemTy->getBitWidth();
+		if ( (elemBits != 8) && (elemBits != 16) && (elemBits != 32) && (elemBits != 64) ) {
+			errs() << err_string << " ABFT doesn't support " << elemBits << "-bit matrices in '"
+				   << F->getName() << "'\n";
+			exit(-1);
+		}
+
+		PointerType* elemPtrTy = elemTy->getPointerTo();
+		Constant* checkFn = M.getOrInsertFunction("__COAST_abft_matmul_i" + std::to_string(elemBits),
+				FunctionType::get(i32Ty, {elemPtrTy, elemPtrTy, elemPtrTy, intPtrTy, intPtrTy, intPtrTy}, false));
+		Constant* voteFn = M.getOrInsertFunction("__COAST_abft_vote_i" + std::to_string(elemBits),
+				FunctionType::get(i32Ty, {elemPtrTy, elemPtrTy, elemPtrTy, intPtrTy}, false));
+
+		std::vector<CallInst*> calls;
+		for (auto U : F->users()) {
+			CallInst* CI = dyn_cast<CallInst>(U);
+			if (!CI || (CI->getCalledFunction() != F))
+				continue;
+			// these are about to be removed
+			Function* caller = CI->getFunction();
+			if (std::find(origFunctions.begin(), origFunctions.end(), caller) != origFunctions.end())
+				continue;
+			// calls at the other protection level are checked by the pass for that level
+			if (isLevelSubset ? (fnsToClone.find(caller) == fnsToClone.end())
+							  : (crossLevelFns.find(caller) != crossLevelFns.end()))
+				continue;
+			calls.push_back(CI);
+		}
+
+		for (auto CI : calls) {
+			Value* result = CI->getArgOperand(2);
+			uint64_t n = getNumRows(result, rows[2], DL);
+			if (n == 0) {
+				errs() << err_string << " can't find the size of the result matrix passed to '"
+					   << F->getName() << "', pass a global or local array directly\n";
+				PRINT_VALUE(CI);
+				exit(-1);
+			}
+			uint64_t m = rows[0]->getNumElements();
+			uint64_t p = rows[2]->getNumElements();
+			BasicBlock* errBB = BasicBlock::Create(C, "abft.fault", CI->getFunction());
+
+			// the kernel and the check only read the original inputs, so an upset in them
+			//  wouldn't be seen; vote on them with their copies first (with DWC, compare them)
+			IRBuilder<> builder(CI);
+			Value* inputsFixed = ConstantInt::get(i32Ty, 0);
+			Value* inputsBad = nullptr;
+			for (unsigned i = 0; i < 2; i++) {
+				Value* input = CI->getArgOperand(i);
+				Value* stripped = input->stripPointerCasts();
+				if (cloneMap.find(stripped) == cloneMap.end())
+					continue;
+				uint64_t inputRows = getNumRows(input, rows[i], DL);
+				if (inputRows == 0) {
+					errs() << err_string << " can't find the size of the input matrix passed to '"
+						   << F->getName() << "', pass a global or local array directly\n";
+					PRINT_VALUE(CI);
+					exit(-1);
+				}
+				Value* copy2 = TMR ? builder.CreateBitCast(cloneMap[stripped].second, elemPtrTy)
+								   : ConstantPointerNull::get(elemPtrTy);
+				CallInst* voteCall = builder.CreateCall(voteFn, {builder.CreateBitCast(input, elemPtrTy),
+						builder.CreateBitCast(cloneMap[stripped].first, elemPtrTy), copy2,
+						ConstantInt::get(intPtrTy, inputRows * rows[i]->getNumElements())}, "abft.voted");
+				voteCall->setDebugLoc(CI->getDebugLoc());
+				Value* bad = builder.CreateICmpSLT(voteCall, ConstantInt::get(i32Ty, 0));
+				inputsBad = inputsBad ? builder.CreateOr(inputsBad, bad) : bad;
+				inputsFixed = builder.CreateAdd(inputsFixed, voteCall);
+			}
+			if (inputsBad) {
+				BasicBlock* voteBB = CI->getParent();
+				BasicBlock* kernelBB = voteBB->splitBasicBlock(CI->getIterator(), "abft.call");
+				voteBB->getTerminator()->eraseFromParent();
+				builder.SetInsertPoint(voteBB);
+				builder.CreateCondBr(inputsBad, errBB, kernelBB);
+			}
+
+			// check right after the call
+			BasicBlock* callBB = CI->getParent();
+			BasicBlock* okBB = callBB->splitBasicBlock(std::next(CI->getIterator()), "abft.ok");
+			callBB->getTerminator()->eraseFromParent();
+
+			builder.SetInsertPoint(callBB);
+			std::vector<Value*> args;
+			for (unsigned i = 0; i < 3; i++) {
+				args.push_back(builder.CreateBitCast(CI->getArgOperand(i), elemPtrTy));
+			}
+			args.push_back(ConstantInt::get(intPtrTy, n));
+			args.push_back(ConstantInt::get(intPtrTy, m));
+			args.push_back(ConstantInt::get(intPtrTy, p));
+			CallInst* checkCall = builder.CreateCall(checkFn, args, "abft.fixed");
+			checkCall->setDebugLoc(CI->getDebugLoc());
+			builder.CreateCondBr(builder.CreateICmpSLT(checkCall, ConstantInt::get(i32Ty, 0)), errBB, okBB);
+
+			// more than one element was wrong, or an input couldn't be voted on
+			builder.SetInsertPoint(errBB);
+			builder.CreateCall(errFn);
+			builder.CreateUnreachable();
+
+			builder.SetInsertPoint(&*okBB->getFirstInsertionPt());
+			GlobalVariable* TMRErrorDetected = M.getGlobalVariable(tmr_global_count_name);
+			if (TMR && ReportErrorsFlag && TMRErrorDetected) {
+				Type* countTy = TMRErrorDetected->getValueType();
+				Value* oldCount = builder.CreateLoad(TMRErrorDetected);
+				Value* fixed = builder.CreateAdd(checkCall, inputsFixed);
+				builder.CreateStore(builder.CreateAdd(oldCount,
+						builder.CreateZExtOrTrunc(fixed, countTy)), TMRErrorDetected);
+			}
+
+			// the copies of the result get the checked one
+			Value* stripped = result->stripPointerCasts();
+			if (cloneMap.find(stripped) != cloneMap.end()) {
+				uint64_t size = DL.getTypeAllocSize(rows[2]) * n;
+				std::vector<Value*> copies = {cloneMap[stripped].first};
+				if (TMR)
+					copies.push_back(cloneMap[stripped].second);
+				for (auto copy : copies) {
+					if (!copy)
+						continue;
+					builder.CreateMemCpy(builder.CreateBitCast(copy, result->getType()), 1, result, 1, size);
+				}
+			}
+			numChecked++;
+		}
+	}
+
+	if (verboseFlag)
+		errs() << info_string << " checking " << numChecked << " calls to matrix kernels with ABFT\n";
+}
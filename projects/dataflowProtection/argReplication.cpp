@@ -0,0 +1,231 @@
+/*
+ * argReplication.cpp
+ *
+ * This file contains the logic for deciding which function arguments are
+ *  passed as copies.  By default, every argument that has copies in the caller
+ *  gets an extra argument for each copy, so a function with four arguments can
+ *  end up with twelve, which no longer fit in the registers the target uses
+ *  for arguments.  The rest are passed on the stack at every call.
+ * With -argReplication=auto, functions that would run out of argument
+ *  registers have some of their arguments voted on at the call instead, and
+ *  the callee uses the one voted value for all of its copies.  The arguments
+ *  picked first are the ones the callee would have voted on soon anyway.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/CallSite.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<std::string> argReplicationMode;
+extern cl::opt<unsigned> argRegsOpt;
+extern cl::opt<unsigned> argVoteSpan;
+extern cl::opt<unsigned> argVoteMinFreq;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::map<Function*, std::set<int> > noXmrArgList;
+
+
+/*
+ * How many integer registers the calling convention uses for arguments.
+ * Floating point arguments have their own registers on these targets, so they aren't counted.
+ * Returns 0 if the target isn't known.
+ */
+static unsigned getArgRegisters(Module& M) {
+	if (argRegsOpt)
+		return argRegsOpt;
+
+	Triple T(M.getTargetTriple());
+	switch (T.getArch()) {
+		case Triple::arm:
+		case Triple::armeb:
+		case Triple::thumb:
+		case Triple::thumbeb:
+		case Triple::mips:
+		case Triple::mipsel:
+			return 4;
+		case Triple::x86_64:
+			return T.isOSWindows() ? 4 : 6;
+		case Triple::aarch64:
+		case Triple::aarch64_be:
+		case Triple::riscv32:
+		case Triple::riscv64:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+
+/*
+ * Count how many instructions use the argument before its copies would be voted on.
+ * The value is followed through locals, so it works before mem2reg.  It stops at calls,
+ *  terminators, and stores to anything other than a local, which is where the copies
+ *  would be synchronized or would go back to replicated memory.
+ * Stops counting at `limit`.
+ */
+static unsigned getVoteSpan(Argument* arg, unsigned limit) {
+	std::set<Value*> visited;
+	std::queue<Value*> worklist;
+	worklist.push(arg);
+	unsigned span = 0;
+
+	while (!worklist.empty() && (span <= limit)) {
+		Value* V = worklist.front();
+		worklist.pop();
+		for (auto U : V->users()) {
+			Instruction* I = dyn_cast<Instruction>(U);
+			if (!I || !visited.insert(I).second)
+				continue;
+			span++;
+
+			if (StoreInst* SI = dyn_cast<StoreInst>(I)) {
+				// follow it through a local
+				AllocaInst* AI = dyn_cast<AllocaInst>(SI->getPointerOperand());
+				if (AI && (SI->getValueOperand() == V)) {
+					for (auto AU : AI->users()) {
+						if (isa<LoadInst>(AU) && visited.insert(AU).second) {
+							span++;
+							worklist.push(AU);
+						}
+					}
+				}
+			} else if (isa<CallInst>(I) || isa<InvokeInst>(I) || isa<TerminatorInst>(I)) {
+				continue;
+			} else if (!I->getType()->isVoidTy()) {
+				worklist.push(I);
+			}
+		}
+	}
+	return span;
+}
+
+
+/*
+ * Decide which arguments are voted on at the call instead of being passed as copies.
+ * Only functions that would need more argument slots than the target has registers are
+ *  changed, and only if they're called often enough for it to matter.  Arguments with
+ *  the shortest span before the callee votes are picked first, until the rest fit.
+ * Pointers are always passed as copies, since each copy points to its own memory.
+ * Must be called before cloneFunctionArguments().
+ */
+void dataflowProtection::selectReplicatedArgs(Module& M) {
+	if (argReplicationMode == "all")
+		return;
+
+	unsigned argRegs = getArgRegisters(M);
+	if (argRegs == 0) {
+		errs() << warn_string << " don't know how many argument registers target '"
+			   << M.getTargetTriple() << "' has, use -argRegs. Passing all of the copies.\n";
+		return;
+	}
+
+	const DataLayout& DL = M.getDataLayout();
+	unsigned wordSize = DL.getPointerSize();
+	unsigned numCopies = TMR ? 3 : 2;
+	std::map<Function*, LoopInfo*> loopInfos;
+	std::vector<DominatorTree*> domTrees;
+
+	for (auto F : fnsToClone) {
+		if (F->isDeclaration() || isISR(*F) || !onlyDirectCalls(F))
+			continue;
+		if ( (protectedLibList.find(F) != protectedLibList.end()) ||
+				(replReturn.find(F) != replReturn.end()) )
+			continue;
+
+		// which arguments would be passed as copies, and how often the function is called
+		std::vector<bool> cloneArg(F->arg_size(), false);
+		unsigned freq = 0;
+		for (auto U : F->users()) {
+			CallSite CS(U);
+			if (!CS)
+				continue;
+			Function* caller = CS.getInstruction()->getFunction();
+			if (fnsToClone.find(caller) == fnsToClone.end())
+				continue;
+
+			for (unsigned i = 0; i < F->arg_size(); i++) {
+				if (willBeCloned(CS.getArgument(i)))
+					cloneArg[i] = true;
+			}
+
+			if (loopInfos.find(caller) == loopInfos.end()) {
+				DominatorTree* DT = new DominatorTree(*caller);
+				domTrees.push_back(DT);
+				loopInfos[caller] = new LoopInfo(*DT);
+			}
+			freq += getLoopWeight(loopInfos[caller]->getLoopDepth(CS.getInstruction()->getParent()));
+		}
+		if (freq < argVoteMinFreq)
+			continue;
+
+		// count the argument slots, not including floating point
+		unsigned slots = 0;
+		std::vector<std::pair<unsigned, unsigned> > candidates;
+		for (auto & arg : F->args()) {
+			unsigned argNo = arg.getArgNo();
+			Type* argTy = arg.getType();
+			if (argTy->isFloatingPointTy())
+				continue;
+			if ( (noXmrArgList.find(F) != noXmrArgList.end()) &&
+					(noXmrArgList[F].find(argNo) != noXmrArgList[F].end()) )
+				cloneArg[argNo] = false;
+			if ( (offsetArgs.find(F) != offsetArgs.end()) &&
+					(offsetArgs[F].find(argNo) != offsetArgs[F].end()) )
+				cloneArg[argNo] = false;
+
+			unsigned argSlots = 1;
+			if (argTy->isSized())
+				argSlots = std::max<uint64_t>((DL.getTypeAllocSize(argTy) + wordSize - 1) / wordSize, 1);
+			slots += cloneArg[argNo] ? argSlots * numCopies : argSlots;
+
+			if (cloneArg[argNo] && argTy->isIntegerTy())
+				candidates.push_back(std::make_pair(getVoteSpan(&arg, argVoteSpan), argNo));
+		}
+		if (slots <= argRegs)
+			continue;
+
+		std::sort(candidates.begin(), candidates.end());
+		for (auto cand : candidates) {
+			if ( (slots <= argRegs) || (cand.first > argVoteSpan) )
+				break;
+			Argument* arg = &*std::next(F->arg_begin(), cand.second);
+			unsigned argSlots = std::max<uint64_t>((DL.getTypeAllocSize(arg->getType()) + wordSize - 1) / wordSize, 1);
+			slots -= argSlots * (numCopies - 1);
+			votedArgs[F].insert(cand.second);
+		}
+
+		if (verboseFlag && (votedArgs.find(F) != votedArgs.end())) {
+			errs() << info_string << " voting on arguments to '" << F->getName() << "' at the call:";
+			for (auto argNo : votedArgs[F]) {
+				errs() << " " << argNo;
+			}
+			errs() << " (" << slots << " argument slots, called " << freq << " times)\n";
+		}
+	}
+
+	for (auto entry : loopInfos) {
+		delete entry.second;
+	}
+	for (auto DT : domTrees) {
+		delete DT;
+	}
+}
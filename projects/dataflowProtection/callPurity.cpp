@@ -0,0 +1,408 @@
+/*
+ * callPurity.cpp
+ *
+ * This file contains the logic for deciding how to handle calls to functions
+ *  that are only declared, from what LLVM knows about them.
+ * Normally, a call to an external function is replicated and becomes a sync
+ *  point, unless the function is listed in skipLibCalls (called once) or
+ *  replicateFnCalls in functions.config.  With -inferCalls, functions that
+ *  can't change memory are found from their attributes and from the list of
+ *  library functions LLVM knows about, like sin() and strlen().  Calls to
+ *  them are replicated like any other instruction, without a sync point, or
+ *  are called once on the voted arguments with -pureCalls=once.
+ * Anything else is handled the same as before, and the lists in
+ *  functions.config still take priority.
+ * With -protectedLibc, calls to C library functions that have a protected
+ *  version in the module (see COAST_libc.h) are changed to call that instead,
+ *  so they aren't external calls at all.
+ * With -temporalPure, functions in the module that only use their own locals
+ *  and read through their arguments are called once for each copy, like
+ *  replicateFnCalls, instead of having their bodies replicated.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+
+// LLVM includes
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/CallSite.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Transforms/Utils/BuildLibCalls.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> inferCallsFlag;
+extern cl::opt<std::string> pureCallsMode;
+extern cl::opt<bool> callReportFlag;
+extern cl::opt<bool> protectedLibcFlag;
+extern cl::opt<bool> temporalPureFlag;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::list<std::string> skipLibCalls;
+extern std::list<std::string> coarseGrainedUserFunctions;
+extern std::list<std::string> dwcFnList;
+extern std::list<std::string> tmrFnList;
+
+// functions that COAST_libc.h has a protected version of
+static const std::set<std::string> protectedLibcNames = {
+	"memcpy", "memset", "memcmp", "strlen", "strcmp", "strncmp", "bsearch"
+};
+
+
+/*
+ * Math functions only change errno, and every copy would set it to the same value.
+ * Unless the code is compiled with -fno-math-errno, they aren't marked readnone.
+ */
+static const std::set<LibFunc> mathLibFuncs = {
+	LibFunc_acos, LibFunc_acosf, LibFunc_acosl,
+	LibFunc_asin, LibFunc_asinf, LibFunc_asinl,
+	LibFunc_atan, LibFunc_atanf, LibFunc_atanl,
+	LibFunc_atan2, LibFunc_atan2f, LibFunc_atan2l,
+	LibFunc_ceil, LibFunc_ceilf, LibFunc_ceill,
+	LibFunc_copysign, LibFunc_copysignf, LibFunc_copysignl,
+	LibFunc_cos, LibFunc_cosf, LibFunc_cosl,
+	LibFunc_cosh, LibFunc_coshf, LibFunc_coshl,
+	LibFunc_exp, LibFunc_expf, LibFunc_expl,
+	LibFunc_exp2, LibFunc_exp2f, LibFunc_exp2l,
+	LibFunc_fabs, LibFunc_fabsf, LibFunc_fabsl,
+	LibFunc_floor, LibFunc_floorf, LibFunc_floorl,
+	LibFunc_fmax, LibFunc_fmaxf, LibFunc_fmaxl,
+	LibFunc_fmin, LibFunc_fminf, LibFunc_fminl,
+	LibFunc_fmod, LibFunc_fmodf, LibFunc_fmodl,
+	LibFunc_log, LibFunc_logf, LibFunc_logl,
+	LibFunc_log10, LibFunc_log10f, LibFunc_log10l,
+	LibFunc_log2, LibFunc_log2f, LibFunc_log2l,
+	LibFunc_pow, LibFunc_powf, LibFunc_powl,
+	LibFunc_round, LibFunc_roundf, LibFunc_roundl,
+	LibFunc_sin, LibFunc_sinf, LibFunc_sinl,
+	LibFunc_sinh, LibFunc_sinhf, LibFunc_sinhl,
+	LibFunc_sqrt, LibFunc_sqrtf, LibFunc_sqrtl,
+	LibFunc_tan, LibFunc_tanf, LibFunc_tanl,
+	LibFunc_tanh, LibFunc_tanhf, LibFunc_tanhl,
+	LibFunc_trunc, LibFunc_truncf, LibFunc_truncl,
+};
+
+
+/*
+ * Change direct calls to the C library functions that have a protected version
+ *  in the module to call the protected version.  Only calls from functions that
+ *  could be protected are changed, the rest still call the library.
+ * Must be called after the lists from the command line and functions.config are read,
+ *  and before populateFnWorklist(), so the protected versions are found from main().
+ */
+void dataflowProtection::redirectLibCalls(Module& M) {
+	if (!protectedLibcFlag)
+		return;
+
+	unsigned numRedirected = 0;
+	for (auto & name : protectedLibcNames) {
+		Function* libF = M.getFunction(name);
+		Function* protF = M.getFunction(coast_libc_prefix + name);
+		if (!libF || !protF || protF->isDeclaration())
+			continue;
+		if (libF->getFunctionType() != protF->getFunctionType()) {
+			errs() << warn_string << " '" << protF->getName() << "' doesn't have the same type as '"
+				   << name << "', calls to it won't be changed\n";
+			continue;
+		}
+
+		std::vector<Instruction*> calls;
+		for (auto U : libF->users()) {
+			CallSite CS(U);
+			if (!CS || (CS.getCalledFunction() != libF))
+				continue;
+			Function* caller = CS.getInstruction()->getFunction();
+			if ( (caller == protF) || (fnsToSkip.find(caller) != fnsToSkip.end()) ||
+					isISR(*caller) || isCoarseGrainedFunction(caller->getName()) )
+				continue;
+			calls.push_back(CS.getInstruction());
+		}
+
+		for (auto I : calls) {
+			CallSite(I).setCalledFunction(protF);
+		}
+		numRedirected += calls.size();
+		if (verboseFlag && !calls.empty()) {
+			errs() << info_string << " " << calls.size() << " calls to '" << name
+				   << "' changed to call '" << protF->getName() << "'\n";
+		}
+	}
+
+	/*
+	 * Most calls to memcpy and memset are turned into intrinsics by clang, so they
+	 *  don't show up as calls to the names above.  The protected routines themselves
+	 *  are skipped, since their loops can be turned back into the same intrinsics.
+	 */
+	Function* protMemcpy = M.getFunction(coast_libc_prefix + "memcpy");
+	Function* protMemset = M.getFunction(coast_libc_prefix + "memset");
+	if (protMemcpy && (protMemcpy->isDeclaration() || (protMemcpy->arg_size() != 3)))
+		protMemcpy = nullptr;
+	if (protMemset && (protMemset->isDeclaration() || (protMemset->arg_size() != 3)))
+		protMemset = nullptr;
+
+	std::vector<MemIntrinsic*> intrinsics;
+	if (protMemcpy || protMemset) {
+		for (auto & F : M) {
+			if ( F.isDeclaration() || F.getName().startswith(coast_libc_prefix) ||
+					(fnsToSkip.find(&F) != fnsToSkip.end()) ||
+					isISR(F) || isCoarseGrainedFunction(F.getName()) )
+				continue;
+			for (auto & bb : F) {
+				for (auto & I : bb) {
+					MemIntrinsic* MI = dyn_cast<MemIntrinsic>(&I);
+					if (!MI || MI->isVolatile())
+						continue;
+					if ( (isa<MemCpyInst>(MI) && protMemcpy) || (isa<MemSetInst>(MI) && protMemset) )
+						intrinsics.push_back(MI);
+				}
+			}
+		}
+	}
+
+	for (auto MI : intrinsics) {
+		Function* protF = isa<MemCpyInst>(MI) ? protMemcpy : protMemset;
+		FunctionType* protTy = protF->getFunctionType();
+		IRBuilder<> builder(MI);
+		Value* dst = builder.CreatePointerCast(MI->getRawDest(), protTy->getParamType(0));
+		Value* srcOrVal;
+		if (MemCpyInst* MCI = dyn_cast<MemCpyInst>(MI)) {
+			srcOrVal = builder.CreatePointerCast(MCI->getRawSource(), protTy->getParamType(1));
+		} else {
+			srcOrVal = builder.CreateZExt(cast<MemSetInst>(MI)->getValue(), protTy->getParamType(1));
+		}
+		Value* len = builder.CreateZExtOrTrunc(MI->getLength(), protTy->getParamType(2));
+		CallInst* CI = builder.CreateCall(protF, {dst, srcOrVal, len});
+		CI->setDebugLoc(MI->getDebugLoc());
+		MI->eraseFromParent();
+	}
+	numRedirected += intrinsics.size();
+	if (verboseFlag && !intrinsics.empty()) {
+		errs() << info_string << " " << intrinsics.size()
+			   << " memcpy and memset intrinsics changed to call the protected versions\n";
+	}
+
+	if (numRedirected == 0) {
+		errs() << warn_string << " -protectedLibc didn't find any calls to change, "
+			   << "is COAST_libc.h included with COAST_LIBC_IMPLEMENTATION?\n";
+	}
+}
+
+
+// what was decided for each function, for the report
+struct CallDecision {
+	std::string kind;
+	std::string strategy;
+	unsigned calls = 0;
+};
+
+
+/*
+ * Classify the functions that are only declared, and pick how calls to them are handled.
+ * Must be called after the lists from the command line and functions.config are read,
+ *  and before populateValuesToClone().
+ */
+void dataflowProtection::classifyLibCalls(Module& M) {
+	if (!inferCallsFlag && !callReportFlag)
+		return;
+
+	TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+	TargetLibraryInfo TLI(TLII);
+	std::map<std::string, CallDecision> decisions;
+
+	for (auto & F : M) {
+		if (!F.isDeclaration() || !F.hasName())
+			continue;
+		StringRef name = F.getName();
+		if (name.startswith("llvm.dbg.") || name.startswith("llvm.lifetime."))
+			continue;
+
+		// only the ones called from code that could be protected
+		unsigned numCalls = 0;
+		for (auto U : F.users()) {
+			CallSite CS(U);
+			if (CS && (CS.getCalledFunction() == &F))
+				numCalls++;
+		}
+		if (!numCalls)
+			continue;
+
+		CallDecision& d = decisions[name.str()];
+		d.calls = numCalls;
+
+		// what LLVM knows about library functions that weren't marked by the front end
+		LibFunc libFunc;
+		bool isLibFunc = TLI.getLibFunc(F, libFunc);
+		if (isLibFunc && inferCallsFlag)
+			inferLibFuncAttributes(F, TLI);
+
+		bool pure = false;
+		if (isLibFunc && (mathLibFuncs.find(libFunc) != mathLibFuncs.end())) {
+			d.kind = "math";
+			pure = true;
+		} else if (F.doesNotAccessMemory()) {
+			d.kind = "readnone";
+			pure = F.doesNotThrow();
+		} else if (F.onlyReadsMemory()) {
+			d.kind = F.onlyAccessesArgMemory() ? "readonly, argmemonly" : "readonly";
+			pure = F.doesNotThrow();
+		} else if (F.onlyAccessesArgMemory()) {
+			d.kind = "argmemonly";
+		} else {
+			d.kind = "unknown";
+		}
+
+		// the lists in functions.config win
+		if (std::find(skipLibCalls.begin(), skipLibCalls.end(), name.str()) != skipLibCalls.end()) {
+			d.strategy = "once (skipLibCalls)";
+			continue;
+		}
+		if (std::find(coarseGrainedUserFunctions.begin(), coarseGrainedUserFunctions.end(),
+				name.str()) != coarseGrainedUserFunctions.end()) {
+			d.strategy = "replicate (replicateFnCalls)";
+			continue;
+		}
+
+		if (!pure || !inferCallsFlag) {
+			d.strategy = "replicate + sync";
+		} else if (pureCallsMode == "once") {
+			skipLibCalls.push_back(name.str());
+			d.strategy = "once";
+		} else {
+			pureCallFns.insert(&F);
+			d.strategy = "replicate";
+		}
+	}
+
+	if (verboseFlag && inferCallsFlag) {
+		errs() << info_string << " " << pureCallFns.size() << " functions can be called without a sync point\n";
+	}
+
+	if (callReportFlag) {
+		errs() << info_string << " handling of calls to external functions:\n";
+		errs() << "  function                          calls  kind                   strategy\n";
+		for (auto & entry : decisions) {
+			CallDecision& d = entry.second;
+			errs() << "  " << format("%-32s %6u  %-22s %s\n", entry.first.c_str(), d.calls,
+					d.kind.c_str(), d.strategy.c_str());
+		}
+	}
+}
+
+
+/*
+ * Can the function be called once for each copy instead of having its body replicated?
+ * Calling it again has to give the same result, so it can only write to its own locals,
+ *  and only read those and what its arguments point to.  Each call gets its own copy of
+ *  the arguments, so it reads its own copy of the memory.  It can only call intrinsics
+ *  and external functions that don't change memory.
+ */
+static bool isTemporalCandidate(Function& F, const TargetLibraryInfo& TLI) {
+	const DataLayout& DL = F.getParent()->getDataLayout();
+
+	for (auto & BB : F) {
+		for (auto & I : BB) {
+			if (I.isAtomic() || isa<InvokeInst>(&I) || isa<VAArgInst>(&I))
+				return false;
+
+			if (LoadInst* LI = dyn_cast<LoadInst>(&I)) {
+				if (LI->isVolatile())
+					return false;
+				Value* obj = GetUnderlyingObject(LI->getPointerOperand(), DL);
+				if (!isa<Argument>(obj) && !isa<AllocaInst>(obj))
+					return false;
+			} else if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+				if (SI->isVolatile() || !isa<AllocaInst>(GetUnderlyingObject(SI->getPointerOperand(), DL)))
+					return false;
+			} else if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+				Function* calledF = CI->getCalledFunction();
+				if (CI->isInlineAsm() || !calledF)
+					return false;
+				if (isa<DbgInfoIntrinsic>(CI) || (calledF->getIntrinsicID() == Intrinsic::lifetime_start) ||
+						(calledF->getIntrinsicID() == Intrinsic::lifetime_end))
+					continue;
+				if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(CI)) {
+					if (!isa<AllocaInst>(GetUnderlyingObject(MI->getRawDest(), DL)) || MI->isVolatile())
+						return false;
+					if (MemTransferInst* MT = dyn_cast<MemTransferInst>(MI)) {
+						Value* obj = GetUnderlyingObject(MT->getRawSource(), DL);
+						if (!isa<Argument>(obj) && !isa<AllocaInst>(obj))
+							return false;
+					}
+					continue;
+				}
+				LibFunc libFunc;
+				if (calledF->isDeclaration() && TLI.getLibFunc(*calledF, libFunc) &&
+						(mathLibFuncs.find(libFunc) != mathLibFuncs.end()))
+					continue;
+				if (!calledF->isDeclaration() || !calledF->doesNotAccessMemory())
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Pick the functions in the module that are called once for each copy instead of
+ *  being protected instruction by instruction.  The body is only there once, so the
+ *  code doesn't grow, and the copies of the result are voted on like any other value.
+ * Functions that were marked in any way are left alone.
+ * Must be called after the lists from the command line and functions.config are read,
+ *  and before populateFnWorklist().
+ */
+void dataflowProtection::selectTemporalFns(Module& M) {
+	if (!temporalPureFlag)
+		return;
+
+	TargetLibraryInfoImpl TLII(Triple(M.getTargetTriple()));
+	TargetLibraryInfo TLI(TLII);
+	std::vector<Function*> chosen;
+
+	for (auto & F : M) {
+		if (F.isDeclaration() || F.isVarArg() || F.hasAddressTaken() || !F.hasName())
+			continue;
+		if ( (F.getName() == "main") || isISR(F) || isCoarseGrainedFunction(F.getName()) )
+			continue;
+		if ( (fnsToClone.find(&F) != fnsToClone.end()) || (fnsToSkip.find(&F) != fnsToSkip.end()) ||
+				(replReturn.find(&F) != replReturn.end()) || (cloneAfterFnCall.find(&F) != cloneAfterFnCall.end()) ||
+				(protectedLibList.find(&F) != protectedLibList.end()) || (fnLevelMap.find(&F) != fnLevelMap.end()) )
+			continue;
+		if (std::find(skipLibCalls.begin(), skipLibCalls.end(), F.getName().str()) != skipLibCalls.end())
+			continue;
+		// given a level by name, which isn't in fnLevelMap until processProtectionLevels()
+		if ( (std::find(dwcFnList.begin(), dwcFnList.end(), F.getName().str()) != dwcFnList.end()) ||
+				(std::find(tmrFnList.begin(), tmrFnList.end(), F.getName().str()) != tmrFnList.end()) )
+			continue;
+
+		if (isTemporalCandidate(F, TLI))
+			chosen.push_back(&F);
+	}
+
+	for (auto F : chosen) {
+		coarseGrainedUserFunctions.push_back(F->getName().str());
+	}
+
+	if ( (verboseFlag || callReportFlag) && !chosen.empty() ) {
+		errs() << info_string << " functions called once for each copy:\n";
+		for (auto F : chosen) {
+			errs() << "  " << F->getName() << "\n";
+		}
+	}
+}
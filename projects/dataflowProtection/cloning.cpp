@@ -20,6 +20,7 @@
 
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <llvm/Analysis/AliasSetTracker.h>
 #include <llvm-c/Core.h>
 
@@ -36,6 +37,7 @@ extern std::list<std::string> skipLibCalls;
 extern std::list<std::string> coarseGrainedUserFunctions;
 extern std::list<std::string> protectedLib;
 extern cl::opt<bool> noMemReplicationFlag;
+extern cl::opt<bool> runtimeInitAllFlag;
 extern cl::opt<bool> verboseFlag;
 extern cl::opt<bool> noCloneOperandsCheckFlag;
 
@@ -244,6 +246,15 @@ void dataflowProtection::populateValuesToClone(Module& M) {
 					continue;
 				}
 
+				// checksummed constants only have one copy, so fixed addresses into them are shared
+				if (LoadInst* LI = dyn_cast<LoadInst>(&I)) {
+					if (!LI->isVolatile() && isChecksumConstAddress(LI->getPointerOperand()))
+						continue;
+				} else if (isa<GetElementPtrInst>(&I) || isa<BitCastInst>(&I)) {
+					if (isChecksumConstAddress(&I))
+						continue;
+				}
+
 				instsToClone.insert(&I);
 			}
 		}
@@ -684,10 +695,27 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 						cloneArg[i] = false;
 					}
 				}
+				// these are voted on at the call instead, see selectReplicatedArgs()
+				if (votedArgs.find(F) != votedArgs.end()) {
+					if (votedArgs[F].find(i) != votedArgs[F].end()) {
+						cloneArg[i] = false;
+					}
+				}
 			}
 		}
 		warnedFnPtrs = 0;
 
+		// pointers into the replica layout find their copies by adding the offset instead
+		std::set<unsigned> offsetArgNums;
+		if (offsetArgs.find(F) != offsetArgs.end()) {
+			for (auto argNum : offsetArgs[F]) {
+				if (cloneArg[argNum]) {
+					cloneArg[argNum] = false;
+					offsetArgNums.insert(argNum);
+				}
+			}
+		}
+
 		// Check if any parameters need clones
 		bool needClones = false;
 		for (auto b : cloneArg) {
@@ -700,6 +728,11 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 				PRINT_STRING("Doesn't need clones!");
 			}
 			#endif
+			for (auto argNum : offsetArgNums) {
+				addOffsetArgClone(&*std::next(F->arg_begin(), argNum));
+			}
+			if (votedArgs.find(F) != votedArgs.end())
+				votedArgNums[F] = votedArgs[F];
 			continue;
 		}
 
@@ -739,6 +772,7 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 		auto argItNew = Fnew->arg_begin();
 
 		ValueToValueMapTy paramMap;
+		std::vector<Argument*> offsetArgsNew;
 
 		while (i < numArgs) {
 			argItNew->setName(argIt->getName());
@@ -746,6 +780,11 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 			Argument* argNew = &*argItNew;
 			Argument* arg = &*argIt;
 			paramMap[arg] = argNew;
+			if (offsetArgNums.find(i) != offsetArgNums.end())
+				offsetArgsNew.push_back(argNew);
+			if ( (votedArgs.find(F) != votedArgs.end()) &&
+					(votedArgs[F].find(i) != votedArgs[F].end()) )
+				votedArgNums[Fnew].insert(argNew->getArgNo());
 
 			if (cloneArg[i]) {
 				argItNew++;
@@ -794,6 +833,11 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 			// Because there should only be one version of it in the list
 		}
 
+		// and keep the sync level of the original
+		if (fnSyncLevelMap.find(F) != fnSyncLevelMap.end()) {
+			fnSyncLevelMap[Fnew] = fnSyncLevelMap[F];
+		}
+
 		/*
 		 * This is needed because we clone functions into new functions while updating references.
 		 * Occasionally, functions had been cloned but instsToClone hadn't been updated,
@@ -804,6 +848,9 @@ void dataflowProtection::cloneFunctionArguments(Module & M) {
 		populateValuesToClone(M);
 		// there are also some special lists that may need to be updated
 		updateInstLists(F, Fnew);
+		for (auto arg : offsetArgsNew) {
+			addOffsetArgClone(arg);
+		}
 
 		// TODO: might want to break up this whole function right here into 2 parts
 		//  so that replacing calls all takes place after the function clones have
@@ -1214,6 +1261,9 @@ void dataflowProtection::cloneFunctionReturnVals(Module& M) {
 		BasicBlock& entryBB = newFunc->getEntryBlock();
 		replRetMap[F] = returns;
 		functionMap[F] = newFunc;
+		if (fnSyncLevelMap.find(F) != fnSyncLevelMap.end()) {
+			fnSyncLevelMap[newFunc] = fnSyncLevelMap[F];
+		}
 
 		// record these things
 		fnsToClone.insert(newFunc);
@@ -1674,6 +1724,7 @@ void dataflowProtection::validateRRFuncs(void) {
 
 	assert(!foundProblem && "must remove the original call!");
 	// If your code hits this assertion, please contact the maintainers
+	checkUsesLater.clear();
 }
 
 
@@ -2430,6 +2481,11 @@ void dataflowProtection::cloneGlobals(Module & M) {
 		if (std::find(clGlobalsToRuntimeInit.begin(), clGlobalsToRuntimeInit.end(), g->getName().str()) != clGlobalsToRuntimeInit.end()) {
 			globalsToRuntimeInit.insert(g);
 		}
+		// the copies of everything with an initial value can go in .bss instead of .data
+		else if (runtimeInitAllFlag && !g->isConstant() && !g->isThreadLocal() &&
+				g->hasDefinitiveInitializer() && !g->getInitializer()->isNullValue()) {
+			globalsToRuntimeInit.insert(g);
+		}
 	}
 
 	for (auto g : globalsToClone) {
@@ -2468,16 +2524,14 @@ void dataflowProtection::cloneGlobals(Module & M) {
 GlobalVariable * dataflowProtection::copyGlobal(Module & M, GlobalVariable* copyFrom, std::string newName) {
 
 	Constant * initializer;
+	bool isConstant = copyFrom->isConstant();
 
 	if (globalsToRuntimeInit.find(copyFrom) == globalsToRuntimeInit.end()) {
 		initializer = copyFrom->getInitializer();
 	} else {
-		Type * initType = copyFrom->getInitializer()->getType();
-
-		// for now we only support runtime initialization of arrays
-		assert(isa<ArrayType>(initType));
-
-		initializer = ConstantAggregateZero::get(initType);
+		// any type works, the copy is filled from the original at startup
+		initializer = Constant::getNullValue(copyFrom->getValueType());
+		isConstant = false;
 
 		if (verboseFlag)	errs() << "Using zero initializer for global " << newName << "\n";
 
@@ -2487,7 +2541,7 @@ GlobalVariable * dataflowProtection::copyGlobal(Module & M, GlobalVariable* copy
 	GlobalVariable* gNew = new GlobalVariable(
 		M,							/* Module */
 		copyFrom->getValueType(), 	/* Type */
-		copyFrom->isConstant(), 	/* isConstant */
+		isConstant,				 	/* isConstant */
 		copyFrom->getLinkage(),		/* Linkage */
 		initializer,				/* Initializer */
 		newName,					/* Name */
@@ -2538,53 +2592,117 @@ GlobalVariable * dataflowProtection::copyGlobal(Module & M, GlobalVariable* copy
 
 
 /*
- * For all globals that need to be initialized at runtime, insert memcpy calls at the start of main
+ * For all globals that need to be initialized at runtime, fill the copies from the originals
+ *  at startup.
+ * Instead of a memcpy for each copy, there's a table with an entry for each global,
+ *  and a single function that goes through it.  Each word of the original is loaded
+ *  once and stored to all of the copies.
+ * The function is a global constructor with priority 0, so it runs before main()
+ *  and any of the program's own constructors.
  */
 void dataflowProtection::addGlobalRuntimeInit(Module & M) {
+	// the copies could have been skipped
+	std::vector<GlobalVariable*> toInit;
 	for (auto g : globalsToRuntimeInit) {
-		ArrayType * arrayType = dyn_cast<ArrayType>(g->getType()->getContainedType(0));
-
-		assert(arrayType);
-
-		std::vector<Type *> arg_type_v;
-		arg_type_v.push_back(Type::getInt8PtrTy(M.getContext()));
-		arg_type_v.push_back(Type::getInt8PtrTy(M.getContext()));
-		arg_type_v.push_back(Type::getInt64Ty(M.getContext()));
-		ArrayRef<Type*> arg_type = ArrayRef<Type*>(arg_type_v);
-
-		// this is an Eclipse error because the definition comes from a built file with an include guard,
-		//  but this is a correct enum in Intrinsic.
-		Function * fun = Intrinsic::getDeclaration(&M, Intrinsic::memcpy, arg_type);
-		IRBuilder<> Builder(&(*(M.getFunction("main")->begin()->begin())));
-
-		std::vector<Value *> args_v;
-
-		// 1st argument is destination pointer (cast to i8*)
-		args_v.push_back(ConstantExpr::getBitCast(cast<Constant>(cloneMap[g].first), Type::getInt8PtrTy(M.getContext())));
-
-		// 2nd argument is source pointer (cast to i8*)
-		args_v.push_back(ConstantExpr::getBitCast(cast<Constant>(g), Type::getInt8PtrTy(M.getContext())));
+		if (cloneMap.find(g) != cloneMap.end())
+			toInit.push_back(g);
+	}
+	if (toInit.empty())
+		return;
 
-		// 3rd argument is size of array in bytes
-		args_v.push_back(ConstantInt::get(Type::getInt64Ty(M.getContext()), getArrayTypeSize(M, arrayType)));
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	Type* intPtrTy = DL.getIntPtrType(C);
+	unsigned wordSize = DL.getTypeAllocSize(intPtrTy);
+	unsigned numCopies = TMR ? 2 : 1;
 
-		// 4th argument is alignment (bitwidth of array element)
-		args_v.push_back(ConstantInt::get(fun->getFunctionType()->getParamType(3), getArrayTypeElementBitWidth(M, arrayType)));
+	std::vector<std::vector<GlobalVariable*> > toCopy;
+	for (auto g : toInit) {
+		std::vector<GlobalVariable*> copies = {g, cast<GlobalVariable>(cloneMap[g].first)};
+		if (TMR)
+			copies.push_back(cast<GlobalVariable>(cloneMap[g].second));
+		toCopy.push_back(copies);
 
-		// 5th argument is volatile (boolean)
-		args_v.push_back(ConstantInt::getNullValue(fun->getFunctionType()->getParamType(4)));
-		ArrayRef<Value*> args = ArrayRef<Value*>(args_v);
+		if (verboseFlag)
+			errs() << "Initializing the copies of " << g->getName() << " at startup\n";
+	}
 
+	GlobalVariable* table = createReplicaTable(M, toCopy, "__COAST_init_table");
+	Type* tableTy = table->getValueType();
+
+	Function* initFn = Function::Create(FunctionType::get(Type::getVoidTy(C), false),
+			GlobalValue::InternalLinkage, "__COAST_init_replicas", &M);
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", initFn);
+	BasicBlock* globalBB = BasicBlock::Create(C, "global", initFn);
+	BasicBlock* wordBB = BasicBlock::Create(C, "word", initFn);
+	BasicBlock* byteCondBB = BasicBlock::Create(C, "byte.cond", initFn);
+	BasicBlock* byteBB = BasicBlock::Create(C, "byte", initFn);
+	BasicBlock* nextBB = BasicBlock::Create(C, "next", initFn);
+	BasicBlock* retBB = BasicBlock::Create(C, "ret", initFn);
+	IRBuilder<> builder(entryBB);
+	Constant* zero = ConstantInt::get(intPtrTy, 0);
+	Constant* one = ConstantInt::get(intPtrTy, 1);
+	builder.CreateBr(globalBB);
+
+	// read the table entry
+	builder.SetInsertPoint(globalBB);
+	PHINode* idx = builder.CreatePHI(intPtrTy, 2, "idx");
+	idx->addIncoming(zero, entryBB);
+	std::vector<Value*> ptrs;
+	for (unsigned i = 0; i <= numCopies; i++) {
+		Value* fieldAddr = builder.CreateInBoundsGEP(tableTy, table,
+				{zero, idx, builder.getInt32(i)});
+		ptrs.push_back(builder.CreateLoad(fieldAddr));
+	}
+	Value* sizeAddr = builder.CreateInBoundsGEP(tableTy, table,
+			{zero, idx, builder.getInt32(numCopies + 1)});
+	Value* size = builder.CreateLoad(sizeAddr, "size");
+	Value* numWords = builder.CreateUDiv(size, ConstantInt::get(intPtrTy, wordSize), "words");
+	builder.CreateCondBr(builder.CreateICmpEQ(numWords, zero), byteCondBB, wordBB);
+
+	// copy whole words
+	builder.SetInsertPoint(wordBB);
+	PHINode* word = builder.CreatePHI(intPtrTy, 2, "w");
+	word->addIncoming(zero, globalBB);
+	Type* wordPtrTy = intPtrTy->getPointerTo();
+	Value* srcWord = builder.CreateGEP(builder.CreateBitCast(ptrs[0], wordPtrTy), word);
+	LoadInst* wordVal = builder.CreateLoad(srcWord);
+	wordVal->setAlignment(wordSize);
+	for (unsigned i = 1; i <= numCopies; i++) {
+		Value* dstWord = builder.CreateGEP(builder.CreateBitCast(ptrs[i], wordPtrTy), word);
+		builder.CreateStore(wordVal, dstWord)->setAlignment(wordSize);
+	}
+	Value* nextWord = builder.CreateAdd(word, one);
+	word->addIncoming(nextWord, wordBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextWord, numWords), wordBB, byteCondBB);
+
+	// then whatever bytes are left over
+	builder.SetInsertPoint(byteCondBB);
+	Value* wordBytes = builder.CreateMul(numWords, ConstantInt::get(intPtrTy, wordSize));
+	builder.CreateCondBr(builder.CreateICmpULT(wordBytes, size), byteBB, nextBB);
+
+	builder.SetInsertPoint(byteBB);
+	PHINode* byte = builder.CreatePHI(intPtrTy, 2, "b");
+	byte->addIncoming(wordBytes, byteCondBB);
+	Value* byteVal = builder.CreateLoad(builder.CreateGEP(ptrs[0], byte));
+	for (unsigned i = 1; i <= numCopies; i++) {
+		builder.CreateStore(byteVal, builder.CreateGEP(ptrs[i], byte));
+	}
+	Value* nextByte = builder.CreateAdd(byte, one);
+	byte->addIncoming(nextByte, byteBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextByte, size), byteBB, nextBB);
 
-		Builder.CreateCall(fun, args);
+	builder.SetInsertPoint(nextBB);
+	Value* nextIdx = builder.CreateAdd(idx, one);
+	idx->addIncoming(nextIdx, nextBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, ConstantInt::get(intPtrTy, toCopy.size())),
+			globalBB, retBB);
 
-		if (TMR) {
-			args_v[0] = ConstantExpr::getBitCast(cast<Constant>(cloneMap[g].second), Type::getInt8PtrTy(M.getContext()));
-			args = ArrayRef<Value*>(args_v);
-			Builder.CreateCall(fun, args);
-		}
+	builder.SetInsertPoint(retBB);
+	builder.CreateRetVoid();
 
-	}
+	// before any of the program's own constructors, which could read the copies
+	appendToGlobalCtors(M, initFn, 0);
 }
 
 
@@ -0,0 +1,355 @@
+/*
+ * constChecksum.cpp
+ *
+ * This file contains the logic for protecting constant globals with a checksum
+ *  instead of replicating them.
+ * Lookup tables (S-boxes, CRC tables, etc.) can't be written to, so the copies
+ *  only protect against upsets in the memory holding them.  A single copy with
+ *  a checksum computed at compile time catches the same upsets, and uses a third
+ *  (TMR) or half (DWC) of the memory.
+ * The checksum is checked at the start of every protected function that uses the
+ *  constant, or only when the scrubbing function __COAST_CHECK_CONSTANTS() is called.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <list>
+#include <string>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Operator.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> checksumConstFlag;
+extern cl::opt<std::string> constCheckMode;
+extern cl::opt<bool> noMemReplicationFlag;
+extern cl::opt<bool> verboseFlag;
+extern std::list<std::string> ignoreGlbl;
+
+// shared variables
+extern std::string fault_function_name;
+std::string const_checksum_fn_name = "__COAST_constChecksum";
+
+// 32-bit FNV-1a
+// Each step is invertible, so any change to a single byte always changes the result
+const uint32_t fnv_offset = 2166136261u;
+const uint32_t fnv_prime = 16777619u;
+
+
+/*
+ * Append the bytes of an integer as it will be laid out in memory
+ */
+static void appendIntBytes(const APInt &val, uint64_t storeSize, uint64_t allocSize,
+		bool littleEndian, std::vector<uint8_t> &bytes) {
+	APInt wide = val.zextOrSelf(storeSize * 8);
+	for (uint64_t i = 0; i < storeSize; i++) {
+		uint64_t byteNum = littleEndian ? i : (storeSize - 1 - i);
+		bytes.push_back((uint8_t)wide.extractBits(8, byteNum * 8).getZExtValue());
+	}
+	bytes.insert(bytes.end(), allocSize - storeSize, 0);
+}
+
+
+/*
+ * Get the bytes of a global initializer, the same as they will be in memory.
+ * Returns false if it contains something that isn't known until link time,
+ *  like the address of another global.
+ */
+bool getInitializerBytes(Constant* C, const DataLayout &DL, std::vector<uint8_t> &bytes) {
+	Type* ty = C->getType();
+	uint64_t allocSize = DL.getTypeAllocSize(ty);
+
+	if (isa<ConstantAggregateZero>(C) || isa<ConstantPointerNull>(C)) {
+		bytes.insert(bytes.end(), allocSize, 0);
+		return true;
+	} else if (ConstantInt* CI = dyn_cast<ConstantInt>(C)) {
+		appendIntBytes(CI->getValue(), DL.getTypeStoreSize(ty), allocSize, DL.isLittleEndian(), bytes);
+		return true;
+	} else if (ConstantFP* CF = dyn_cast<ConstantFP>(C)) {
+		appendIntBytes(CF->getValueAPF().bitcastToAPInt(), DL.getTypeStoreSize(ty), allocSize,
+				DL.isLittleEndian(), bytes);
+		return true;
+	} else if (ConstantDataArray* CDA = dyn_cast<ConstantDataArray>(C)) {
+		for (unsigned i = 0; i < CDA->getNumElements(); i++) {
+			if (!getInitializerBytes(CDA->getElementAsConstant(i), DL, bytes))
+				return false;
+		}
+		return true;
+	} else if (ConstantArray* CA = dyn_cast<ConstantArray>(C)) {
+		for (unsigned i = 0; i < CA->getNumOperands(); i++) {
+			if (!getInitializerBytes(CA->getOperand(i), DL, bytes))
+				return false;
+		}
+		return true;
+	} else if (ConstantStruct* CS = dyn_cast<ConstantStruct>(C)) {
+		// padding between fields is filled with zeros
+		const StructLayout* SL = DL.getStructLayout(CS->getType());
+		size_t start = bytes.size();
+		for (unsigned i = 0; i < CS->getNumOperands(); i++) {
+			bytes.resize(start + SL->getElementOffset(i), 0);
+			if (!getInitializerBytes(CS->getOperand(i), DL, bytes))
+				return false;
+		}
+		bytes.resize(start + allocSize, 0);
+		return true;
+	}
+	return false;
+}
+
+
+/*
+ * Constant globals that would be cloned are kept as a single copy instead,
+ *  and the checksum of their initializer is saved for later.
+ * Must be called before populateValuesToClone(), because the loads from them
+ *  are shared between the copies.
+ */
+void dataflowProtection::selectChecksumGlobals(Module& M) {
+	if (!checksumConstFlag || noMemReplicationFlag)
+		return;
+
+	if ( (constCheckMode != "call") && (constCheckMode != "scrub") ) {
+		errs() << err_string << " unknown value '" << constCheckMode
+			   << "' for -constCheck, must be 'call' or 'scrub'\n";
+		std::exit(-1);
+	}
+
+	const DataLayout &DL = M.getDataLayout();
+	for (GlobalVariable & g : M.getGlobalList()) {
+		if (g.getName().startswith("llvm"))
+			continue;
+		if (!g.isConstant() || !g.hasDefinitiveInitializer())
+			continue;
+		if (globalsToSkip.find(&g) != globalsToSkip.end())
+			continue;
+		if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g.getName().str()) != ignoreGlbl.end())
+			continue;
+		// same as in populateValuesToClone()
+		if ( !xMR_default && (globalsToClone.find(&g) == globalsToClone.end()) )
+			continue;
+
+		std::vector<uint8_t> bytes;
+		if (!getInitializerBytes(g.getInitializer(), DL, bytes)) {
+			if (verboseFlag)
+				errs() << info_string << " can't compute the checksum of '" << g.getName()
+					   << "', it will be replicated\n";
+			continue;
+		}
+
+		uint32_t sum = fnv_offset;
+		for (auto b : bytes) {
+			sum ^= b;
+			sum *= fnv_prime;
+		}
+		checksumGlobals[&g] = sum;
+	}
+
+	for (auto entry : checksumGlobals) {
+		GlobalVariable* g = entry.first;
+		globalsToClone.erase(g);
+		globalsToSkip.insert(g);
+		if (verboseFlag)
+			errs() << "Checksum instead of cloning constant: " << g->getName() << " ("
+				   << DL.getTypeAllocSize(g->getValueType()) << " bytes)\n";
+	}
+}
+
+
+/*
+ * Returns true if the pointer is a fixed address inside of a checksummed constant.
+ * Loads from these addresses would be the same for every copy, so they can be shared.
+ */
+bool dataflowProtection::isChecksumConstAddress(Value* ptr) {
+	if (checksumGlobals.size() == 0)
+		return false;
+
+	Value* base = ptr->stripPointerCasts();
+	while (GEPOperator* gep = dyn_cast<GEPOperator>(base)) {
+		// an index computed at run time is replicated, so the load must be too
+		if (!gep->hasAllConstantIndices())
+			return false;
+		base = gep->getPointerOperand()->stripPointerCasts();
+	}
+
+	GlobalVariable* gv = dyn_cast<GlobalVariable>(base);
+	return gv && (checksumGlobals.find(gv) != checksumGlobals.end());
+}
+
+
+/*
+ * Creates the function that computes the checksum of a range of memory.
+ * The loads are volatile so they aren't folded using the initializer.
+ */
+static Function* getChecksumFunction(Module& M) {
+	if (Function* existing = M.getFunction(const_checksum_fn_name))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	Type* i8PtrTy = Type::getInt8PtrTy(C);
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	FunctionType* fnTy = FunctionType::get(i32Ty, {i8PtrTy, i32Ty}, false);
+	Function* sumFn = Function::Create(fnTy, GlobalValue::InternalLinkage, const_checksum_fn_name, &M);
+	sumFn->addFnAttr(Attribute::NoInline);
+
+	auto argIt = sumFn->arg_begin();
+	Argument* data = &*argIt++;
+	Argument* len = &*argIt;
+	data->setName("data");
+	len->setName("len");
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", sumFn);
+	BasicBlock* loopBB = BasicBlock::Create(C, "loop", sumFn);
+	BasicBlock* doneBB = BasicBlock::Create(C, "done", sumFn);
+	Constant* offset = ConstantInt::get(i32Ty, fnv_offset);
+
+	IRBuilder<> builder(entryBB);
+	Value* isEmpty = builder.CreateICmpEQ(len, ConstantInt::get(i32Ty, 0), "empty");
+	builder.CreateCondBr(isEmpty, doneBB, loopBB);
+
+	builder.SetInsertPoint(loopBB);
+	PHINode* idx = builder.CreatePHI(i32Ty, 2, "i");
+	PHINode* hash = builder.CreatePHI(i32Ty, 2, "h");
+	Value* addr = builder.CreateGEP(data, idx, "addr");
+	Value* byte = builder.CreateLoad(addr, true, "byte");
+	Value* mixed = builder.CreateXor(hash, builder.CreateZExt(byte, i32Ty), "mixed");
+	Value* nextHash = builder.CreateMul(mixed, ConstantInt::get(i32Ty, fnv_prime), "h.next");
+	Value* nextIdx = builder.CreateAdd(idx, ConstantInt::get(i32Ty, 1), "i.next");
+	Value* more = builder.CreateICmpULT(nextIdx, len, "more");
+	builder.CreateCondBr(more, loopBB, doneBB);
+	idx->addIncoming(ConstantInt::get(i32Ty, 0), entryBB);
+	idx->addIncoming(nextIdx, loopBB);
+	hash->addIncoming(offset, entryBB);
+	hash->addIncoming(nextHash, loopBB);
+
+	builder.SetInsertPoint(doneBB);
+	PHINode* result = builder.CreatePHI(i32Ty, 2, "sum");
+	result->addIncoming(offset, entryBB);
+	result->addIncoming(nextHash, loopBB);
+	builder.CreateRet(result);
+
+	return sumFn;
+}
+
+
+/*
+ * Insert the code that compares the checksums of the globals against the saved values.
+ * Returns the result of all of the comparisons, true if nothing has changed.
+ */
+static Value* createChecksumCompare(IRBuilder<> &builder, Function* sumFn,
+		std::map<GlobalVariable*, uint32_t> &globals, const DataLayout &DL) {
+	Value* allMatch = nullptr;
+	for (auto entry : globals) {
+		GlobalVariable* g = entry.first;
+		uint64_t size = DL.getTypeAllocSize(g->getValueType());
+		Value* ptr = builder.CreateBitCast(g, builder.getInt8PtrTy());
+		Value* sum = builder.CreateCall(sumFn, {ptr, builder.getInt32(size)}, "constSum");
+		Value* match = builder.CreateICmpEQ(sum, builder.getInt32(entry.second), "constCheck");
+		allMatch = allMatch ? builder.CreateAnd(allMatch, match) : match;
+	}
+	return allMatch;
+}
+
+
+/*
+ * Check the constants at the start of each protected function that uses them,
+ *  and fill in the body of the scrubbing function if it's needed.
+ */
+void dataflowProtection::insertConstChecks(Module& M) {
+	Function* scrubFn = M.getFunction(const_scrub_fn_name);
+	if (checksumGlobals.size() == 0) {
+		// nothing to check, but calls to the scrubbing function still need something to link to
+		if (scrubFn && scrubFn->isDeclaration() && !isLevelSubset) {
+			BasicBlock* entryBB = BasicBlock::Create(M.getContext(), "entry", scrubFn);
+			ReturnInst::Create(M.getContext(), entryBB);
+		}
+		return;
+	}
+
+	const DataLayout &DL = M.getDataLayout();
+	Function* sumFn = getChecksumFunction(M);
+	Function* errFn = M.getFunction(fault_function_name);
+	assert(errFn && "error function exists");
+
+	if (constCheckMode == "call") {
+		for (auto F : fnsToClone) {
+			if (isCoarseGrainedFunction(F->getName()) || F->isDeclaration() || (F == errFn))
+				continue;
+			BasicBlock* errBlock = errBlockMap[F];
+			if (!errBlock)
+				continue;
+
+			// which of the constants this function reads from, or passes to other functions
+			std::map<GlobalVariable*, uint32_t> usedGlobals;
+			for (auto & bb : *F) {
+				for (auto & I : bb) {
+					for (auto & op : I.operands()) {
+						if (!op->getType()->isPointerTy())
+							continue;
+						Value* base = op->stripPointerCasts();
+						while (GEPOperator* gep = dyn_cast<GEPOperator>(base)) {
+							base = gep->getPointerOperand()->stripPointerCasts();
+						}
+						GlobalVariable* gv = dyn_cast<GlobalVariable>(base);
+						if (gv && (checksumGlobals.find(gv) != checksumGlobals.end()))
+							usedGlobals[gv] = checksumGlobals[gv];
+					}
+				}
+			}
+			if (usedGlobals.size() == 0)
+				continue;
+
+			// check after the local variables are allocated
+			BasicBlock* entryBB = &F->getEntryBlock();
+			Instruction* checkPt = entryBB->getFirstNonPHIOrDbgOrLifetime();
+			while (isa<AllocaInst>(checkPt))
+				checkPt = checkPt->getNextNode();
+
+			IRBuilder<> builder(checkPt);
+			if (checkPt->getDebugLoc())
+				builder.SetCurrentDebugLocation(checkPt->getDebugLoc());
+			Value* allMatch = createChecksumCompare(builder, sumFn, usedGlobals, DL);
+
+			BasicBlock* contBB = entryBB->splitBasicBlock(checkPt, F->getName() + ".constOk");
+			entryBB->getTerminator()->eraseFromParent();
+			BranchInst::Create(contBB, errBlock, allMatch, entryBB);
+		}
+	}
+
+	// The scrubbing function is only filled in once
+	if (isLevelSubset)
+		return;
+	if ( (constCheckMode != "scrub") && !scrubFn )
+		return;
+	if (scrubFn && !scrubFn->isDeclaration())
+		return;
+
+	LLVMContext& C = M.getContext();
+	if (!scrubFn) {
+		FunctionType* scrubTy = FunctionType::get(Type::getVoidTy(C), false);
+		scrubFn = Function::Create(scrubTy, GlobalValue::ExternalLinkage, const_scrub_fn_name, &M);
+	}
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", scrubFn);
+	BasicBlock* okBB = BasicBlock::Create(C, "ok", scrubFn);
+	BasicBlock* errBB = BasicBlock::Create(C, "error", scrubFn);
+
+	IRBuilder<> builder(entryBB);
+	Value* allMatch = createChecksumCompare(builder, sumFn, checksumGlobals, DL);
+	builder.CreateCondBr(allMatch, okBB, errBB);
+	builder.SetInsertPoint(okBB);
+	builder.CreateRetVoid();
+	builder.SetInsertPoint(errBB);
+	builder.CreateCall(errFn);
+	builder.CreateUnreachable();
+
+	if (verboseFlag)
+		errs() << info_string << " checking " << checksumGlobals.size() << " constants in "
+			   << const_scrub_fn_name << "()\n";
+}
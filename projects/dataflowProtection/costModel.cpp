@@ -0,0 +1,484 @@
+/*
+ * costModel.cpp
+ *
+ * This file contains a static estimate of the overhead of protecting each
+ *  function and global, and the logic that picks the protection scope when
+ *  the user gives an overhead budget.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <list>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<unsigned> overheadBudget;
+extern cl::opt<bool> costReportFlag;
+extern cl::opt<std::string> costProfileFile;
+extern cl::opt<std::string> budgetConfigFile;
+extern cl::opt<bool> noMemReplicationFlag;
+extern cl::opt<bool> storeDataSyncFlag;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::list<std::string> skipLibCalls;
+extern std::list<std::string> coarseGrainedUserFunctions;
+extern std::list<std::string> ignoreGlbl;
+extern std::list<std::string> clGlobalsToRuntimeInit;
+extern std::list<std::string> isrFuncNameList;
+
+
+//----------------------------------------------------------------------------//
+// Instruction costs
+//----------------------------------------------------------------------------//
+/*
+ * Rough reciprocal throughput, in cycles, of each kind of instruction on a
+ *  small in-order core (like the Cortex-A9 on the pynq).
+ * We don't have a target machine available inside the pass, so this stands
+ *  in for the scheduling model that llvm-mca would use.
+ */
+static unsigned getInstructionCost(Instruction& I) {
+	if (isa<DbgInfoIntrinsic>(&I))
+		return 0;
+
+	switch (I.getOpcode()) {
+		case Instruction::PHI:
+		case Instruction::Alloca:
+		case Instruction::BitCast:
+		case Instruction::PtrToInt:
+		case Instruction::IntToPtr:
+			return 0;
+		case Instruction::Load:
+			return 3;
+		case Instruction::Mul:
+			return 3;
+		case Instruction::UDiv:
+		case Instruction::SDiv:
+		case Instruction::URem:
+		case Instruction::SRem:
+			return 20;
+		case Instruction::FAdd:
+		case Instruction::FSub:
+		case Instruction::FMul:
+		case Instruction::FPToUI:
+		case Instruction::FPToSI:
+		case Instruction::UIToFP:
+		case Instruction::SIToFP:
+			return 4;
+		case Instruction::FDiv:
+		case Instruction::FRem:
+			return 20;
+		case Instruction::Call:
+		case Instruction::Invoke:
+			return 5;
+		default:
+			return 1;
+	}
+}
+
+
+/*
+ * Static cost of a single synchronization point.
+ * TMR votes with 2 compares and 2 selects, DWC does a compare and a branch.
+ */
+static unsigned getSyncCost(int numClones) {
+	return (numClones == 3) ? 4 : 3;
+}
+
+
+/*
+ * Mirrors the decisions made in populateSyncPoints(), without needing
+ *  any of the cloning to have been done yet.
+ */
+static bool willBeSyncPoint(Instruction& I) {
+	if (I.isTerminator()) {
+		if (isa<UnreachableInst>(&I))
+			return false;
+		// unconditional branches have nothing to vote on
+		if (BranchInst* BI = dyn_cast<BranchInst>(&I))
+			return BI->isConditional();
+		if (ReturnInst* RI = dyn_cast<ReturnInst>(&I))
+			return RI->getReturnValue() != nullptr;
+		return true;
+	}
+
+	if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+		if (CI->isInlineAsm())
+			return false;
+		Function* calledF = CI->getCalledFunction();
+		if (!calledF || isa<DbgInfoIntrinsic>(CI))
+			return false;
+		if (calledF->getName().startswith("llvm.lifetime."))
+			return false;
+		return calledF->hasExternalLinkage() && calledF->isDeclaration();
+	}
+
+	if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+		if (SI->getValueOperand()->getType()->isPointerTy())
+			return false;
+		return noMemReplicationFlag || storeDataSyncFlag;
+	}
+
+	if (isa<GetElementPtrInst>(&I)) {
+		return noMemReplicationFlag;
+	}
+
+	return false;
+}
+
+
+/*
+ * Reads function entry counts from a profile file.
+ * Each line is "functionName count"; lines starting with '#' are ignored.
+ * Returns false if the file could not be read.
+ */
+static bool readProfileCounts(std::string fileName, std::map<std::string, double> &counts) {
+	std::ifstream ifs(fileName, std::ifstream::in);
+	if (!ifs.is_open())
+		return false;
+
+	std::string line;
+	while (getline(ifs, line)) {
+		if ( (line.length() == 0) || (line[0] == '#') )
+			continue;
+
+		std::istringstream iss(line);
+		std::string fnName;
+		double count;
+		if (iss >> fnName >> count) {
+			counts[fnName] = count;
+		}
+	}
+	ifs.close();
+	return true;
+}
+
+
+//----------------------------------------------------------------------------//
+// Estimation
+//----------------------------------------------------------------------------//
+/*
+ * Estimate the per-call runtime and code-size overhead of protecting each function,
+ *  and how often each function is called.
+ * Without a profile, call frequency is propagated down the call graph from the
+ *  functions that are not called by anything else in the module.
+ */
+void dataflowProtection::estimateOverhead(Module& M, int numClones) {
+	if (!overheadBudget.getNumOccurrences() && !costReportFlag)
+		return;
+
+	std::map<Function*, std::map<BasicBlock*, double> > blockWeights;
+	std::map<Function*, std::vector<CallInst*> > callersOf;
+
+	for (auto & F : M) {
+		if (F.isDeclaration())
+			continue;
+
+		ProtectionCost cost;
+		DominatorTree DT(F);
+		LoopInfo LI(DT);
+
+		for (auto & bb : F) {
+			double weight = getLoopWeight(LI.getLoopDepth(&bb));
+			blockWeights[&F][&bb] = weight;
+
+			for (auto & I : bb) {
+				unsigned instCost = getInstructionCost(I);
+				cost.baseCycles += weight * instCost;
+				cost.staticInsts++;
+
+				// terminators aren't replicated, but everything else in the body is
+				if (!I.isTerminator() && !isa<DbgInfoIntrinsic>(&I)) {
+					cost.overheadCycles += weight * instCost * (numClones - 1);
+					cost.overheadInsts += (numClones - 1);
+				}
+
+				if (willBeSyncPoint(I) && keepsSyncPoint(&I, getSyncLevel(&F))) {
+					cost.overheadCycles += weight * getSyncCost(numClones);
+					cost.overheadInsts += getSyncCost(numClones);
+					cost.syncSites++;
+				}
+
+				if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+					Function* calledF = CI->getCalledFunction();
+					if (calledF && !calledF->isDeclaration())
+						callersOf[calledF].push_back(CI);
+				}
+			}
+		}
+
+		fnCostMap[&F] = cost;
+	}
+
+	// Figure out how many times each function runs
+	std::map<std::string, double> profileCounts;
+	bool haveProfile = false;
+	if (costProfileFile != "") {
+		haveProfile = readProfileCounts(costProfileFile, profileCounts);
+		if (!haveProfile) {
+			errs() << warn_string << " could not read profile '" << costProfileFile
+				   << "', using static estimates instead\n";
+		}
+	}
+
+	if (haveProfile) {
+		for (auto & entry : fnCostMap) {
+			auto found = profileCounts.find(entry.first->getName().str());
+			entry.second.calls = (found == profileCounts.end()) ? 0 : found->second;
+		}
+	} else {
+		// Functions with no callers in the module are the roots.
+		// Walk the call graph in order, ignoring back edges from recursion.
+		std::map<Function*, int> state;		// 0 = unvisited, 1 = on stack, 2 = done
+		std::function<double(Function*)> getCalls = [&](Function* F) -> double {
+			if (state[F] == 2)
+				return fnCostMap[F].calls;
+			if (state[F] == 1)
+				return 0;
+			state[F] = 1;
+
+			double calls = 0;
+			auto found = callersOf.find(F);
+			if ( (found == callersOf.end()) || F->hasAddressTaken() ) {
+				calls = 1;
+			}
+			if (found != callersOf.end()) {
+				for (auto CI : found->second) {
+					Function* parentF = CI->getFunction();
+					calls += getCalls(parentF) * blockWeights[parentF][CI->getParent()];
+				}
+			}
+
+			state[F] = 2;
+			fnCostMap[F].calls = calls;
+			return calls;
+		};
+
+		for (auto & entry : fnCostMap) {
+			getCalls(entry.first);
+		}
+	}
+
+	// Globals only cost memory, one extra copy for each clone
+	const DataLayout& DL = M.getDataLayout();
+	for (GlobalVariable & g : M.getGlobalList()) {
+		if (g.getName().startswith("llvm"))
+			continue;
+		if (g.hasExternalLinkage() && !g.hasInitializer())
+			continue;
+		uint64_t bytes = DL.getTypeAllocSize(g.getValueType());
+		globalCostMap[&g] = bytes * (numClones - 1);
+	}
+
+	if (costReportFlag) {
+		errs() << info_string << " estimated protection overhead (" << numClones << " copies):\n";
+		errs() << "  function                                calls     base cyc    extra cyc   +insts    syncs\n";
+		for (auto & entry : fnCostMap) {
+			ProtectionCost &c = entry.second;
+			std::string name = entry.first->getName().str();
+			errs() << "  " << format("%-32s %12.0f %12.0f %12.0f %8u %8u\n", name.c_str(), c.calls,
+					c.calls * c.baseCycles, c.calls * c.overheadCycles, c.overheadInsts, c.syncSites);
+		}
+		errs() << "  global                                 +bytes\n";
+		for (auto & entry : globalCostMap) {
+			std::string name = entry.first->getName().str();
+			errs() << "  " << format("%-32s %12lu\n", name.c_str(), (unsigned long)entry.second);
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------//
+// Scope selection
+//----------------------------------------------------------------------------//
+/*
+ * Given a budget, as a percentage of the estimated unprotected run time,
+ *  pick the set of functions which covers the most dynamic instructions.
+ * This is a knapsack problem; the greedy choice by coverage per cycle of overhead
+ *  is good enough here, since the estimates are rough anyway.
+ * Functions the user has already put in or out of scope are left alone.
+ */
+void dataflowProtection::applyOverheadBudget() {
+	if (!overheadBudget.getNumOccurrences())
+		return;
+
+	std::vector<Function*> candidates;
+	std::set<Function*> chosen;
+	double totalBase = 0;
+	double spent = 0;
+
+	for (auto & entry : fnCostMap) {
+		Function* F = entry.first;
+		ProtectionCost &c = entry.second;
+		totalBase += c.calls * c.baseCycles;
+
+		if (isISR(*F) || isCoarseGrainedFunction(F->getName()))
+			continue;
+		if (fnsToSkip.find(F) != fnsToSkip.end())
+			continue;
+		// marked by the user to be cloned, so it has to be paid for first
+		if (!xMR_default && (fnsToClone.find(F) != fnsToClone.end())) {
+			chosen.insert(F);
+			spent += c.calls * c.overheadCycles;
+			continue;
+		}
+		candidates.push_back(F);
+	}
+
+	double budget = totalBase * overheadBudget / 100.0;
+
+	std::sort(candidates.begin(), candidates.end(), [&](Function* a, Function* b) {
+		ProtectionCost &ca = fnCostMap[a];
+		ProtectionCost &cb = fnCostMap[b];
+		// coverage per unit of overhead, cross-multiplied to avoid dividing by 0
+		return (ca.calls * ca.baseCycles) * (cb.calls * cb.overheadCycles) >
+			   (cb.calls * cb.baseCycles) * (ca.calls * ca.overheadCycles);
+	});
+
+	for (auto F : candidates) {
+		ProtectionCost &c = fnCostMap[F];
+		double cost = c.calls * c.overheadCycles;
+		if (spent + cost <= budget) {
+			chosen.insert(F);
+			spent += cost;
+		}
+	}
+
+	// Put everything else out of scope
+	for (auto F : candidates) {
+		if (chosen.find(F) == chosen.end()) {
+			fnsToClone.erase(F);
+			fnsToSkip.insert(F);
+		} else {
+			fnsToClone.insert(F);
+		}
+	}
+
+	// Only protect globals that are used exclusively inside the chosen scope,
+	//  so there are no unsafe crossings of the sphere of replication.
+	std::set<GlobalVariable*> skippedGlobals;
+	for (auto & entry : globalCostMap) {
+		GlobalVariable* g = entry.first;
+		if (globalsToSkip.find(g) != globalsToSkip.end())
+			continue;
+
+		std::vector<User*> users(g->user_begin(), g->user_end());
+		bool usedOutside = false;
+		while (users.size() > 0) {
+			User* U = users.back();
+			users.pop_back();
+			if (Instruction* I = dyn_cast<Instruction>(U)) {
+				if (chosen.find(I->getFunction()) == chosen.end()) {
+					usedOutside = true;
+					break;
+				}
+			} else if (isa<ConstantExpr>(U)) {
+				users.insert(users.end(), U->user_begin(), U->user_end());
+			}
+		}
+
+		if (usedOutside) {
+			skippedGlobals.insert(g);
+			globalsToSkip.insert(g);
+		}
+	}
+
+	if (verboseFlag || costReportFlag) {
+		errs() << info_string << " overhead budget " << overheadBudget << "%, estimated overhead "
+			   << format("%.1f", (totalBase > 0) ? 100.0 * spent / totalBase : 0.0) << "%, protecting "
+			   << chosen.size() << " of " << fnCostMap.size() << " functions\n";
+	}
+
+	writeScopeConfig(chosen, skippedGlobals);
+}
+
+
+/*
+ * Write the chosen scope out in the same format as functions.config,
+ *  so the build can be reproduced with -configFile and without -overheadBudget.
+ * The chosen functions are listed as well as the skipped ones, since without
+ *  the budget they would only be protected by default with __DEFAULT_xMR.
+ */
+void dataflowProtection::writeScopeConfig(std::set<Function*> &chosen, std::set<GlobalVariable*> &skippedGlobals) {
+	std::ofstream ofs(budgetConfigFile, std::ofstream::out);
+	if (!ofs.is_open()) {
+		errs() << err_string << " could not write scope configuration to '" << budgetConfigFile << "'\n";
+		return;
+	}
+
+	auto writeList = [&](std::string name, std::vector<std::string> items) {
+		ofs << name << " = ";
+		for (unsigned i = 0; i < items.size(); i++) {
+			ofs << items[i];
+			if (i + 1 < items.size())
+				ofs << ", ";
+		}
+		ofs << "\n\n";
+	};
+
+	ofs << "# Generated by COAST with -overheadBudget=" << overheadBudget << "\n";
+	ofs << "# Pass this file in with -configFile to reproduce the same protection scope\n\n";
+
+	// carry over the call handling from the configuration this run used
+	std::set<std::string> seen;
+	std::vector<std::string> items;
+	for (auto x : skipLibCalls) {
+		if (seen.insert(x).second)
+			items.push_back(x);
+	}
+	writeList("skipLibCalls", items);
+	writeList("replicateFnCalls", std::vector<std::string>(coarseGrainedUserFunctions.begin(), coarseGrainedUserFunctions.end()));
+	if (isrFuncNameList.size() > 0)
+		writeList("isrFunctions", std::vector<std::string>(isrFuncNameList.begin(), isrFuncNameList.end()));
+	if (clGlobalsToRuntimeInit.size() > 0)
+		writeList("runtimeInitGlobals", std::vector<std::string>(clGlobalsToRuntimeInit.begin(), clGlobalsToRuntimeInit.end()));
+
+	items.clear();
+	for (auto F : chosen) {
+		items.push_back(F->getName().str());
+	}
+	std::sort(items.begin(), items.end());
+	writeList("cloneFns", items);
+
+	items.clear();
+	for (auto F : fnsToSkip) {
+		items.push_back(F->getName().str());
+	}
+	std::sort(items.begin(), items.end());
+	writeList("ignoreFns", items);
+
+	items.clear();
+	seen.clear();
+	for (auto x : ignoreGlbl) {
+		if (seen.insert(x).second)
+			items.push_back(x);
+	}
+	for (auto g : skippedGlobals) {
+		if (seen.insert(g->getName().str()).second)
+			items.push_back(g->getName().str());
+	}
+	writeList("ignoreGlbls", items);
+
+	ofs.close();
+	if (verboseFlag) {
+		errs() << info_string << " wrote protection scope to '" << budgetConfigFile << "'\n";
+	}
+}
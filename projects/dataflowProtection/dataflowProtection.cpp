@@ -31,6 +31,15 @@ cl::list<std::string> cloneGlblCl ("cloneGlbls", cl::desc("Specify global(s) to
 cl::list<std::string> replReturnCl ("cloneReturn", cl::desc("Specify function(s) which should return multiple values. Defaults to none."), cl::CommaSeparated, cl::ZeroOrMore);
 cl::list<std::string> cloneAfterCallCl ("cloneAfterCall", cl::desc("Specify function(s) of which the argument(s) should be cloned after the function is called once (ie. scanf)"), cl::CommaSeparated, cl::ZeroOrMore);
 cl::list<std::string> protectedLibCl ("protectedLibFn", cl::desc("Specify function(s) which should be treated as protected library functions."), cl::CommaSeparated, cl::ZeroOrMore);
+// protection level of individual functions/globals, if different from the pass
+cl::list<std::string> dwcFnCl ("dwcFns", cl::desc("Specify function(s) to protect with DWC instead of TMR."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> tmrFnCl ("tmrFns", cl::desc("Specify function(s) to protect with TMR instead of DWC."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> dwcGlblCl ("dwcGlbls", cl::desc("Specify global(s) to protect with DWC instead of TMR."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> tmrGlblCl ("tmrGlbls", cl::desc("Specify global(s) to protect with TMR instead of DWC."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> outputsCl ("outputs", cl::desc("Specify global(s) and function return value(s) to compute the slice of replication from."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> outputCallsCl ("outputCalls", cl::desc("Specify function(s) whose arguments are outputs, like printf."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> abftFnCl ("abftFns", cl::desc("Specify matrix multiply function(s) to protect with row and column checksums instead of replication."), cl::CommaSeparated, cl::ZeroOrMore);
+cl::list<std::string> multiVersionFnCl ("multiVersionFns", cl::desc("Specify function(s) to also keep an unprotected version of, chosen at run time with COAST_SET_PROTECTION()."), cl::CommaSeparated, cl::ZeroOrMore);
 
 // Other options
 cl::opt<std::string> configFileLocation ("configFile", cl::desc("Location of configuration file"));
@@ -39,13 +48,54 @@ cl::opt<bool> OriginalReportErrorsFlag ("reportErrors", cl::desc("Instrument TMR
 cl::opt<bool> InterleaveFlag ("i", cl::desc("Interleave instructions, rather than segmenting within a basic block. Default behavior."));
 cl::opt<bool> SegmentFlag ("s", cl::desc("Segment instructions, rather than interleaving within a basic block"));
 cl::list<std::string> globalsToRuntimeInitCl ("runtimeInitGlobals", cl::CommaSeparated, cl::ZeroOrMore);
+cl::opt<bool> runtimeInitAllFlag ("runtimeInitAll", cl::desc("Leave the copies of all initialized globals in .bss, and fill them from the originals at startup"));
 cl::opt<bool> dumpModuleFlag ("dumpModule", cl::desc("Print out the module immediately before pass concludes. Option is for pass debugging."));
 cl::opt<bool> verboseFlag ("verbose", cl::desc("Increase the amount of output"));
 cl::opt<bool> noMainFlag ("noMain", cl::desc("There is no 'main' function in this module"));
 cl::opt<bool> noCloneOperandsCheckFlag ("noCloneOpsCheck", cl::desc("Continue compilation even if instruction operands weren't correctly cloned."));
-cl::opt<bool> countSyncsFlag ("countSyncs", cl::desc("Dynamic count of synchronization points"));
+cl::opt<bool> countSyncsFlag ("countSyncs", cl::desc("Count how many times each synchronization point is reached"));
+cl::opt<unsigned> syncSampleRate ("syncSampleRate", cl::desc("With -countSyncs, only count 1 in every N synchronization points, a power of 2"), cl::value_desc("N"), cl::init(1));
 cl::opt<bool> protectStackFlag ("protectStack", cl::desc("Vote on values of return address and frame pointer before returning from function call."));
 
+// Overhead cost model
+cl::opt<unsigned> overheadBudget ("overheadBudget", cl::desc("Choose the protection scope so the estimated run time overhead stays under this percentage"), cl::value_desc("percent"));
+cl::opt<bool> costReportFlag ("costReport", cl::desc("Print the estimated overhead of protecting each function and global"));
+cl::opt<std::string> costProfileFile ("costProfile", cl::desc("File of function call counts (\"name count\" per line) to weight the cost estimates"), cl::value_desc("filename"));
+cl::opt<std::string> vulnProfileFile ("vulnProfile", cl::desc("File with the results of a fault injection campaign, per source line"), cl::value_desc("filename"), cl::init(""));
+cl::opt<unsigned> vulnMinInjections ("vulnMinInjections", cl::desc("Number of masked injections needed before a line is left unprotected"), cl::init(10));
+cl::opt<bool> checksumConstFlag ("checksumConstGlbls", cl::desc("Keep a single copy of constant globals, protected by a checksum, instead of replicating them"));
+cl::opt<std::string> constCheckMode ("constCheck", cl::desc("When to check the constant checksums: at the start of each function that uses them (call), or only in __COAST_CHECK_CONSTANTS (scrub)"), cl::value_desc("call|scrub"), cl::init("call"));
+cl::opt<std::string> shadowMemMode ("shadowMem", cl::desc("Protect memory with a shadow of check bits (parity or secded) instead of copies"), cl::value_desc("parity|secded"), cl::init(""));
+cl::opt<bool> interleaveMemFlag ("interleaveMem", cl::desc("Place the copies of each global and local next to each other, interleaving the elements of arrays"));
+cl::opt<unsigned> replicaOffset ("replicaOffset", cl::desc("Place the copies of replicated globals at this fixed distance from the originals"), cl::value_desc("bytes"), cl::init(0));
+cl::opt<unsigned> replicaStackSize ("replicaStackSize", cl::desc("Size of the stack to reserve in the -replicaOffset layout, so the copies of locals are at the same distance"), cl::value_desc("bytes"), cl::init(0));
+cl::opt<std::string> replicaLinkerScript ("replicaLinkerScript", cl::desc("Where to write the linker script for -replicaOffset"), cl::value_desc("filename"), cl::init("coast.replicas.ld"));
+cl::opt<std::string> replicaLoadRegion ("replicaLoadRegion", cl::desc("Memory region to load the -replicaOffset sections from, when the program starts from flash"), cl::value_desc("region"));
+cl::opt<std::string> replicaBanks ("replicaBanks", cl::desc("Sections for the original and each copy of large globals, as <section>[:<region>] separated by commas"), cl::value_desc("orig,DWC,TMR"), cl::init(""));
+cl::opt<unsigned> replicaBankMinSize ("replicaBankMinSize", cl::desc("Only place globals at least this big in the -replicaBanks sections"), cl::value_desc("bytes"), cl::init(0));
+cl::opt<std::string> replicaBankScript ("replicaBankScript", cl::desc("Where to write the linker script for -replicaBanks"), cl::value_desc("filename"), cl::init("coast.banks.ld"));
+cl::opt<bool> replicaMallocFlag ("replicaMalloc", cl::desc("Serve all copies of a wrapped malloc() from one call to the replica-aware heap"));
+cl::opt<bool> promoteLocalsFlag ("promoteLocals", cl::desc("Keep locals that are only loaded and stored, and their copies, in registers instead of on the stack"));
+cl::opt<bool> stackReportFlag ("stackReport", cl::desc("Print how much stack is used by the copies of locals in each function"));
+cl::opt<bool> scrubMemoryFlag ("scrubMemory", cl::desc("Create __COAST_SCRUB_MEMORY(), which checks and repairs part of the copies of the globals each time it is called"));
+cl::opt<unsigned> scrubChunkSize ("scrubChunk", cl::desc("How many bytes of the globals __COAST_SCRUB_MEMORY() checks each time it is called"), cl::value_desc("bytes"), cl::init(1024));
+cl::opt<bool> fuseMemOpsFlag ("fuseMemOps", cl::desc("Replace the copies of each replicated memcpy and memset with a single loop"));
+cl::opt<bool> fuseMemVoteFlag ("fuseMemVote", cl::desc("Compare the copies of the source while doing a fused memcpy, and vote on them with TMR"));
+cl::opt<std::string> argReplicationMode ("argReplication", cl::desc("Which arguments are passed as copies: all of them, or only as many as fit in the argument registers (auto)"), cl::value_desc("all|auto"), cl::init("all"));
+cl::opt<unsigned> argRegsOpt ("argRegs", cl::desc("How many integer argument registers the target has, for -argReplication=auto"), cl::init(0));
+cl::opt<unsigned> argVoteSpan ("argVoteSpan", cl::desc("Only vote on an argument at the call if the callee uses it in at most this many instructions before voting"), cl::init(8));
+cl::opt<unsigned> argVoteMinFreq ("argVoteMinFreq", cl::desc("Only vote on arguments at the call for functions called at least this often (loops count 8 times per level)"), cl::init(8));
+cl::opt<bool> inferCallsFlag ("inferCalls", cl::desc("Use the function attributes and known library functions to decide how to handle calls to external functions"));
+cl::opt<std::string> pureCallsMode ("pureCalls", cl::desc("How -inferCalls handles calls to functions that can't change memory: replicate them without a sync point, or call them once"), cl::value_desc("replicate|once"), cl::init("replicate"));
+cl::opt<bool> callReportFlag ("callReport", cl::desc("Print how calls to each external function are handled"));
+cl::opt<bool> protectedLibcFlag ("protectedLibc", cl::desc("Call the protected versions of C library functions from COAST_libc.h instead of the library"));
+cl::opt<bool> temporalPureFlag ("temporalPure", cl::desc("Call functions that only read through their arguments once for each copy, instead of replicating their bodies"));
+cl::opt<bool> dwcSignatureFlag ("dwcSignature", cl::desc("With DWC, fold the differences between the copies into a signature, checked before external calls, returns, and loop exits"));
+cl::opt<std::string> syncLevelOpt ("syncLevel", cl::desc("Which sync points to keep: all of them, only memory and calls, or only function boundaries and external effects"), cl::value_desc("all|memory|boundary"), cl::init("all"));
+cl::opt<bool> correctionLogFlag ("correctionLog", cl::desc("With TMR, log each correction with the ID of the sync point and which copy was wrong (see COAST_telemetry.h)"));
+cl::opt<std::string> siteTableFile ("siteTable", cl::desc("Where to write the table of sync point IDs and their source locations"), cl::value_desc("filename"), cl::init("coast.sites.csv"));
+cl::opt<std::string> budgetConfigFile ("budgetConfigOut", cl::desc("Where to write the scope chosen by -overheadBudget"), cl::value_desc("filename"), cl::init("functions.budget.config"));
+
 
 //--------------------------------------------------------------------------//
 // Top level behavior
@@ -61,31 +111,68 @@ bool dataflowProtection::runOnModule(Module &M) {
 }
 
 bool dataflowProtection::run(Module &M, int numClones) {
-	// Remove user functions that are never called in the module to reduce code size, processing time
-	// These are mainly inlined by prior optimizations
-	if (verboseFlag)
-		PRINT_STRING("The following functions are unused, removing them:");
-	removeUnusedFunctions(M);
-
-	// Process user commands inside of the source code
-	// Must happen before processCommandLine to make sure we don't clone things if not needed
-	processAnnotations(M);
-
-	// Remove annotations here so they aren't cloned
-	removeAnnotations(M);
+	// When protecting part of the module at another level, the pass
+	//  that created this one has already done these steps
+	if (!isLevelSubset) {
+		// Remove user functions that are never called in the module to reduce code size, processing time
+		// These are mainly inlined by prior optimizations
+		if (verboseFlag)
+			PRINT_STRING("The following functions are unused, removing them:");
+		removeUnusedFunctions(M);
+
+		// Process user commands inside of the source code
+		// Must happen before processCommandLine to make sure we don't clone things if not needed
+		processAnnotations(M);
+
+		// Remove annotations here so they aren't cloned
+		removeAnnotations(M);
+	}
 
 	// Make sure that the command line options are correct
 	processCommandLine(M, numClones);
 
+	// Calls to the C library go to the protected versions, if they're there
+	redirectLibCalls(M);
+
+	// Calls to functions that can't change memory don't need a sync point
+	classifyLibCalls(M);
+
+	// Pure functions in the module can be called again instead of replicated
+	selectTemporalFns(M);
+
+	// Anything marked with a different protection level is protected first
+	processProtectionLevels(M, numClones);
+
+	if (!isLevelSubset) {
+		// Estimate the cost of protection, and narrow the scope to fit a budget if asked
+		estimateOverhead(M, numClones);
+		applyOverheadBudget();
+	}
+
 	// Populate the list of functions to touch
 	populateFnWorklist(M);
 
+	// Functions with xMR regions only have those regions cloned
+	processRegionMarkers(M);
+
+	// Only clone what can affect the outputs, if any were given
+	computeOutputSlice(M);
+
+	// Constant globals can be protected with a checksum instead of being cloned
+	selectChecksumGlobals(M);
+
 	// First figure out which instructions are going to be cloned
 	populateValuesToClone(M);
 
 	// validate that the configuration parameters can be followed safely
 	verifyOptions(M);
 
+	// Pointers into the replica layout don't need extra arguments
+	findOffsetArgs(M);
+
+	// Some arguments are cheaper to vote on at the call than to pass as copies
+	selectReplicatedArgs(M);
+
 	// Now add new arguments to functions
 	// (In LLVM you can't change a function signature, so we have to make new functions)
 	// populateValuesToClone has to be called before this so we know which
@@ -100,14 +187,24 @@ bool dataflowProtection::run(Module &M, int numClones) {
 	//  list of values to clone is up to date
 	processLocalAnnotations(M);
 	removeLocalAnnotations(M);
+	skipOutsideSlice(M);
+	applyVulnProfile(M);
 
 	// Once again figure out which instructions are going to be cloned
 	// This need to be re-run after creating the new functions as the old
 	// pointers will be stale
 	populateValuesToClone(M);
 
+	// Memory protected by check bits instead of copies
+	selectShadowObjects(M);
+
+	// Unprotected versions are copied from the original code, before anything is cloned
+	createMultiVersions(M);
+
 	// Do the actual cloning
 	cloneGlobals(M);
+	placeReplicaSections(M);
+	placeReplicaBanks(M);
 	cloneConstantExpr();
 	cloneInsns();
 
@@ -115,6 +212,9 @@ bool dataflowProtection::run(Module &M, int numClones) {
 	updateCallInsns(M);
 	updateInvokeInsns(M);
 
+	// One allocation for all of the copies
+	mergeReplicaAllocs(M);
+
 	// Insert error detection/handling
 	insertErrorFunction(M, numClones);
 	createErrorBlocks(M, numClones);
@@ -132,15 +232,49 @@ bool dataflowProtection::run(Module &M, int numClones) {
 	// stack protection
 	insertStackProtection(M);
 
+	// check the constants that weren't cloned
+	insertConstChecks(M);
+	insertShadowChecks(M);
+	insertAbftChecks(M);
+
 	// Clean up
 	removeUnusedErrorBlocks(M);
 	checkForUnusedClones(M);
 	removeOrigFunctions();
-	removeUnusedGlobals(M);
+	if (!isLevelSubset)
+		removeUnusedGlobals(M);
+
+	// check the copies of the globals in the background
+	insertMemoryScrubber(M);
 
 	// This is executed if code is segmented instead of interleaved
 	moveClonesToEndIfSegmented(M);
 
+	// Fewer copies of locals on the stack
+	shrinkReplicaStack(M);
+
+	// One loop for all of the copies of memcpy and memset
+	fuseMemIntrinsics(M);
+
+	// The copies of locals are at a fixed distance on the stack
+	offsetStackReplicas(M);
+
+	// The protected versions choose at run time whether to call the unprotected ones
+	insertMultiVersionDispatch(M);
+
+	// The pass protecting the rest of the module will do the final clean up
+	if (isLevelSubset) {
+		validateRRFuncs();
+		return true;
+	}
+
+	// Put the copies of memory next to each other, or at a fixed distance
+	interleaveReplicas(M);
+	writeReplicaLinkerScript();
+	writeBankLinkerScript();
+	finishSyncCounts(M);
+	writeSiteTable();
+
 	if (verboseFlag)
 		PRINT_STRING("Removing unused functions...");
 	/*
@@ -1,6 +1,7 @@
 #ifndef PROJECTS_Dataflow_protection_H_
 #define PROJECTS_Dataflow_protection_H_
 
+#include <list>
 #include <vector>
 #include <map>
 #include <set>
@@ -46,6 +47,30 @@ typedef std::tuple< Value*, GlobalVariable*, Function* > LoadRecordType;
 typedef std::tuple< StoreInst*, GlobalVariable*, Function* > StoreRecordType;
 typedef std::tuple< CallInst*, GlobalVariable*, Function* , long > CallRecordType;
 
+//----------------------------------------------------------------------------//
+// Cost model types
+//----------------------------------------------------------------------------//
+// estimated cost of protecting a single function, per call
+struct ProtectionCost {
+  double calls = 0;             // how many times the function is expected to run
+  double baseCycles = 0;        // unprotected cycles, weighted by loop depth
+  double overheadCycles = 0;    // extra cycles from replication and synchronization
+  unsigned staticInsts = 0;
+  unsigned overheadInsts = 0;   // extra instructions added to the binary
+  unsigned syncSites = 0;
+};
+
+//----------------------------------------------------------------------------//
+// Synchronization levels
+//----------------------------------------------------------------------------//
+// which sync points are kept, from -syncLevel or the __xMR_SYNC_* directives
+// each level keeps all of the sync points the ones before it do
+enum SyncLevel {
+  SYNC_BOUNDARY,                // returns, external calls, memory with one copy
+  SYNC_MEMORY,                  // also stores and addresses
+  SYNC_ALL                      // also branches (default)
+};
+
 //----------------------------------------------------------------------------//
 // Class definition
 //----------------------------------------------------------------------------//
@@ -77,6 +102,26 @@ private:
   const std::string isr_anno	     = "isr_function";
   const std::string prot_lib_anno  = "protected_lib";
   const std::string cloneAfterCallAnno = "clone-after-call-";
+  const std::string dwc_level_anno = "xMR_level_DWC";
+  const std::string tmr_level_anno = "xMR_level_TMR";
+  const std::string output_anno    = "xMR_output";
+  const std::string abft_anno      = "xMR_abft";
+  const std::string sync_all_anno      = "xMR_sync_all";
+  const std::string sync_memory_anno   = "xMR_sync_memory";
+  const std::string sync_boundary_anno = "xMR_sync_boundary";
+  const std::string multi_version_anno = "xMR_multi_version";
+  const std::string region_begin_name = "__COAST_xMR_REGION_BEGIN";
+  const std::string region_end_name   = "__COAST_xMR_REGION_END";
+  const std::string const_scrub_fn_name = "__COAST_CHECK_CONSTANTS";
+  const std::string mem_scrub_fn_name   = "__COAST_SCRUB_MEMORY";
+  const std::string scrub_lock_fn_name  = "__COAST_SCRUB_LOCK";
+  const std::string scrub_unlock_fn_name = "__COAST_SCRUB_UNLOCK";
+  const std::string set_protection_fn_name = "__COAST_SET_PROTECTION";
+  const std::string log_correction_fn_name = "__COAST_LOG_CORRECTION";
+  const std::string sync_counts_name    = "__COAST_sync_counts";
+  const std::string sync_sites_name     = "__COAST_sync_sites";
+  const std::string sync_tick_name      = "__COAST_sync_tick";
+  const std::string coast_libc_prefix   = "__COAST_";
 
   //----------------------------------------------------------------------------//
   // Constant strings for fancy printing
@@ -140,6 +185,63 @@ private:
   // in the case of SIMD instructions, need special support for compare logic
   std::map<Instruction*, std::tuple<Instruction*, Instruction*, Instruction*> > simdMap;
 
+  // For the overhead cost model
+  std::map<Function*, ProtectionCost> fnCostMap;
+  std::map<GlobalVariable*, uint64_t> globalCostMap;
+
+  // For mixed protection levels
+  bool isLevelSubset = false;                     /* only protecting the functions at another level */
+  std::map<Function*, int> fnLevelMap;            /* marked with __DWC or __TMR */
+  std::map<GlobalVariable*, int> globalLevelMap;
+  std::set<Function*> crossLevelFns;              /* protected at the other level */
+
+  // sync points kept in each function
+  SyncLevel syncLevel = SYNC_ALL;
+  // -dwcSignature and -correctionLog, only if they apply to the level of this pass
+  bool dwcSignature = false;
+  bool correctionLog = false;
+  std::map<Function*, SyncLevel> fnSyncLevelMap;  /* marked with __xMR_SYNC_* */
+
+  // instructions between COAST_xMR_BEGIN() and COAST_xMR_END()
+  std::set<Instruction*> regionInsts;
+
+  // outputs to compute the backward slice from
+  std::set<GlobalVariable*> outputGlobals;
+  std::set<Function*> outputFns;                  /* return value is an output */
+
+  // constant globals kept as a single copy, and the checksum of their contents
+  std::map<GlobalVariable*, uint32_t> checksumGlobals;
+
+  // globals and locals with a shadow of check bits, and the initial check bits
+  std::map<Value*, std::vector<uint8_t> > shadowObjects;
+
+  // pointer arguments whose copies are found at -replicaOffset, by argument number
+  std::map<Function*, std::set<unsigned> > offsetArgs;
+  // functions that only run on the stack main() starts on, for -replicaStackSize
+  std::set<Function*> mainStackFns;
+  // arguments voted on at the call instead of passed as copies, from -argReplication=auto
+  std::map<Function*, std::set<unsigned> > votedArgs;     /* original function, argument number */
+  std::map<Function*, std::set<unsigned> > votedArgNums;  /* function being called, operand number */
+  // external functions that can't change memory, called without a sync point (-inferCalls)
+  std::set<Function*> pureCallFns;
+  // matrix kernels called once and checked with row and column sums (__xMR_ABFT)
+  std::set<Function*> abftFns;
+  // running signature of the differences between the copies in each function (-dwcSignature)
+  std::map<Function*, AllocaInst*> signatureAccs;
+  // where the signature is checked, besides the returns and loop exits
+  std::map<Function*, std::vector<Instruction*> > signatureChecks;
+  // functions that also get an unprotected version chosen at run time (__xMR_MULTI_VERSION)
+  std::set<Function*> multiVersionFns;
+  // unprotected copy of each original function they call, directly or not
+  std::map<Function*, Function*> fastVersions;
+  // protected version of each of them, and the unprotected copy it can call instead
+  std::map<Function*, Function*> multiVersionMap;
+  // globals written by the unprotected copy, by protected version
+  std::map<Function*, std::set<GlobalVariable*> > fastWrittenGlobals;
+  // section and memory region for each copy, from -replicaBanks
+  std::vector<std::string> bankSections;
+  std::vector<std::string> bankRegions;
+
   //----------------------------------------------------------------------------//
   // cloning.cpp
   //----------------------------------------------------------------------------//
@@ -181,6 +283,10 @@ private:
   void processCallSync(CallInst* currCallInst, GlobalVariable* TMRErrorDetected);
   void syncTerminator(TerminatorInst* currTerminator, GlobalVariable* TMRErrorDetected);
   Instruction* splitBlocks(Instruction* I, BasicBlock* errBlock);
+  // DWC signatures
+  Instruction* foldSignature(Value* orig, Value* clone, Instruction* insertBefore);
+  void insertSignatureCheck(Instruction* I);
+  void insertSignatureChecks();
   // DWC error handling
   void insertErrorFunction(Module& M, int numClones);
   void createErrorBlocks(Module& M, int numClones);
@@ -200,6 +306,7 @@ private:
   void removeUnusedErrorBlocks(Module& M);
   void removeUnusedGlobals(Module& M);
   void checkForUnusedClones(Module& M);
+  void removeFromCloneMap(std::set<Value*> &removed);
   // Synchronization utilities
   void moveClonesToEndIfSegmented(Module& M);
   GlobalVariable* createGlobalVariable(Module& M, std::string name, unsigned int byteSz);
@@ -207,11 +314,14 @@ private:
   int getArrayTypeSize(Module& M, ArrayType * arrayType);
   int getArrayTypeElementBitWidth(Module& M, ArrayType * arrayType);
   void recursivelyVisitCalls(Module& M, Function* F, std::set<Function*> &functionList);
+  GlobalVariable* createReplicaTable(Module& M, std::vector<std::vector<GlobalVariable*> > &globals, std::string name);
   // Miscellaneous
   void walkInstructionUses(Instruction* I, bool xMR);
   void updateFnWrappers(Module& M);
   std::string getRandomString(std::size_t len);
   void dumpModule(Module& M);
+  bool onlyDirectCalls(Function* F);
+  double getLoopWeight(unsigned loopDepth);
 
   //----------------------------------------------------------------------------//
   // verification.cpp
@@ -236,6 +346,8 @@ private:
   bool isSyncPoint(Instruction* I);
   bool isStoreMovePoint(StoreInst* SI);
   bool isCallMovePoint(CallInst* ci);
+  SyncLevel getSyncLevel(Function* F);
+  bool keepsSyncPoint(Instruction* I, SyncLevel level);
   bool checkCoarseSync(StoreInst* inst);
   // Miscellaneous
   bool isIndirectFunctionCall(CallInst* CI, std::string errMsg, bool print=true);
@@ -253,6 +365,117 @@ private:
   void removeAnnotations(Module& M);
   void removeLocalAnnotations(Module& M);
 
+  //----------------------------------------------------------------------------//
+  // costModel.cpp
+  //----------------------------------------------------------------------------//
+  void estimateOverhead(Module& M, int numClones);
+  void applyOverheadBudget();
+  void writeScopeConfig(std::set<Function*> &chosen, std::set<GlobalVariable*> &skippedGlobals);
+
+  //----------------------------------------------------------------------------//
+  // protectionLevels.cpp
+  //----------------------------------------------------------------------------//
+  void processProtectionLevels(Module& M, int numClones);
+  void addLevelsByName(Module& M, std::list<std::string> &fnNames, std::list<std::string> &glblNames, int level);
+  void restrictToLevelScope(Module& M);
+  void allowCrossLevelReads(std::set<Function*> &otherLevelFns);
+
+  //----------------------------------------------------------------------------//
+  // regions.cpp
+  //----------------------------------------------------------------------------//
+  void processRegionMarkers(Module& M);
+  void syncRegionExits(GlobalVariable* TMRErrorDetected);
+
+  //----------------------------------------------------------------------------//
+  // outputSlice.cpp
+  //----------------------------------------------------------------------------//
+  void computeOutputSlice(Module& M);
+  void skipOutsideSlice(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // vulnProfile.cpp
+  //----------------------------------------------------------------------------//
+  void applyVulnProfile(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // constChecksum.cpp
+  //----------------------------------------------------------------------------//
+  void selectChecksumGlobals(Module& M);
+  bool isChecksumConstAddress(Value* ptr);
+  void insertConstChecks(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // shadowMemory.cpp
+  //----------------------------------------------------------------------------//
+  void selectShadowObjects(Module& M);
+  void insertShadowChecks(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // replicaLayout.cpp
+  //----------------------------------------------------------------------------//
+  void interleaveReplicas(Module& M);
+  bool isOffsetGlobal(GlobalVariable* g);
+  void findMainStackFns(Module& M);
+  bool isOffsetAddress(Value* ptr);
+  void findOffsetArgs(Module& M);
+  void addOffsetArgClone(Argument* arg);
+  void placeReplicaSections(Module& M);
+  void offsetStackReplicas(Module& M);
+  void writeReplicaLinkerScript(void);
+  void mergeReplicaAllocs(Module& M);
+  void placeReplicaBanks(Module& M);
+  void writeBankLinkerScript(void);
+
+  //----------------------------------------------------------------------------//
+  // stackUsage.cpp
+  //----------------------------------------------------------------------------//
+  void shrinkReplicaStack(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // scrubber.cpp
+  //----------------------------------------------------------------------------//
+  Function* getScrubHook(Module& M, const std::string& name);
+  void insertMemoryScrubber(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // memFusion.cpp
+  //----------------------------------------------------------------------------//
+  void fuseMemIntrinsics(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // argReplication.cpp
+  //----------------------------------------------------------------------------//
+  void selectReplicatedArgs(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // callPurity.cpp
+  //----------------------------------------------------------------------------//
+  void redirectLibCalls(Module& M);
+  void classifyLibCalls(Module& M);
+  void selectTemporalFns(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // abft.cpp
+  //----------------------------------------------------------------------------//
+  void insertAbftChecks(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // multiVersion.cpp
+  //----------------------------------------------------------------------------//
+  void createMultiVersions(Module& M);
+  Function* getFastVersion(Function* F);
+  void insertMultiVersionDispatch(Module& M);
+
+  //----------------------------------------------------------------------------//
+  // telemetry.cpp
+  //----------------------------------------------------------------------------//
+  unsigned addSyncSite(Instruction* I);
+  void insertCorrectionLog(Instruction* cmpInst, Instruction* cmpInst2, BasicBlock* errBlock, unsigned id);
+  void createSyncCounts(Module& M);
+  void insertSyncCount(Instruction* insertBefore, unsigned id);
+  void finishSyncCounts(Module& M);
+  void writeSiteTable(void);
+
 };
 
 #endif
@@ -17,6 +17,7 @@ using namespace llvm;
 
 // command line options
 extern cl::opt<bool> verboseFlag;
+extern cl::opt<bool> noMemReplicationFlag;
 
 // shared variables
 extern std::list<std::string> coarseGrainedUserFunctions;
@@ -130,6 +131,30 @@ bool dataflowProtection::isCallMovePoint(CallInst* ci) {
 }
 
 
+// the directive on the function wins over -syncLevel
+SyncLevel dataflowProtection::getSyncLevel(Function* F) {
+	auto levelIt = fnSyncLevelMap.find(F);
+	if (levelIt != fnSyncLevelMap.end())
+		return levelIt->second;
+	return syncLevel;
+}
+
+
+/*
+ * Returns false if a sync point at I is left out at this level.
+ * Returns, calls, and stores to memory with only one copy are always kept.
+ */
+bool dataflowProtection::keepsSyncPoint(Instruction* I, SyncLevel level) {
+	if (isa<BranchInst>(I) || isa<SwitchInst>(I) || isa<IndirectBrInst>(I))
+		return level >= SYNC_ALL;
+	if (isa<GetElementPtrInst>(I))
+		return level >= SYNC_MEMORY;
+	if (isa<StoreInst>(I))
+		return (level >= SYNC_MEMORY) || noMemReplicationFlag;
+	return true;
+}
+
+
 /*
  * Returns true if this will try to sync on a coarse-grained function return value
  * These should be avoided for things like the case of malloc()
@@ -35,6 +35,14 @@ extern cl::list<std::string> cloneGlblCl;
 extern cl::list<std::string> replReturnCl;
 extern cl::list<std::string> cloneAfterCallCl;
 extern cl::list<std::string> protectedLibCl;
+extern cl::list<std::string> dwcFnCl;
+extern cl::list<std::string> tmrFnCl;
+extern cl::list<std::string> dwcGlblCl;
+extern cl::list<std::string> tmrGlblCl;
+extern cl::list<std::string> outputsCl;
+extern cl::list<std::string> outputCallsCl;
+extern cl::list<std::string> abftFnCl;
+extern cl::list<std::string> multiVersionFnCl;
 
 extern cl::opt<std::string> configFileLocation;
 extern cl::opt<bool> SegmentFlag;
@@ -42,6 +50,21 @@ extern cl::opt<bool> storeDataSyncFlag;
 extern cl::opt<bool> noStoreDataSyncFlag;
 extern cl::opt<bool> InterleaveFlag;
 extern cl::opt<bool> noMemReplicationFlag;
+extern cl::opt<std::string> shadowMemMode;
+extern cl::opt<std::string> pureCallsMode;
+extern cl::opt<std::string> argReplicationMode;
+extern cl::opt<bool> dwcSignatureFlag;
+extern cl::opt<bool> correctionLogFlag;
+extern cl::opt<bool> ReportErrorsFlag;
+extern cl::opt<bool> OriginalReportErrorsFlag;
+extern cl::opt<bool> countSyncsFlag;
+extern cl::opt<bool> noMainFlag;
+extern cl::opt<unsigned> syncSampleRate;
+extern cl::opt<std::string> syncLevelOpt;
+extern cl::opt<bool> interleaveMemFlag;
+extern cl::opt<unsigned> replicaOffset;
+extern cl::opt<unsigned> replicaStackSize;
+extern cl::opt<std::string> replicaBanks;
 extern cl::opt<bool> verboseFlag;
 
 extern std::string tmr_global_count_name;
@@ -59,6 +82,14 @@ std::list<std::string> tempCloneGlblList;
 std::list<std::string> tempReplReturnList;
 std::list<std::string> cloneAfterCallList;
 std::list<std::string> tempProtectedLibList;
+std::list<std::string> abftFnList;
+std::list<std::string> multiVersionFnList;
+std::list<std::string> dwcFnList;
+std::list<std::string> tmrFnList;
+std::list<std::string> dwcGlblList;
+std::list<std::string> tmrGlblList;
+std::list<std::string> outputNameList;
+std::list<std::string> outputCallList;
 std::map<Function*, std::set<int> > noXmrArgList;
 // see removeAnnotations()
 std::set<ConstantExpr*> annotationExpressions;
@@ -67,12 +98,19 @@ std::set<ConstantExpr*> annotationExpressions;
 // These are the names of the above CL lists.
 // Any changes to these must also be changed at the head of dataflowProtection.cpp
 const std::string skipFnName = "ignoreFns";
+const std::string cloneFnsName = "cloneFns";
 const std::string ignoreGlblName = "ignoreGlbls";
 const std::string skipLibCallsName = "skipLibCalls";
 const std::string coarseFnsName = "replicateFnCalls";
 const std::string runtimeGlblInitName = "runtimeInitGlobals";
 const std::string isrFuncListString = "isrFunctions";
 const std::string cloneAfterCallString = "cloneAfterCall";
+const std::string dwcFnsName = "dwcFns";
+const std::string tmrFnsName = "tmrFns";
+const std::string dwcGlblsName = "dwcGlbls";
+const std::string tmrGlblsName = "tmrGlbls";
+const std::string outputsName = "outputs";
+const std::string outputCallsName = "outputCalls";
 
 // track functions that we should ignore invalid SOR crossings
 extern std::map<GlobalVariable*, std::set<Function*> > globalCrossMap;
@@ -156,11 +194,62 @@ void dataflowProtection::getFunctionsFromCL() {
 		skipFn.push_back(x);
 	}
 
+	for (auto x : abftFnCl) {
+		if (verboseFlag)
+			errs() << "CL: protect function '" << x << "' with ABFT\n";
+		abftFnList.push_back(x);
+		// called once, and checked afterwards
+		skipLibCalls.push_back(x);
+		skipFn.push_back(x);
+	}
+
+	for (auto x : multiVersionFnCl) {
+		if (verboseFlag)
+			errs() << "CL: keep an unprotected version of function '" << x << "'\n";
+		multiVersionFnList.push_back(x);
+	}
+
 	for (auto x : protectedLibCl) {
 		if (verboseFlag)
 			errs() << "CL: treat function '" << x << "' as a protected library\n";
 		tempProtectedLibList.push_back(x);
 	}
+
+	for (auto x : dwcFnCl) {
+		if (verboseFlag)
+			errs() << "CL: protect function '" << x << "' with DWC\n";
+		dwcFnList.push_back(x);
+	}
+
+	for (auto x : tmrFnCl) {
+		if (verboseFlag)
+			errs() << "CL: protect function '" << x << "' with TMR\n";
+		tmrFnList.push_back(x);
+	}
+
+	for (auto x : dwcGlblCl) {
+		if (verboseFlag)
+			errs() << "CL: protect global '" << x << "' with DWC\n";
+		dwcGlblList.push_back(x);
+	}
+
+	for (auto x : tmrGlblCl) {
+		if (verboseFlag)
+			errs() << "CL: protect global '" << x << "' with TMR\n";
+		tmrGlblList.push_back(x);
+	}
+
+	for (auto x : outputsCl) {
+		if (verboseFlag)
+			errs() << "CL: '" << x << "' is an output\n";
+		outputNameList.push_back(x);
+	}
+
+	for (auto x : outputCallsCl) {
+		if (verboseFlag)
+			errs() << "CL: arguments to function '" << x << "' are outputs\n";
+		outputCallList.push_back(x);
+	}
 }
 
 
@@ -213,6 +302,8 @@ int dataflowProtection::getFunctionsFromConfig() {
 			lptr = &skipLibCalls;
 		} else if (substr == skipFnName) {
 			lptr = &skipFn;
+		} else if (substr == cloneFnsName) {
+			lptr = &tempCloneFnList;
 		} else if (substr == coarseFnsName) {
 			lptr = &coarseGrainedUserFunctions;
 		} else if (substr == ignoreGlblName) {
@@ -221,6 +312,18 @@ int dataflowProtection::getFunctionsFromConfig() {
 			lptr = &clGlobalsToRuntimeInit;
 		} else if (substr == isrFuncListString) {
 			lptr = &isrFuncNameList;
+		} else if (substr == dwcFnsName) {
+			lptr = &dwcFnList;
+		} else if (substr == tmrFnsName) {
+			lptr = &tmrFnList;
+		} else if (substr == dwcGlblsName) {
+			lptr = &dwcGlblList;
+		} else if (substr == tmrGlblsName) {
+			lptr = &tmrGlblList;
+		} else if (substr == outputsName) {
+			lptr = &outputNameList;
+		} else if (substr == outputCallsName) {
+			lptr = &outputCallList;
 		} else {
 			errs() << "ERROR: unrecognized option '" << substr;
 			errs() << "' in configuration file '" << filename << "'\n\n";
@@ -247,6 +350,108 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 	}
 	TMR = (numClones==3);
 
+	// memory protected by check bits only has a single copy
+	if (!shadowMemMode.empty()) {
+		if ( (shadowMemMode != "parity") && (shadowMemMode != "secded") ) {
+			errs() << err_string << " unknown value '" << shadowMemMode
+				   << "' for -shadowMem, must be 'parity' or 'secded'\n";
+			exit(-1);
+		}
+		noMemReplicationFlag = true;
+	}
+
+	if ( (pureCallsMode != "replicate") && (pureCallsMode != "once") ) {
+		errs() << err_string << " unknown value '" << pureCallsMode
+			   << "' for -pureCalls, must be 'replicate' or 'once'\n";
+		exit(-1);
+	}
+
+	if ( (argReplicationMode != "all") && (argReplicationMode != "auto") ) {
+		errs() << err_string << " unknown value '" << argReplicationMode
+			   << "' for -argReplication, must be 'all' or 'auto'\n";
+		exit(-1);
+	}
+
+	if (syncLevelOpt == "all") {
+		syncLevel = SYNC_ALL;
+	} else if (syncLevelOpt == "memory") {
+		syncLevel = SYNC_MEMORY;
+	} else if (syncLevelOpt == "boundary") {
+		syncLevel = SYNC_BOUNDARY;
+	} else {
+		errs() << err_string << " unknown value '" << syncLevelOpt
+			   << "' for -syncLevel, must be 'all', 'memory' or 'boundary'\n";
+		exit(-1);
+	}
+
+	// TMR has to vote at each sync point, so there's nothing to defer
+	// The options are shared with the pass for the other protection level, so they're
+	//  left alone, and processProtectionLevels() warns if neither level can use them
+	dwcSignature = dwcSignatureFlag && !TMR;
+
+	// corrections are logged where they are counted
+	if (correctionLogFlag && OriginalReportErrorsFlag && !isLevelSubset) {
+		errs() << warn_string << " -correctionLog can't be used with -reportErrors, ignoring it\n";
+	}
+	correctionLog = correctionLogFlag && TMR && !OriginalReportErrorsFlag;
+	if (correctionLog)
+		ReportErrorsFlag = true;
+
+	// the sync counts are indexed by IDs that are only unique within a module
+	if (countSyncsFlag && noMainFlag) {
+		errs() << warn_string << " -countSyncs needs the whole program in one module, ignoring it\n";
+		countSyncsFlag = false;
+	}
+	if ( (syncSampleRate == 0) || (syncSampleRate & (syncSampleRate - 1)) ) {
+		errs() << err_string << " -syncSampleRate must be a power of 2\n";
+		exit(-1);
+	}
+
+	// the replica layouts only make sense when there are copies of memory
+	if (replicaOffset || interleaveMemFlag) {
+		if (noMemReplicationFlag) {
+			errs() << warn_string << " -replicaOffset and -interleaveMem have no effect unless memory is replicated\n";
+		}
+		if (replicaOffset && interleaveMemFlag) {
+			errs() << err_string << " -replicaOffset and -interleaveMem can't be used together\n";
+			exit(-1);
+		}
+		if (replicaOffset % 64) {
+			errs() << err_string << " -replicaOffset must be a multiple of 64 bytes\n";
+			exit(-1);
+		}
+	}
+	if (replicaStackSize && !replicaOffset) {
+		errs() << warn_string << " -replicaStackSize has no effect without -replicaOffset\n";
+	}
+
+	// a section for each copy, optionally with the memory region it goes in
+	if (!replicaBanks.empty()) {
+		SmallVector<StringRef, 3> lanes;
+		StringRef(replicaBanks).split(lanes, ',');
+		if (lanes.size() > 3) {
+			errs() << err_string << " -replicaBanks takes at most 3 sections (original, DWC, TMR)\n";
+			exit(-1);
+		}
+		for (auto lane : lanes) {
+			std::pair<StringRef, StringRef> secAndRegion = lane.trim().split(':');
+			std::string sec = secAndRegion.first.str();
+			if (!sec.empty() && std::find(bankSections.begin(), bankSections.end(), sec) != bankSections.end()) {
+				errs() << err_string << " section '" << sec << "' is used for more than one copy in -replicaBanks\n";
+				exit(-1);
+			}
+			bankSections.push_back(sec);
+			bankRegions.push_back(secAndRegion.second.str());
+		}
+		if (replicaOffset) {
+			errs() << err_string << " -replicaBanks and -replicaOffset can't be used together\n";
+			exit(-1);
+		}
+		if (noMemReplicationFlag) {
+			errs() << warn_string << " -replicaBanks has no effect unless memory is replicated\n";
+		}
+	}
+
 	if (noMemReplicationFlag && noStoreDataSyncFlag) {
 		errs() << warn_string << " noMemDuplication and noStoreDataSync set simultaneously. Recommend not setting the two together.\n";
 	}
@@ -256,6 +461,11 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 		exit(-1);
 	}
 
+	// The pass protecting another level shares the name lists, which have already
+	//  been filled in, and is handed the sets it needs by processProtectionLevels()
+	if (isLevelSubset)
+		return;
+
 	// Parse information from config file
 	if (getFunctionsFromConfig()) {
 		assert("Configuration file error!" && false);
@@ -284,6 +494,13 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 			// it needs to be added to clone list as well
 			fnsToClone.insert(&F);
 		}
+
+		if (std::find(abftFnList.begin(), abftFnList.end(), F.getName()) != abftFnList.end()) {
+			abftFns.insert(&F);
+		}
+		if (std::find(multiVersionFnList.begin(), multiVersionFnList.end(), F.getName()) != multiVersionFnList.end()) {
+			multiVersionFns.insert(&F);
+		}
 	}
 
 	// more useful missing function information
@@ -357,8 +574,10 @@ void dataflowProtection::processCommandLine(Module& M, int numClones) {
 		exit(-1);
 	}
 
-	// special case
+	// special cases
 	ignoreGlbl.push_back(tmr_global_count_name);
+	ignoreGlbl.push_back(sync_counts_name);
+	ignoreGlbl.push_back(sync_sites_name);
 }
 
 void dataflowProtection::processAnnotations(Module& M) {
@@ -392,6 +611,12 @@ void dataflowProtection::processAnnotations(Module& M) {
 						if (verboseFlag) errs() << "Directive: do not clone calls to function '"  << fn->getName() << "'\n";
 						skipLibCalls.push_back(fn->getName());
 						// TODO: do we need to worry about duplicates? - make it a set instead
+					} else if (anno == abft_anno) {
+						if (verboseFlag) errs() << "Directive: protect function '" << fn->getName() << "' with ABFT\n";
+						abftFns.insert(fn);
+						skipLibCalls.push_back(fn->getName());
+						fnsToSkip.insert(fn);
+						fnsToClone.erase(fn);
 					} else if (anno.startswith("no-verify-")) {
 						StringRef global_name = anno.substr(10, anno.size() - 10);
 
@@ -467,6 +692,27 @@ void dataflowProtection::processAnnotations(Module& M) {
 						protectedLibList.insert(fn);
 						// it needs to be added to clone list as well
 						fnsToClone.insert(fn);
+					} else if (anno == dwc_level_anno) {
+						if (verboseFlag) errs() << "Directive: protect function '" << fn->getName() << "' with DWC\n";
+						fnLevelMap[fn] = 2;
+					} else if (anno == tmr_level_anno) {
+						if (verboseFlag) errs() << "Directive: protect function '" << fn->getName() << "' with TMR\n";
+						fnLevelMap[fn] = 3;
+					} else if (anno == output_anno) {
+						if (verboseFlag) errs() << "Directive: return value of function '" << fn->getName() << "' is an output\n";
+						outputFns.insert(fn);
+					} else if (anno == sync_all_anno) {
+						if (verboseFlag) errs() << "Directive: keep all sync points in function '" << fn->getName() << "'\n";
+						fnSyncLevelMap[fn] = SYNC_ALL;
+					} else if (anno == sync_memory_anno) {
+						if (verboseFlag) errs() << "Directive: only sync on memory and calls in function '" << fn->getName() << "'\n";
+						fnSyncLevelMap[fn] = SYNC_MEMORY;
+					} else if (anno == sync_boundary_anno) {
+						if (verboseFlag) errs() << "Directive: only sync at the boundaries of function '" << fn->getName() << "'\n";
+						fnSyncLevelMap[fn] = SYNC_BOUNDARY;
+					} else if (anno == multi_version_anno) {
+						if (verboseFlag) errs() << "Directive: keep an unprotected version of function '" << fn->getName() << "'\n";
+						multiVersionFns.insert(fn);
 					} else {
 						assert(false && "Invalid option on function");
 					}
@@ -485,6 +731,15 @@ void dataflowProtection::processAnnotations(Module& M) {
 					} else if (anno == default_no_xMR) {
 						if (verboseFlag) errs() << "Directive: set no xMR as default\n";
 						xMR_default = false;
+					} else if (anno == dwc_level_anno) {
+						if (verboseFlag) errs() << "Directive: protect global variable '" << gv->getName() << "' with DWC\n";
+						globalLevelMap[gv] = 2;
+					} else if (anno == tmr_level_anno) {
+						if (verboseFlag) errs() << "Directive: protect global variable '" << gv->getName() << "' with TMR\n";
+						globalLevelMap[gv] = 3;
+					} else if (anno == output_anno) {
+						if (verboseFlag) errs() << "Directive: global variable '" << gv->getName() << "' is an output\n";
+						outputGlobals.insert(gv);
 					} else {
 						if (verboseFlag) errs() << "Directive: " << anno << "\n";
 						assert(false && "Invalid option on global value");
@@ -537,6 +792,9 @@ void dataflowProtection::processLocalAnnotations(Module& M) {
 	std::set<CallInst*> skippedIndirectCalls;
 	// Local variables
 	for (auto &F : M) {
+		// only look at our own functions when protecting another level
+		if (isLevelSubset && (fnsToClone.find(&F) == fnsToClone.end()))
+			continue;
 		for (auto &bb : F) {
 			for (auto &I : bb) {
 				if ( auto CI = dyn_cast<CallInst>(&I) ) {
@@ -679,6 +937,9 @@ void dataflowProtection::removeLocalAnnotations(Module& M) {
 	Function* lva = NULL;
 
 	for (auto &F : M) {
+		// the rest are removed by the pass protecting the rest of the module
+		if (isLevelSubset && (fnsToClone.find(&F) == fnsToClone.end()))
+			continue;
 		for (auto & bb : F) {
 			for (auto & I : bb) {
 				if (auto CI = dyn_cast<CallInst>(&I)) {
@@ -711,6 +972,10 @@ void dataflowProtection::removeLocalAnnotations(Module& M) {
 		}
 	}
 
+	if (isLevelSubset) {
+		return;
+	}
+
 	if (lva) {
 		lva->removeFromParent();
 	}
@@ -0,0 +1,295 @@
+/*
+ * memFusion.cpp
+ *
+ * This file contains the logic for fusing the copies of memcpy and memset.
+ * Each copy of a replicated llvm.memcpy or llvm.memset is its own call, so the
+ *  copies stream through memory one after another, and each one can push the
+ *  others out of the cache.  With -fuseMemOps, the copies are replaced by a
+ *  single loop that copies (or sets) a word of every replica each time around.
+ * With -fuseMemVote, the words read from the copies of the source are also
+ *  compared as they are copied.  TMR writes the voted value to every copy of
+ *  the destination, and DWC reports a mismatch once the copy is done.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <set>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> fuseMemOpsFlag;
+extern cl::opt<bool> fuseMemVoteFlag;
+extern cl::opt<bool> ReportErrorsFlag;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::string fault_function_name;
+extern std::string tmr_global_count_name;
+
+
+/*
+ * Loop from `start` to `end` over elements of type `elemTy`, copying from each of `srcs`
+ *  to the matching one of `dsts`.  For memset, `srcs` is empty and `vals` has the value
+ *  to store in each copy.
+ * If `diff` is not null, the differences between the copies of the source are ORed into it.
+ * The builder is left at the end of the new exit block, and `diff` is updated to the value
+ *  there.
+ */
+static void emitFusedLoop(IRBuilder<>& builder, std::vector<Value*>& dsts, std::vector<Value*>& srcs,
+		std::vector<Value*>& vals, Type* elemTy, unsigned align, Value* start, Value* end,
+		bool vote, Value*& diff, const Twine& name) {
+	LLVMContext& C = builder.getContext();
+	BasicBlock* preBB = builder.GetInsertBlock();
+	Function* F = preBB->getParent();
+	BasicBlock* exitBB = preBB->splitBasicBlock(builder.GetInsertPoint(), name + ".end");
+	BasicBlock* loopBB = BasicBlock::Create(C, name, F, exitBB);
+	Type* idxTy = start->getType();
+
+	// the branch from splitting the block becomes the loop guard
+	preBB->getTerminator()->eraseFromParent();
+	builder.SetInsertPoint(preBB);
+	builder.CreateCondBr(builder.CreateICmpULT(start, end), loopBB, exitBB);
+
+	builder.SetInsertPoint(loopBB);
+	PHINode* idx = builder.CreatePHI(idxTy, 2, name + ".idx");
+	idx->addIncoming(start, preBB);
+	PHINode* diffPhi = nullptr;
+	if (diff) {
+		diffPhi = builder.CreatePHI(elemTy, 2, name + ".diff");
+		diffPhi->addIncoming(Constant::getNullValue(elemTy), preBB);
+	}
+
+	// load every copy of the source before storing any of them
+	std::vector<Value*> loaded;
+	for (unsigned i = 0; i < srcs.size(); i++) {
+		Value* ptr = builder.CreateBitCast(srcs[i], elemTy->getPointerTo());
+		loaded.push_back(builder.CreateAlignedLoad(builder.CreateGEP(ptr, idx), align));
+	}
+	if (srcs.empty())
+		loaded = vals;
+
+	Value* nextDiff = nullptr;
+	if (diffPhi) {
+		Value* d = builder.CreateXor(loaded[0], loaded[1]);
+		if (loaded.size() > 2)
+			d = builder.CreateOr(d, builder.CreateXor(loaded[0], loaded[2]));
+		nextDiff = builder.CreateOr(diffPhi, d);
+	}
+	if (vote && (loaded.size() > 2)) {
+		Value* voted = builder.CreateOr(builder.CreateOr(
+				builder.CreateAnd(loaded[0], loaded[1]), builder.CreateAnd(loaded[0], loaded[2])),
+				builder.CreateAnd(loaded[1], loaded[2]), "voted");
+		loaded.assign(loaded.size(), voted);
+	}
+	for (unsigned i = 0; i < dsts.size(); i++) {
+		Value* ptr = builder.CreateBitCast(dsts[i], elemTy->getPointerTo());
+		builder.CreateAlignedStore(loaded[i], builder.CreateGEP(ptr, idx), align);
+	}
+
+	Value* nextIdx = builder.CreateAdd(idx, ConstantInt::get(idxTy, 1));
+	idx->addIncoming(nextIdx, loopBB);
+	if (diffPhi)
+		diffPhi->addIncoming(nextDiff, loopBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextIdx, end), loopBB, exitBB);
+
+	builder.SetInsertPoint(exitBB, exitBB->begin());
+	if (diff) {
+		PHINode* diffOut = builder.CreatePHI(elemTy, 2, name + ".diff.out");
+		diffOut->addIncoming(Constant::getNullValue(elemTy), preBB);
+		diffOut->addIncoming(nextDiff, loopBB);
+		// combine with whatever was found before this loop
+		Value* prevDiff = builder.CreateZExtOrTrunc(diff, idxTy);
+		diff = builder.CreateOr(prevDiff, builder.CreateZExtOrTrunc(diffOut, idxTy));
+	}
+}
+
+
+/*
+ * Replace the copies of each replicated memcpy and memset with one loop.
+ * This is done after the synchronization logic is in place, so the lengths have
+ *  already been voted on (TMR) or compared (DWC).  The copies are only fused if
+ *  they're in the same block, with nothing between them that touches memory, so
+ *  moving them to the last copy doesn't change what any other instruction sees.
+ * When the code is segmented, the copies are apart and are left alone.
+ */
+void dataflowProtection::fuseMemIntrinsics(Module& M) {
+	if (!fuseMemOpsFlag)
+		return;
+
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	IntegerType* intPtrTy = DL.getIntPtrType(C);
+	Type* i8Ty = Type::getInt8Ty(C);
+	unsigned wordSize = DL.getTypeAllocSize(intPtrTy);
+	std::set<Instruction*> removed;
+	unsigned numFused = 0;
+
+	// the same value, or the DWC copy of it, which was checked before the call
+	auto sameOperand = [this](Value* orig, Value* copy, unsigned copyNum) {
+		if (orig == copy)
+			return true;
+		if (TMR || !isCloned(orig))
+			return false;
+		return (copyNum == 1) && (getClone(orig).first == copy);
+	};
+
+	for (auto F : fnsToClone) {
+		if (F->isDeclaration())
+			continue;
+
+		std::vector<MemIntrinsic*> origCalls;
+		for (auto & bb : *F) {
+			for (auto & I : bb) {
+				MemIntrinsic* MI = dyn_cast<MemIntrinsic>(&I);
+				if (MI && (isa<MemCpyInst>(MI) || isa<MemSetInst>(MI)) &&
+						(cloneMap.find(MI) != cloneMap.end()))
+					origCalls.push_back(MI);
+			}
+		}
+
+		for (auto MI : origCalls) {
+			std::vector<MemIntrinsic*> copies = {MI};
+			copies.push_back(dyn_cast_or_null<MemIntrinsic>(cloneMap[MI].first));
+			if (TMR)
+				copies.push_back(dyn_cast_or_null<MemIntrinsic>(cloneMap[MI].second));
+
+			bool canFuse = true;
+			for (unsigned i = 0; i < copies.size(); i++) {
+				MemIntrinsic* copy = copies[i];
+				if (!copy || (copy->getParent() != MI->getParent()) || copy->isVolatile() ||
+						(copy->getIntrinsicID() != MI->getIntrinsicID()) ||
+						!sameOperand(MI->getLength(), copy->getLength(), i)) {
+					canFuse = false;
+					break;
+				}
+				if (MemSetInst* MS = dyn_cast<MemSetInst>(copy)) {
+					if (!sameOperand(cast<MemSetInst>(MI)->getValue(), MS->getValue(), i))
+						canFuse = false;
+				}
+			}
+			if (!canFuse)
+				continue;
+
+			// nothing between the copies can read or write memory
+			Instruction* last = nullptr;
+			unsigned seen = 0;
+			for (auto & I : *MI->getParent()) {
+				if (std::find(copies.begin(), copies.end(), &I) != copies.end()) {
+					seen++;
+					last = &I;
+					if (seen == copies.size())
+						break;
+				} else if (seen && I.mayReadOrWriteMemory()) {
+					canFuse = false;
+					break;
+				}
+			}
+			if (!canFuse)
+				continue;
+
+			unsigned align = MI->getDestAlignment();
+			if (MemCpyInst* MC = dyn_cast<MemCpyInst>(MI))
+				align = std::min(align, MC->getSourceAlignment());
+			std::vector<Value*> dsts, srcs, wordVals, byteVals;
+			for (auto copy : copies) {
+				dsts.push_back(copy->getRawDest());
+				align = std::min(align, copy->getDestAlignment());
+				if (MemCpyInst* MC = dyn_cast<MemCpyInst>(copy)) {
+					srcs.push_back(MC->getRawSource());
+					align = std::min(align, MC->getSourceAlignment());
+				}
+			}
+			align = std::max(align, 1u);
+
+			IRBuilder<> builder(last);
+			Value* len = builder.CreateZExtOrTrunc(MI->getLength(), intPtrTy, "fused.len");
+			Value* numWords = builder.CreateUDiv(len, ConstantInt::get(intPtrTy, wordSize), "fused.words");
+			Value* tailStart = builder.CreateMul(numWords, ConstantInt::get(intPtrTy, wordSize));
+			if (isa<MemSetInst>(MI)) {
+				// the byte is repeated across the word
+				Constant* splat = ConstantInt::get(intPtrTy, APInt::getSplat(wordSize * 8, APInt(8, 1)));
+				for (unsigned i = 0; i < copies.size(); i++) {
+					Value* byteVal = cast<MemSetInst>(copies[i])->getValue();
+					byteVals.push_back(byteVal);
+					wordVals.push_back(builder.CreateMul(builder.CreateZExt(byteVal, intPtrTy), splat));
+				}
+			}
+
+			// only a copy has something to vote on
+			bool vote = fuseMemVoteFlag && !srcs.empty();
+			Value* diff = vote ? ConstantInt::get(intPtrTy, 0) : nullptr;
+			emitFusedLoop(builder, dsts, srcs, wordVals, intPtrTy, std::min(align, wordSize),
+					ConstantInt::get(intPtrTy, 0), numWords, vote, diff, "fused");
+			for (auto & dst : dsts) {
+				dst = builder.CreateGEP(dst, tailStart);
+			}
+			for (auto & src : srcs) {
+				src = builder.CreateGEP(src, tailStart);
+			}
+			emitFusedLoop(builder, dsts, srcs, byteVals, i8Ty, 1, ConstantInt::get(intPtrTy, 0),
+					builder.CreateSub(len, tailStart), vote, diff, "fused.tail");
+
+			if (vote) {
+				Value* mismatch = builder.CreateICmpNE(diff, ConstantInt::get(intPtrTy, 0), "fused.mismatch");
+				if (TMR) {
+					GlobalVariable* TMRErrorDetected = M.getGlobalVariable(tmr_global_count_name);
+					if (ReportErrorsFlag && TMRErrorDetected) {
+						Type* countTy = TMRErrorDetected->getValueType();
+						Value* oldCount = builder.CreateLoad(TMRErrorDetected);
+						Value* newCount = builder.CreateAdd(oldCount,
+								builder.CreateZExt(mismatch, countTy));
+						builder.CreateStore(newCount, TMRErrorDetected);
+					}
+				} else {
+					// DWC can't tell which copy of the source is right
+					Function* errFn = M.getFunction(fault_function_name);
+					assert(errFn && "error function exists");
+					BasicBlock* curBB = builder.GetInsertBlock();
+					BasicBlock* okBB = curBB->splitBasicBlock(builder.GetInsertPoint(), "fused.ok");
+					BasicBlock* errBB = BasicBlock::Create(C, "fused.mismatch", F, okBB);
+					curBB->getTerminator()->eraseFromParent();
+					builder.SetInsertPoint(curBB);
+					builder.CreateCondBr(mismatch, errBB, okBB);
+					builder.SetInsertPoint(errBB);
+					builder.CreateCall(errFn);
+					builder.CreateUnreachable();
+				}
+			}
+
+			removed.insert(copies.begin(), copies.end());
+			numFused++;
+		}
+	}
+
+	// don't leave anything behind that refers to the old calls
+	if (!removed.empty()) {
+		std::set<Value*> removedValues(removed.begin(), removed.end());
+		removeFromCloneMap(removedValues);
+		syncPoints.erase(std::remove_if(syncPoints.begin(), syncPoints.end(),
+				[&removed](Instruction* I) { return removed.find(I) != removed.end(); }), syncPoints.end());
+		for (auto it = startOfSyncLogic.begin(); it != startOfSyncLogic.end(); ) {
+			if (removed.find(it->first) != removed.end())
+				it = startOfSyncLogic.erase(it);
+			else
+				it++;
+		}
+		for (auto I : removed) {
+			I->eraseFromParent();
+		}
+	}
+
+	if (verboseFlag)
+		errs() << info_string << " fused " << numFused << " replicated memcpy/memset calls\n";
+}
@@ -0,0 +1,438 @@
+/*
+ * multiVersion.cpp
+ *
+ * This file contains the logic for keeping an unprotected version of some
+ *  functions next to the protected one, and choosing between them at run time.
+ * A function marked with __xMR_MULTI_VERSION or -multiVersionFns gets a copy of
+ *  its original body, and of the body of each protected function it calls,
+ *  before anything is cloned.  When the protected version is called, it checks
+ *  a flag, and if protection is turned off, it calls the copy instead.
+ * The flag is set with COAST_SET_PROTECTION(), and can be changed at any time.
+ *  The copy only uses the originals, so after it returns, the globals it wrote
+ *  are copied to their copies.  Each call leaves memory the same way a
+ *  protected call would, so the protected code never sees copies that don't
+ *  match, no matter when the flag changes.  This only works if the copy can't
+ *  write anywhere else, so it may only write to its own locals and to globals.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <set>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> interleaveMemFlag;
+extern cl::opt<std::string> shadowMemMode;
+extern cl::opt<bool> verboseFlag;
+
+// run-time flag checked by the protected versions, 0 means call the unprotected ones
+static const std::string protectionFlagName = "__COAST_protection_on";
+
+
+/*
+ * Find the globals that a write through ptr in an unprotected copy can change.
+ * Writes through the arguments of a function are followed back to each call to it,
+ *  and pointers kept in a local are followed back to each store to it.
+ * Returns false if it could write somewhere that isn't a local or a global,
+ *  or through the arguments of a function called from protected code.
+ */
+static bool findWrittenGlobals(Value* ptr, const DataLayout& DL, std::set<Function*>& roots,
+		std::map<Function*, std::vector<CallInst*> >& callSites,
+		std::set<GlobalVariable*>& written, std::set<Value*>& visited)
+{
+	SmallVector<Value*, 4> objects;
+	GetUnderlyingObjects(ptr, objects, DL, nullptr, 0);
+
+	for (auto obj : objects) {
+		if (isa<AllocaInst>(obj))
+			continue;
+		if (GlobalVariable* g = dyn_cast<GlobalVariable>(obj)) {
+			if (!g->isConstant())
+				written.insert(g);
+			continue;
+		}
+
+		if (Argument* arg = dyn_cast<Argument>(obj)) {
+			if (roots.find(arg->getParent()) != roots.end())
+				return false;
+			if (!visited.insert(arg).second)
+				continue;
+			for (auto CI : callSites[arg->getParent()]) {
+				if (!findWrittenGlobals(CI->getArgOperand(arg->getArgNo()), DL, roots, callSites, written, visited))
+					return false;
+			}
+			continue;
+		}
+
+		LoadInst* LI = dyn_cast<LoadInst>(obj);
+		if (!LI)
+			return false;
+		Value* from = GetUnderlyingObject(LI->getPointerOperand(), DL, 0);
+		// memory that belongs to code outside of the module, like stdout
+		GlobalVariable* fromGlobal = dyn_cast<GlobalVariable>(from);
+		if (fromGlobal && fromGlobal->isDeclaration())
+			continue;
+		// a local that holds a pointer, like at -O0, can only hold what is stored to it
+		AllocaInst* AI = dyn_cast<AllocaInst>(from);
+		if (!AI || (AI != LI->getPointerOperand()))
+			return false;
+		if (!visited.insert(AI).second)
+			continue;
+		for (auto U : AI->users()) {
+			if (isa<LoadInst>(U))
+				continue;
+			StoreInst* SI = dyn_cast<StoreInst>(U);
+			if (!SI || (SI->getPointerOperand() != AI))
+				return false;
+			if (!findWrittenGlobals(SI->getValueOperand(), DL, roots, callSites, written, visited))
+				return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Make the unprotected copy of an original function.
+ * Calls to other protected functions are changed to call their unprotected copies,
+ *  with only the original arguments, so the copy never uses anything that was cloned.
+ * Must be called before the instructions are cloned, so the original bodies are still intact.
+ */
+Function* dataflowProtection::getFastVersion(Function* F) {
+	if (fastVersions.find(F) != fastVersions.end())
+		return fastVersions[F];
+
+	ValueToValueMapTy VMap;
+	Function* fast = CloneFunction(F, VMap);
+	fast->setName(F->getName() + ".fast");
+	fast->setLinkage(GlobalValue::InternalLinkage);
+	fastVersions[F] = fast;
+	// nothing in it is cloned or synchronized
+	fnsToSkip.insert(fast);
+	fnsToCloneAndSkip.insert(fast);
+
+	// the calls in a function protected in place already go to the new versions
+	std::map<Function*, Function*> origOf;
+	for (auto entry : functionMap) {
+		origOf[entry.second] = entry.first;
+	}
+
+	std::vector<CallInst*> calls;
+	for (auto & bb : *fast) {
+		for (auto & I : bb) {
+			if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+				calls.push_back(CI);
+			} else if (isa<InvokeInst>(&I)) {
+				errs() << err_string << " '" << F->getName() << "' can't have an unprotected version, "
+					   << "exceptions aren't supported\n";
+				PRINT_VALUE(&I);
+				exit(-1);
+			}
+		}
+	}
+
+	for (auto CI : calls) {
+		if (CI->isInlineAsm())
+			continue;
+		Function* calledF = CI->getCalledFunction();
+		if (!calledF) {
+			errs() << err_string << " '" << F->getName() << "' can't have an unprotected version, "
+				   << "it makes an indirect function call\n";
+			PRINT_VALUE(CI);
+			exit(-1);
+		}
+
+		Function* orig = calledF;
+		while (origOf.find(orig) != origOf.end() && (origOf[orig] != orig))
+			orig = origOf[orig];
+		if ( (replReturn.find(orig) != replReturn.end()) || (replReturn.find(calledF) != replReturn.end()) ) {
+			errs() << err_string << " '" << F->getName() << "' can't have an unprotected version, "
+				   << "it calls '" << orig->getName() << "', which has its return value replicated\n";
+			exit(-1);
+		}
+
+		// unprotected functions are called the same way from both versions
+		bool isProtected = (fnsToClone.find(orig) != fnsToClone.end()) ||
+						   (functionMap.find(orig) != functionMap.end());
+		if (orig->isDeclaration() || !isProtected)
+			continue;
+
+		Function* fastCallee = getFastVersion(orig);
+		if (orig == calledF) {
+			CI->setCalledFunction(fastCallee);
+			continue;
+		}
+
+		// leave out the copies of the arguments
+		std::set<Value*> argCopies;
+		for (auto & arg : calledF->args()) {
+			if (cloneMap.find(&arg) != cloneMap.end()) {
+				argCopies.insert(cloneMap[&arg].first);
+				argCopies.insert(cloneMap[&arg].second);
+			}
+		}
+		std::vector<Value*> args;
+		for (auto & arg : calledF->args()) {
+			if (argCopies.find(&arg) == argCopies.end())
+				args.push_back(CI->getArgOperand(arg.getArgNo()));
+		}
+		assert((args.size() == fastCallee->arg_size()) && "only the original arguments are left");
+
+		CallInst* newCall = CallInst::Create(fastCallee, args, "", CI);
+		newCall->takeName(CI);
+		newCall->setDebugLoc(CI->getDebugLoc());
+		CI->replaceAllUsesWith(newCall);
+		CI->eraseFromParent();
+	}
+
+	return fast;
+}
+
+
+/*
+ * Make the unprotected copies of the functions marked to have one, and find the
+ *  globals each copy can write, so they can be copied after it returns.
+ * Must be called after the function arguments are cloned, so the protected
+ *  versions are known, and before anything is cloned.
+ */
+void dataflowProtection::createMultiVersions(Module& M) {
+	if (isLevelSubset || multiVersionFns.empty())
+		return;
+
+	// these change where the copies of memory are, so they can't just be copied
+	if (interleaveMemFlag || !shadowMemMode.empty()) {
+		errs() << err_string << " unprotected versions of functions can't be used with -interleaveMem or -shadowMem\n";
+		exit(-1);
+	}
+
+	const DataLayout& DL = M.getDataLayout();
+	std::set<Function*> roots;
+
+	for (auto F : multiVersionFns) {
+		if (F->isDeclaration())
+			continue;
+		if (F->getName() == "main" || F->isVarArg() || (replReturn.find(F) != replReturn.end())) {
+			errs() << err_string << " '" << F->getName() << "' can't have an unprotected version, "
+				   << "it can't be main, variadic, or have its return value replicated\n";
+			exit(-1);
+		}
+		bool isProtected = (fnsToClone.find(F) != fnsToClone.end()) ||
+						   (functionMap.find(F) != functionMap.end());
+		if (!isProtected) {
+			errs() << warn_string << " '" << F->getName()
+				   << "' isn't protected, so it doesn't need an unprotected version\n";
+			continue;
+		}
+
+		Function* fast = getFastVersion(F);
+		Function* prot = (functionMap.find(F) != functionMap.end()) ? functionMap[F] : F;
+		multiVersionMap[prot] = fast;
+		roots.insert(fast);
+	}
+
+	// which of the copies each one calls, and from where
+	std::set<Function*> fastFns;
+	for (auto entry : fastVersions) {
+		fastFns.insert(entry.second);
+	}
+	std::map<Function*, std::vector<CallInst*> > callSites;
+	std::map<Function*, std::set<Function*> > callees;
+	for (auto fast : fastFns) {
+		for (auto & bb : *fast) {
+			for (auto & I : bb) {
+				CallInst* CI = dyn_cast<CallInst>(&I);
+				if (CI && (fastFns.find(CI->getCalledFunction()) != fastFns.end())) {
+					callSites[CI->getCalledFunction()].push_back(CI);
+					callees[fast].insert(CI->getCalledFunction());
+				}
+			}
+		}
+	}
+
+	// everywhere each copy writes
+	std::map<Function*, Function*> origOfFast;
+	for (auto entry : fastVersions) {
+		origOfFast[entry.second] = entry.first;
+	}
+	std::map<Function*, std::set<GlobalVariable*> > written;
+	for (auto fast : fastFns) {
+		for (auto & bb : *fast) {
+			for (auto & I : bb) {
+				std::vector<Value*> ptrs;
+				if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+					ptrs.push_back(SI->getPointerOperand());
+				} else if (AtomicRMWInst* RMW = dyn_cast<AtomicRMWInst>(&I)) {
+					ptrs.push_back(RMW->getPointerOperand());
+				} else if (AtomicCmpXchgInst* CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+					ptrs.push_back(CX->getPointerOperand());
+				} else if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(&I)) {
+					ptrs.push_back(MI->getRawDest());
+				} else if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+					Function* calledF = CI->getCalledFunction();
+					if ( (fastFns.find(calledF) != fastFns.end()) || CI->onlyReadsMemory() ||
+							(calledF && calledF->isIntrinsic()) )
+						continue;
+					// anything else can write through its pointer arguments
+					for (unsigned i = 0; i < CI->getNumArgOperands(); i++) {
+						if (!CI->getArgOperand(i)->getType()->isPointerTy())
+							continue;
+						if (CI->paramHasAttr(i, Attribute::ReadOnly) || CI->paramHasAttr(i, Attribute::ReadNone))
+							continue;
+						ptrs.push_back(CI->getArgOperand(i));
+					}
+				}
+
+				for (auto ptr : ptrs) {
+					std::set<Value*> visited;
+					if (!findWrittenGlobals(ptr, DL, roots, callSites, written[fast], visited)) {
+						errs() << err_string << " '" << origOfFast[fast]->getName()
+							   << "' can't have an unprotected version, it can only write to its locals and globals\n";
+						PRINT_VALUE(&I);
+						exit(-1);
+					}
+				}
+			}
+		}
+	}
+
+	// including everything it calls
+	for (auto entry : multiVersionMap) {
+		std::set<Function*> reached = {entry.second};
+		std::vector<Function*> worklist = {entry.second};
+		while (!worklist.empty()) {
+			Function* fast = worklist.back();
+			worklist.pop_back();
+			fastWrittenGlobals[entry.first].insert(written[fast].begin(), written[fast].end());
+			for (auto callee : callees[fast]) {
+				if (reached.insert(callee).second)
+					worklist.push_back(callee);
+			}
+		}
+	}
+
+	if (verboseFlag) {
+		errs() << info_string << " keeping unprotected versions of " << multiVersionMap.size()
+			   << " functions, with " << fastFns.size() << " copies in all\n";
+	}
+}
+
+
+/*
+ * Have each protected version check the flag when it's called, and call the
+ *  unprotected copy instead if protection is turned off.  Then fill in the
+ *  body of the function that sets the flag.
+ * Must be called after the sync logic is moved, since the entry blocks are split.
+ */
+void dataflowProtection::insertMultiVersionDispatch(Module& M) {
+	if (isLevelSubset)
+		return;
+	Function* setFn = M.getFunction(set_protection_fn_name);
+	if (multiVersionMap.empty() && !setFn)
+		return;
+	if (setFn && !setFn->isDeclaration())
+		return;
+
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+
+	GlobalVariable* flag = new GlobalVariable(M, i32Ty, false, GlobalValue::InternalLinkage,
+			ConstantInt::get(i32Ty, 1), protectionFlagName);
+	globalsToSkip.insert(flag);
+
+	// the copies of globals that are still around
+	std::set<Value*> liveGlobals;
+	for (GlobalVariable & g : M.globals()) {
+		liveGlobals.insert(&g);
+	}
+
+	for (auto entry : multiVersionMap) {
+		Function* prot = entry.first;
+		Function* fast = entry.second;
+
+		// the allocas stay in the entry block
+		BasicBlock* entryBB = &prot->getEntryBlock();
+		BasicBlock::iterator splitPt = entryBB->getFirstInsertionPt();
+		while (isa<AllocaInst>(&*splitPt))
+			splitPt++;
+		BasicBlock* protBB = entryBB->splitBasicBlock(splitPt, "mv.protected");
+		BasicBlock* fastBB = BasicBlock::Create(C, "mv.unprotected", prot, protBB);
+		entryBB->getTerminator()->eraseFromParent();
+
+		// it can change from an interrupt, so read it each time
+		IRBuilder<> builder(entryBB);
+		Value* on = builder.CreateLoad(flag, true, "mv.on");
+		builder.CreateCondBr(builder.CreateICmpEQ(on, ConstantInt::get(i32Ty, 0)), fastBB, protBB);
+
+		// call the copy with only the original arguments
+		std::set<Value*> argCopies;
+		for (auto & arg : prot->args()) {
+			if (cloneMap.find(&arg) != cloneMap.end()) {
+				argCopies.insert(cloneMap[&arg].first);
+				argCopies.insert(cloneMap[&arg].second);
+			}
+		}
+		std::vector<Value*> args;
+		for (auto & arg : prot->args()) {
+			if (argCopies.find(&arg) == argCopies.end())
+				args.push_back(&arg);
+		}
+		assert((args.size() == fast->arg_size()) && "only the original arguments are left");
+
+		builder.SetInsertPoint(fastBB);
+		CallInst* fastCall = builder.CreateCall(fast, args);
+		if (DISubprogram* SP = prot->getSubprogram())
+			fastCall->setDebugLoc(DebugLoc::get(SP->getLine(), 0, SP));
+
+		// then the copies of the globals it wrote get the new values
+		for (auto g : fastWrittenGlobals[prot]) {
+			if (cloneMap.find(g) == cloneMap.end())
+				continue;
+			uint64_t size = DL.getTypeAllocSize(g->getValueType());
+			std::vector<Value*> copies = {cloneMap[g].first};
+			if (TMR)
+				copies.push_back(cloneMap[g].second);
+			for (auto copy : copies) {
+				if (!copy || (liveGlobals.find(copy) == liveGlobals.end()))
+					continue;
+				builder.CreateMemCpy(copy, 1, g, 1, size);
+			}
+		}
+
+		if (prot->getReturnType()->isVoidTy())
+			builder.CreateRetVoid();
+		else
+			builder.CreateRet(fastCall);
+
+		if (verboseFlag) {
+			errs() << info_string << " '" << prot->getName() << "' can call '" << fast->getName()
+				   << "', which writes " << fastWrittenGlobals[prot].size() << " globals\n";
+		}
+	}
+
+	// COAST_SET_PROTECTION(on)
+	if (!setFn) {
+		setFn = Function::Create(FunctionType::get(Type::getVoidTy(C), {i32Ty}, false),
+				GlobalValue::ExternalLinkage, set_protection_fn_name, &M);
+	}
+	BasicBlock* setBB = BasicBlock::Create(C, "entry", setFn);
+	IRBuilder<> builder(setBB);
+	Value* on = builder.CreateZExtOrTrunc(&*setFn->arg_begin(), i32Ty);
+	builder.CreateStore(builder.CreateZExt(builder.CreateICmpNE(on, ConstantInt::get(i32Ty, 0)), i32Ty), flag, true);
+	builder.CreateRetVoid();
+}
@@ -0,0 +1,484 @@
+/*
+ * outputSlice.cpp
+ *
+ * This file contains the logic for narrowing the scope of replication to the
+ *  backward slice of the outputs the user cares about.
+ * Outputs can be global variables, function return values, or the arguments
+ *  passed to output functions (like printf or a UART driver).
+ * Everything that can affect an output, through data, memory, or control flow,
+ *  is replicated as normal.  Everything else is only executed once.
+ *
+ * The analysis is conservative: memory is tracked per object (alloca or global),
+ *  and any pointer that can't be traced to an object is assumed to alias
+ *  every object whose address escapes.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <deque>
+#include <list>
+#include <string>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::list<std::string> outputNameList;
+extern std::list<std::string> outputCallList;
+
+// instructions outside of the slice are tagged with this until the
+//  function bodies have been copied by cloneFunctionArguments()
+std::string noSliceMDName = "coast.not_in_slice";
+
+
+//----------------------------------------------------------------------------//
+// Slice state
+//----------------------------------------------------------------------------//
+namespace {
+
+class OutputSlice {
+public:
+	OutputSlice(Module& M) : M(M), DL(&M) {
+		catalogMemoryUses();
+	}
+
+	void addValue(Value* v);
+	void addObject(Value* obj);
+
+	std::set<Value*> values;            /* instructions and arguments in the slice */
+	std::set<Value*> objects;           /* allocas and globals read by the slice */
+
+private:
+	Module& M;
+	DataLayout DL;
+	std::deque<Value*> worklist;
+
+	// who writes to memory
+	std::map<Value*, std::vector<Instruction*> > writersByObject;
+	std::vector<Instruction*> unknownWriters;
+	std::vector<Value*> escapedObjects;
+	std::set<Value*> escapedSet;
+	bool unknownMemory = false;
+
+	// control dependence
+	std::set<Function*> ctrlComputed;
+	std::map<BasicBlock*, std::set<Instruction*> > ctrlDeps;
+	std::set<BasicBlock*> ctrlVisited;
+	std::set<Function*> callersVisited;
+
+	Value* getMemObject(Value* ptr);
+	bool objectEscapes(Value* obj);
+	void catalogMemoryUses();
+	void computeControlDeps(Function* F);
+	void addControl(BasicBlock* bb);
+	void addCallers(Function* F);
+	void addUnknownMemory();
+	void visit(Value* v);
+
+public:
+	void run() {
+		while (!worklist.empty()) {
+			Value* v = worklist.front();
+			worklist.pop_front();
+			visit(v);
+		}
+	}
+};
+
+} // namespace
+
+
+/*
+ * Returns the alloca or global a pointer is based on, or nullptr if it can't be known.
+ */
+Value* OutputSlice::getMemObject(Value* ptr) {
+	Value* obj = GetUnderlyingObject(ptr, DL);
+	if (isa<AllocaInst>(obj) || isa<GlobalVariable>(obj))
+		return obj;
+	return nullptr;
+}
+
+
+/*
+ * An object escapes if its address can end up somewhere we can't follow it,
+ *  like another function, another pointer, or a PHI node.
+ */
+bool OutputSlice::objectEscapes(Value* obj) {
+	std::deque<Value*> ptrs;
+	std::set<Value*> seen;
+	ptrs.push_back(obj);
+
+	while (!ptrs.empty()) {
+		Value* ptr = ptrs.front();
+		ptrs.pop_front();
+		if (!seen.insert(ptr).second)
+			continue;
+
+		for (auto U : ptr->users()) {
+			if (isa<GEPOperator>(U) || isa<BitCastOperator>(U) || isa<AddrSpaceCastInst>(U)) {
+				ptrs.push_back(U);
+			} else if (isa<LoadInst>(U) || isa<CmpInst>(U)) {
+				continue;
+			} else if (StoreInst* SI = dyn_cast<StoreInst>(U)) {
+				if (SI->getValueOperand() == ptr)
+					return true;
+			} else if (CallInst* CI = dyn_cast<CallInst>(U)) {
+				// library calls are counted as writers instead, see catalogMemoryUses()
+				Function* calledF = CI->getCalledFunction();
+				if (!calledF || !calledF->isDeclaration())
+					return true;
+			} else if (ConstantExpr* CE = dyn_cast<ConstantExpr>(U)) {
+				if (CE->isCast())
+					ptrs.push_back(CE);
+				// annotations and the like
+				continue;
+			} else if (isa<Constant>(U)) {
+				continue;
+			} else {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+/*
+ * Find all the instructions that write to memory, and which object they write to.
+ */
+void OutputSlice::catalogMemoryUses() {
+	for (auto & F : M) {
+		for (auto & bb : F) {
+			for (auto & I : bb) {
+				if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+					if (Value* obj = getMemObject(SI->getPointerOperand()))
+						writersByObject[obj].push_back(SI);
+					else
+						unknownWriters.push_back(SI);
+				} else if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+					if (isa<DbgInfoIntrinsic>(CI) || CI->isInlineAsm())
+						continue;
+					// calls into user code are handled through the arguments and escapes
+					Function* calledF = CI->getCalledFunction();
+					if (calledF && !calledF->isDeclaration())
+						continue;
+					if (calledF && calledF->doesNotAccessMemory())
+						continue;
+					for (unsigned i = 0; i < CI->getNumArgOperands(); i++) {
+						Value* arg = CI->getArgOperand(i);
+						if (!arg->getType()->isPointerTy())
+							continue;
+						if (Value* obj = getMemObject(arg))
+							writersByObject[obj].push_back(CI);
+						else
+							unknownWriters.push_back(CI);
+					}
+				}
+			}
+		}
+	}
+
+	for (auto & g : M.globals()) {
+		if (objectEscapes(&g)) {
+			escapedObjects.push_back(&g);
+			escapedSet.insert(&g);
+		}
+	}
+	for (auto & F : M) {
+		for (auto & I : instructions(F)) {
+			if (isa<AllocaInst>(&I) && objectEscapes(&I)) {
+				escapedObjects.push_back(&I);
+				escapedSet.insert(&I);
+			}
+		}
+	}
+}
+
+
+/*
+ * Standard control dependence from the post-dominator tree:
+ *  a block is control dependent on a branch if it post-dominates one of the
+ *  successors of the branch, but not the branch itself.
+ */
+void OutputSlice::computeControlDeps(Function* F) {
+	if (!ctrlComputed.insert(F).second)
+		return;
+
+	PostDominatorTree PDT(*F);
+	for (auto & bb : *F) {
+		TerminatorInst* TI = bb.getTerminator();
+		if (!TI || TI->getNumSuccessors() < 2)
+			continue;
+
+		DomTreeNode* bbNode = PDT.getNode(&bb);
+		BasicBlock* stopAt = nullptr;
+		if (bbNode && bbNode->getIDom())
+			stopAt = bbNode->getIDom()->getBlock();
+
+		for (unsigned i = 0; i < TI->getNumSuccessors(); i++) {
+			BasicBlock* runner = TI->getSuccessor(i);
+			while (runner && runner != stopAt) {
+				ctrlDeps[runner].insert(TI);
+				DomTreeNode* node = PDT.getNode(runner);
+				if (!node || !node->getIDom())
+					break;
+				runner = node->getIDom()->getBlock();
+			}
+		}
+	}
+}
+
+
+void OutputSlice::addControl(BasicBlock* bb) {
+	if (!ctrlVisited.insert(bb).second)
+		return;
+	computeControlDeps(bb->getParent());
+	for (auto TI : ctrlDeps[bb]) {
+		addValue(TI);
+	}
+}
+
+
+/*
+ * Whether a function runs at all depends on the control flow around its calls.
+ */
+void OutputSlice::addCallers(Function* F) {
+	if (!callersVisited.insert(F).second)
+		return;
+	for (auto U : F->users()) {
+		if (CallInst* CI = dyn_cast<CallInst>(U)) {
+			if (CI->getCalledFunction() != F)
+				continue;
+			addControl(CI->getParent());
+			addCallers(CI->getFunction());
+		}
+	}
+}
+
+
+/*
+ * Reading through a pointer we can't follow means any escaped object might be read.
+ */
+void OutputSlice::addUnknownMemory() {
+	if (unknownMemory)
+		return;
+	unknownMemory = true;
+	for (auto I : unknownWriters) {
+		addValue(I);
+	}
+	for (auto obj : escapedObjects) {
+		addObject(obj);
+	}
+}
+
+
+void OutputSlice::addValue(Value* v) {
+	if (isa<Instruction>(v) || isa<Argument>(v)) {
+		if (values.insert(v).second)
+			worklist.push_back(v);
+	}
+}
+
+
+void OutputSlice::addObject(Value* obj) {
+	if (!objects.insert(obj).second)
+		return;
+	addValue(obj);
+	for (auto I : writersByObject[obj]) {
+		addValue(I);
+	}
+	if (escapedSet.find(obj) != escapedSet.end()) {
+		addUnknownMemory();
+	}
+}
+
+
+void OutputSlice::visit(Value* v) {
+	// the actual values passed in to this argument
+	if (Argument* arg = dyn_cast<Argument>(v)) {
+		Function* F = arg->getParent();
+		for (auto U : F->users()) {
+			CallInst* CI = dyn_cast<CallInst>(U);
+			if (CI && (CI->getCalledFunction() == F) && (arg->getArgNo() < CI->getNumArgOperands())) {
+				addValue(CI->getArgOperand(arg->getArgNo()));
+			}
+		}
+		return;
+	}
+
+	Instruction* I = dyn_cast<Instruction>(v);
+	addControl(I->getParent());
+	addCallers(I->getFunction());
+
+	if (LoadInst* LI = dyn_cast<LoadInst>(I)) {
+		addValue(LI->getPointerOperand());
+		if (Value* obj = getMemObject(LI->getPointerOperand()))
+			addObject(obj);
+		else
+			addUnknownMemory();
+	} else if (CallInst* CI = dyn_cast<CallInst>(I)) {
+		Function* calledF = CI->getCalledFunction();
+		if (calledF && !calledF->isDeclaration()) {
+			// the return value depends on whatever the callee returns
+			for (auto & bb : *calledF) {
+				if (ReturnInst* RI = dyn_cast<ReturnInst>(bb.getTerminator())) {
+					addValue(RI);
+				}
+			}
+		} else {
+			addValue(CI->getCalledValue());
+			for (unsigned i = 0; i < CI->getNumArgOperands(); i++) {
+				Value* arg = CI->getArgOperand(i);
+				addValue(arg);
+				if (!arg->getType()->isPointerTy())
+					continue;
+				if (Value* obj = getMemObject(arg))
+					addObject(obj);
+				else
+					addUnknownMemory();
+			}
+		}
+	} else if (PHINode* phi = dyn_cast<PHINode>(I)) {
+		// which value is picked depends on where we came from
+		for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+			addValue(phi->getIncomingValue(i));
+			addValue(phi->getIncomingBlock(i)->getTerminator());
+		}
+	} else {
+		for (unsigned i = 0; i < I->getNumOperands(); i++) {
+			addValue(I->getOperand(i));
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------//
+// Applying the slice
+//----------------------------------------------------------------------------//
+/*
+ * Work out which instructions, functions, and globals can affect the outputs,
+ *  and take everything else out of the scope of replication.
+ * Must be called after populateFnWorklist() and before populateValuesToClone().
+ */
+void dataflowProtection::computeOutputSlice(Module& M) {
+	if (isLevelSubset)
+		return;
+
+	// convert names from the command line and configuration file
+	for (auto name : outputNameList) {
+		if (GlobalVariable* gv = M.getGlobalVariable(name, true)) {
+			outputGlobals.insert(gv);
+		} else if (Function* F = M.getFunction(name)) {
+			outputFns.insert(F);
+		} else {
+			errs() << warn_string << " output '" << name << "' does not exist\n";
+		}
+	}
+
+	if (outputGlobals.empty() && outputFns.empty() && outputCallList.empty())
+		return;
+
+	OutputSlice slice(M);
+
+	for (auto gv : outputGlobals) {
+		slice.addObject(gv);
+	}
+	for (auto F : outputFns) {
+		for (auto & bb : *F) {
+			if (ReturnInst* RI = dyn_cast<ReturnInst>(bb.getTerminator()))
+				slice.addValue(RI);
+		}
+	}
+	for (auto name : outputCallList) {
+		Function* outF = M.getFunction(name);
+		if (!outF) {
+			errs() << warn_string << " output function '" << name << "' does not exist\n";
+			continue;
+		}
+		for (auto U : outF->users()) {
+			if (CallInst* CI = dyn_cast<CallInst>(U)) {
+				if (CI->getCalledFunction() == outF)
+					slice.addValue(CI);
+			}
+		}
+	}
+	slice.run();
+
+	// Functions with nothing in the slice don't need to be cloned at all
+	std::set<Function*> outOfSlice;
+	unsigned skippedInsts = 0;
+	LLVMContext& C = M.getContext();
+	for (auto F : fnsToClone) {
+		bool inSlice = false;
+		for (auto & I : instructions(F)) {
+			if (slice.values.find(&I) != slice.values.end()) {
+				inSlice = true;
+				break;
+			}
+		}
+		if (!inSlice) {
+			outOfSlice.insert(F);
+			continue;
+		}
+
+		// Calls and terminators are never cloned, so leave them alone
+		for (auto & I : instructions(F)) {
+			if (isa<CallInst>(&I) || isa<InvokeInst>(&I) || isa<TerminatorInst>(&I))
+				continue;
+			if (slice.values.find(&I) == slice.values.end()) {
+				I.setMetadata(noSliceMDName, MDNode::get(C, None));
+				skippedInsts++;
+			}
+		}
+	}
+	for (auto F : outOfSlice) {
+		if (verboseFlag)
+			errs() << "Output slice: not cloning function '" << F->getName() << "'\n";
+		fnsToClone.erase(F);
+	}
+
+	// Only clone globals that can affect an output, unless asked to
+	for (auto & g : M.globals()) {
+		if (globalsToClone.find(&g) != globalsToClone.end())
+			continue;
+		if (slice.objects.find(&g) == slice.objects.end()) {
+			globalsToSkip.insert(&g);
+		}
+	}
+
+	if (verboseFlag) {
+		errs() << info_string << " output slice leaves out " << outOfSlice.size()
+			   << " functions and " << skippedInsts << " instructions\n";
+	}
+}
+
+
+/*
+ * Instructions outside of the slice are not cloned.
+ * Called after the function bodies have been copied, which keeps the metadata.
+ */
+void dataflowProtection::skipOutsideSlice(Module& M) {
+	for (auto & F : M) {
+		for (auto & I : instructions(F)) {
+			if (!I.getMetadata(noSliceMDName))
+				continue;
+			if (fnsToClone.find(&F) != fnsToClone.end())
+				instsToSkip.insert(&I);
+			I.setMetadata(noSliceMDName, nullptr);
+		}
+	}
+}
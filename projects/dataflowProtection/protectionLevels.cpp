@@ -0,0 +1,318 @@
+/*
+ * protectionLevels.cpp
+ *
+ * This file contains the logic for protecting parts of a module at a different
+ *  level (DWC or TMR) than the rest of it.
+ * The functions and globals at the other level are protected first by a separate
+ *  instance of the pass, then the rest of the module is protected as normal.
+ * Calls across the boundary are synchronized like calls to external functions.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <list>
+#include <string>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> verboseFlag;
+extern cl::opt<bool> dwcSignatureFlag;
+extern cl::opt<bool> correctionLogFlag;
+extern cl::opt<bool> OriginalReportErrorsFlag;
+
+// shared variables
+extern std::list<std::string> dwcFnList;
+extern std::list<std::string> tmrFnList;
+extern std::list<std::string> dwcGlblList;
+extern std::list<std::string> tmrGlblList;
+extern std::set<StoreInst*> syncGlobalStores;
+extern std::map<GlobalVariable*, std::set<Function*> > globalCrossMap;
+extern std::set<ConstantExpr*> annotationExpressions;
+
+
+/*
+ * Walk back through casts and GEPs to find the global variable a pointer is based on.
+ * Returns nullptr if it isn't a global.
+ */
+static GlobalVariable* getBaseGlobal(Value* ptr) {
+	Value* base = ptr->stripPointerCasts();
+	while (GEPOperator* gep = dyn_cast<GEPOperator>(base)) {
+		base = gep->getPointerOperand()->stripPointerCasts();
+	}
+	return dyn_cast<GlobalVariable>(base);
+}
+
+
+/*
+ * Converts the names from the configuration file and command line into the level maps.
+ * These override any in-code directives.
+ */
+void dataflowProtection::addLevelsByName(Module& M, std::list<std::string> &fnNames,
+		std::list<std::string> &glblNames, int level) {
+	for (auto name : fnNames) {
+		Function* F = M.getFunction(name);
+		if (F && !F->isDeclaration()) {
+			fnLevelMap[F] = level;
+		} else {
+			errs() << warn_string << " function '" << name << "' given a protection level does not exist\n";
+		}
+	}
+	for (auto name : glblNames) {
+		GlobalVariable* gv = M.getGlobalVariable(name, true);
+		if (gv) {
+			globalLevelMap[gv] = level;
+		} else {
+			errs() << warn_string << " global '" << name << "' given a protection level does not exist\n";
+		}
+	}
+}
+
+
+/*
+ * If there are any functions or globals marked with a protection level other
+ *  than the one this pass is running, hand them off to another instance of the
+ *  pass running at that level.
+ * When this instance is that other pass (isLevelSubset), narrow the scope to
+ *  only those functions and globals instead.
+ */
+void dataflowProtection::processProtectionLevels(Module& M, int numClones) {
+	if (isLevelSubset) {
+		restrictToLevelScope(M);
+		return;
+	}
+
+	addLevelsByName(M, dwcFnList, dwcGlblList, 2);
+	addLevelsByName(M, tmrFnList, tmrGlblList, 3);
+
+	int otherLevel = (numClones == 3) ? 2 : 3;
+	std::map<Function*, int> otherFns;
+	std::map<GlobalVariable*, int> otherGlobals;
+
+	for (auto entry : fnLevelMap) {
+		Function* F = entry.first;
+		if (entry.second == numClones)
+			continue;
+		if (isISR(*F) || isCoarseGrainedFunction(F->getName()) || (fnsToSkip.find(F) != fnsToSkip.end())) {
+			errs() << warn_string << " function '" << F->getName()
+				   << "' is not protected, ignoring its protection level\n";
+			continue;
+		}
+		otherFns[F] = otherLevel;
+	}
+	for (auto entry : globalLevelMap) {
+		if ( (entry.second != numClones) && (globalsToSkip.find(entry.first) == globalsToSkip.end()) ) {
+			otherGlobals[entry.first] = otherLevel;
+		}
+	}
+
+	// these only apply to one level, which could be the one the other pass protects
+	if (otherFns.empty()) {
+		if (dwcSignatureFlag && (numClones == 3))
+			errs() << warn_string << " -dwcSignature only applies to DWC, ignoring it\n";
+		if (correctionLogFlag && (numClones == 2) && !OriginalReportErrorsFlag)
+			errs() << warn_string << " -correctionLog only applies to TMR, ignoring it\n";
+	}
+
+	if (otherFns.size() == 0 && otherGlobals.size() == 0)
+		return;
+
+	/*
+	 * Functions at the other level that are used from this level keep their signatures,
+	 *  so they are treated as protected library functions.
+	 * Functions at this level called from the other level are treated the same way.
+	 */
+	std::set<Function*> otherBoundary;
+	std::set<Function*> thisBoundary;
+	for (auto entry : otherFns) {
+		Function* F = entry.first;
+		for (auto U : F->users()) {
+			// left over from llvm.global.annotations
+			if (ConstantExpr* ce = dyn_cast<ConstantExpr>(U)) {
+				if (annotationExpressions.find(ce) != annotationExpressions.end())
+					continue;
+			}
+			CallInst* CI = dyn_cast<CallInst>(U);
+			if ( !CI || (CI->getCalledFunction() != F) ||
+					(otherFns.find(CI->getFunction()) == otherFns.end()) ) {
+				otherBoundary.insert(F);
+			}
+		}
+
+		for (auto & bb : *F) {
+			for (auto & I : bb) {
+				if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+					Function* calledF = CI->getCalledFunction();
+					if ( calledF && !calledF->isDeclaration() &&
+						 (otherFns.find(calledF) == otherFns.end()) &&
+						 (fnsToSkip.find(calledF) == fnsToSkip.end()) &&
+						 !isCoarseGrainedFunction(calledF->getName()) )
+					{
+						thisBoundary.insert(calledF);
+					}
+				}
+			}
+		}
+	}
+
+	if (verboseFlag) {
+		errs() << info_string << " protecting with " << ((otherLevel == 3) ? "TMR" : "DWC") << ":\n";
+		for (auto entry : otherFns)
+			errs() << "    " << entry.first->getName() << "\n";
+		for (auto entry : otherGlobals)
+			errs() << "    " << entry.first->getName() << "\n";
+	}
+
+	// Set up the other pass with what we know from the annotations
+	dataflowProtection levelPass;
+	levelPass.isLevelSubset = true;
+	levelPass.xMR_default = false;
+	levelPass.fnLevelMap = otherFns;
+	levelPass.globalLevelMap = otherGlobals;
+	levelPass.crossLevelFns = thisBoundary;
+	levelPass.protectedLibList = otherBoundary;
+	levelPass.isrFunctions = isrFunctions;
+	levelPass.usedFunctions = usedFunctions;
+	levelPass.volatileGlobals = volatileGlobals;
+	levelPass.cloneAfterFnCall = cloneAfterFnCall;
+	levelPass.fnsToSkip = fnsToSkip;
+	levelPass.abftFns = abftFns;
+	for (auto entry : otherFns) {
+		Function* F = entry.first;
+		if (protectedLibList.find(F) != protectedLibList.end())
+			levelPass.protectedLibList.insert(F);
+		if (replReturn.find(F) != replReturn.end())
+			levelPass.replReturn.insert(F);
+		// the other pass may replace these, so don't keep any references to them
+		fnsToClone.erase(F);
+		protectedLibList.erase(F);
+		replReturn.erase(F);
+	}
+	for (auto g : globalsToSkip) {
+		if (otherGlobals.find(g) == otherGlobals.end())
+			levelPass.globalsToSkip.insert(g);
+	}
+
+	levelPass.run(M, otherLevel);
+
+	// Now leave everything the other pass touched alone
+	crossLevelFns = levelPass.fnsToClone;
+	for (auto F : levelPass.fnsToClone) {
+		fnsToSkip.insert(F);
+	}
+	for (auto g : levelPass.globalsToSkip) {
+		globalsToSkip.insert(g);
+	}
+	for (auto g : levelPass.globalsToClone) {
+		globalsToSkip.insert(g);
+		globalsToClone.erase(g);
+	}
+	for (auto entry : levelPass.cloneMap) {
+		if (GlobalVariable* g = dyn_cast<GlobalVariable>(entry.first)) {
+			globalsToSkip.insert(g);
+			if (GlobalVariable* g1 = dyn_cast<GlobalVariable>(entry.second.first))
+				globalsToSkip.insert(g1);
+			if (GlobalVariable* g2 = dyn_cast<GlobalVariable>(entry.second.second))
+				globalsToSkip.insert(g2);
+		}
+	}
+	checksumGlobals.insert(levelPass.checksumGlobals.begin(), levelPass.checksumGlobals.end());
+	for (auto F : thisBoundary) {
+		protectedLibList.insert(F);
+		fnsToClone.insert(F);
+	}
+	// these were only for the other pass
+	syncGlobalStores.clear();
+
+	allowCrossLevelReads(crossLevelFns);
+}
+
+
+/*
+ * Only protect the functions and globals handed to this instance of the pass.
+ * Everything else is left for the pass that created this one.
+ */
+void dataflowProtection::restrictToLevelScope(Module& M) {
+	fnsToClone.clear();
+	globalsToClone.clear();
+
+	std::set<Function*> otherLevelFns;
+	for (auto & F : M) {
+		if (F.isDeclaration())
+			continue;
+		if (fnLevelMap.find(&F) != fnLevelMap.end()) {
+			fnsToClone.insert(&F);
+		} else {
+			fnsToSkip.insert(&F);
+			otherLevelFns.insert(&F);
+		}
+	}
+	for (auto entry : globalLevelMap) {
+		globalsToClone.insert(entry.first);
+	}
+
+	// the command line may have added functions outside of our scope
+	for (auto F : otherLevelFns) {
+		protectedLibList.erase(F);
+		replReturn.erase(F);
+	}
+
+	allowCrossLevelReads(otherLevelFns);
+}
+
+
+/*
+ * Globals protected at one level may be read by functions at the other level.
+ * Those functions will only see the original copy, which is safe as long as they
+ *  don't write to it, so tell verifyOptions() to allow these reads.
+ * Writes across levels are still reported as errors.
+ */
+void dataflowProtection::allowCrossLevelReads(std::set<Function*> &otherLevelFns) {
+	for (auto F : otherLevelFns) {
+		std::set<GlobalVariable*> readGlobals;
+		std::set<GlobalVariable*> writtenGlobals;
+
+		for (auto & bb : *F) {
+			for (auto & I : bb) {
+				if (LoadInst* LI = dyn_cast<LoadInst>(&I)) {
+					if (GlobalVariable* gv = getBaseGlobal(LI->getPointerOperand()))
+						readGlobals.insert(gv);
+				} else if (StoreInst* SI = dyn_cast<StoreInst>(&I)) {
+					if (GlobalVariable* gv = getBaseGlobal(SI->getPointerOperand()))
+						writtenGlobals.insert(gv);
+					// storing the address means it could be written later
+					if (SI->getValueOperand()->getType()->isPointerTy()) {
+						if (GlobalVariable* gv = getBaseGlobal(SI->getValueOperand()))
+							writtenGlobals.insert(gv);
+					}
+				} else if (CallInst* CI = dyn_cast<CallInst>(&I)) {
+					if (isa<DbgInfoIntrinsic>(CI))
+						continue;
+					// can't tell what the callee does with it
+					for (unsigned i = 0; i < CI->getNumArgOperands(); i++) {
+						Value* arg = CI->getArgOperand(i);
+						if (!arg->getType()->isPointerTy())
+							continue;
+						if (GlobalVariable* gv = getBaseGlobal(arg))
+							writtenGlobals.insert(gv);
+					}
+				}
+			}
+		}
+
+		for (auto gv : readGlobals) {
+			if (writtenGlobals.find(gv) == writtenGlobals.end()) {
+				globalCrossMap[gv].insert(F);
+			}
+		}
+	}
+}
@@ -0,0 +1,195 @@
+/*
+ * regions.cpp
+ *
+ * This file contains the logic for replicating only a region of code inside
+ *  of a function, marked with COAST_xMR_BEGIN() and COAST_xMR_END().
+ * The rest of the function is left alone, the same as if it were marked __NO_xMR.
+ * Values used inside the region come from the single copy outside of it, and
+ *  values that leave the region (including those used by stores, calls, and
+ *  branches in the region, which are not replicated) are voted on.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <deque>
+#include <string>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::string tmr_vote_inst_name;
+std::string region_cmp_name = "rcmp";
+
+// helpers from synchronization.cpp
+Instruction::OtherOps getComparisonType(Type* opType);
+CmpInst::Predicate getComparisonPredicate(Type* opType);
+
+
+/*
+ * Returns the name of the function called, or an empty string if it isn't a direct call
+ */
+static StringRef getCalledName(Instruction* I) {
+	if (CallInst* CI = dyn_cast<CallInst>(I)) {
+		if (Function* calledF = CI->getCalledFunction())
+			return calledF->getName();
+	}
+	return StringRef();
+}
+
+
+/*
+ * Find all of the instructions between each COAST_xMR_BEGIN() and the
+ *  COAST_xMR_END() calls that close it, and mark them to be cloned.
+ * Must be called after populateFnWorklist() and before cloneFunctionArguments(),
+ *  because functions with regions are taken out of the list of functions to clone.
+ */
+void dataflowProtection::processRegionMarkers(Module& M) {
+	Function* beginFn = M.getFunction(region_begin_name);
+	Function* endFn = M.getFunction(region_end_name);
+	if (!beginFn && !endFn)
+		return;
+
+	std::vector<CallInst*> markers;
+	std::set<Function*> regionFns;
+
+	if (beginFn) {
+		for (auto U : beginFn->users()) {
+			CallInst* beginCall = dyn_cast<CallInst>(U);
+			if (!beginCall)
+				continue;
+			markers.push_back(beginCall);
+			Function* F = beginCall->getFunction();
+			regionFns.insert(F);
+
+			// walk forward through the CFG until every path reaches an end marker
+			std::set<BasicBlock*> visitedBlocks;
+			std::deque<Instruction*> worklist;
+			worklist.push_back(beginCall->getNextNode());
+
+			while (!worklist.empty()) {
+				Instruction* start = worklist.front();
+				worklist.pop_front();
+
+				for (Instruction* I = start; I != nullptr; I = I->getNextNode()) {
+					StringRef calledName = getCalledName(I);
+					if (calledName == region_end_name) {
+						break;
+					} else if (calledName == region_begin_name) {
+						errs() << err_string << " xMR regions cannot be nested or left open in a loop, in function '"
+							   << F->getName() << "'\n";
+						std::exit(-1);
+					}
+
+					if (TerminatorInst* TI = dyn_cast<TerminatorInst>(I)) {
+						if (isa<ReturnInst>(TI) || isa<ResumeInst>(TI)) {
+							errs() << err_string << " xMR region is not closed on every path in function '"
+								   << F->getName() << "'\n";
+							std::exit(-1);
+						}
+						for (unsigned i = 0; i < TI->getNumSuccessors(); i++) {
+							BasicBlock* succ = TI->getSuccessor(i);
+							if (visitedBlocks.find(succ) == visitedBlocks.end()) {
+								visitedBlocks.insert(succ);
+								worklist.push_back(&succ->front());
+							}
+						}
+						break;
+					}
+
+					// Stores, calls, and allocas are done once, the values they use are voted on
+					if (isa<CallInst>(I) || isa<InvokeInst>(I) || isa<StoreInst>(I) ||
+							isa<AllocaInst>(I) || I->isEHPad() || willBeSkipped(I)) {
+						continue;
+					}
+					regionInsts.insert(I);
+				}
+			}
+		}
+	}
+
+	if (endFn) {
+		for (auto U : endFn->users()) {
+			if (CallInst* endCall = dyn_cast<CallInst>(U))
+				markers.push_back(endCall);
+		}
+	}
+
+	// The rest of the function is not protected
+	for (auto F : regionFns) {
+		if (verboseFlag)
+			errs() << "Directive: only clone the marked regions in function '" << F->getName() << "'\n";
+		fnsToClone.erase(F);
+	}
+	instsToCloneAnno.insert(regionInsts.begin(), regionInsts.end());
+
+	// The markers aren't real functions, so remove them
+	for (auto CI : markers) {
+		CI->eraseFromParent();
+	}
+	if (beginFn && beginFn->use_empty())
+		beginFn->eraseFromParent();
+	if (endFn && endFn->use_empty())
+		endFn->eraseFromParent();
+}
+
+
+/*
+ * Vote on every value from a region that is used by something which was not cloned.
+ * The vote goes right after the last copy of the value, so it dominates all of the uses.
+ */
+void dataflowProtection::syncRegionExits(GlobalVariable* TMRErrorDetected) {
+	for (auto I : regionInsts) {
+		if (!isCloned(I) || I->getType()->isVoidTy())
+			continue;
+
+		ValuePair clones = getClone(I);
+		std::vector<Use*> exitUses;
+		for (auto & U : I->uses()) {
+			Instruction* user = dyn_cast<Instruction>(U.getUser());
+			if (!user || isCloned(user))
+				continue;
+			exitUses.push_back(&U);
+		}
+		if (exitUses.size() == 0)
+			continue;
+
+		Type* opType = I->getType();
+		if (opType->isAggregateType()) {
+			errs() << warn_string << " can't vote on aggregate value leaving xMR region:\n";
+			PRINT_VALUE(I);
+			continue;
+		}
+
+		// insert after the last copy, but not between PHI nodes
+		Instruction* lastCopy = dyn_cast<Instruction>(TMR ? clones.second : clones.first);
+		Instruction* insertPt = lastCopy->getNextNode();
+		if (isa<PHINode>(lastCopy))
+			insertPt = &*lastCopy->getParent()->getFirstInsertionPt();
+
+		Instruction::OtherOps cmp_op = getComparisonType(opType);
+		CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
+		Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, I, clones.first, region_cmp_name, insertPt);
+
+		if (TMR) {
+			SelectInst* sel = SelectInst::Create(cmp, I, clones.second, tmr_vote_inst_name, insertPt);
+			for (auto U : exitUses) {
+				U->set(sel);
+			}
+			insertTMRCorrectionCount(cmp, TMRErrorDetected);
+		} else {
+			Function* currFn = I->getParent()->getParent();
+			splitBlocks(cmp, errBlockMap[currFn]);
+		}
+	}
+}
@@ -0,0 +1,1045 @@
+/*
+ * replicaLayout.cpp
+ *
+ * This file contains the logic for controlling where the copies of globals
+ *  and locals are placed in memory.
+ * With -interleaveMem, the copies are placed next to each other instead of as
+ *  separate objects.  Arrays that are only indexed directly are interleaved by
+ *  element, so a[i], a_DWC[i], and a_TMR[i] share a cache line.  Small objects
+ *  are put together in a tuple.
+ * With -replicaOffset, the copies are placed in their own sections, which the
+ *  generated linker script puts at a fixed distance from the originals.  Then
+ *  a pointer into replicated memory doesn't need to be passed around in triplicate,
+ *  because the copies can be found by adding the offset.
+ * With -replicaBanks, the original and copies of large globals are put in
+ *  separate sections, so they can be placed in different memories.
+ * With -replicaMalloc, the copies of a wrapped malloc() call are replaced by one
+ *  call to the heap in tests/COAST_malloc.h, which has space for every copy.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <llvm/ADT/StringExtras.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> interleaveMemFlag;
+extern cl::opt<bool> noMemReplicationFlag;
+extern cl::opt<bool> noMainFlag;
+extern cl::opt<unsigned> replicaOffset;
+extern cl::opt<unsigned> replicaStackSize;
+extern cl::opt<std::string> replicaLinkerScript;
+extern cl::opt<std::string> replicaLoadRegion;
+extern cl::opt<bool> replicaMallocFlag;
+extern cl::opt<std::string> replicaBanks;
+extern cl::opt<unsigned> replicaBankMinSize;
+extern cl::opt<std::string> replicaBankScript;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::list<std::string> ignoreGlbl;
+extern std::string noSliceMDName;
+
+// sections for -replicaOffset, the copies have the suffix _DWC or _TMR
+static const std::string xmr_section_name = ".xmr";
+
+// allocation functions that -replicaMalloc knows how to merge
+static const std::set<std::string> replicaMallocNames = {"malloc", "pvPortMalloc"};
+static const std::set<std::string> replicaFreeNames = {"free", "vPortFree"};
+
+// objects bigger than this are only moved if their elements can be interleaved
+#define TUPLE_MAX_BYTES 64
+
+
+/*
+ * An address is only an element access if it indexes into the array with a
+ *  leading zero, and the element address is only used to load or store.
+ * Any other use could do pointer math that assumes the elements are contiguous.
+ */
+static bool isElementAccess(User* U) {
+	GEPOperator* gep = dyn_cast<GEPOperator>(U);
+	if (!gep || gep->getNumIndices() < 2)
+		return false;
+	ConstantInt* first = dyn_cast<ConstantInt>(gep->getOperand(1));
+	if (!first || !first->isZero())
+		return false;
+
+	for (auto elemUser : gep->users()) {
+		if (LoadInst* LI = dyn_cast<LoadInst>(elemUser)) {
+			if (LI->getPointerOperand() != gep)
+				return false;
+		} else if (StoreInst* SI = dyn_cast<StoreInst>(elemUser)) {
+			if (SI->getPointerOperand() != gep || SI->getValueOperand() == gep)
+				return false;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Lifetime markers on a local go through a bitcast.  They can be dropped,
+ *  because they only tell the optimizer when the memory can be reused.
+ */
+static bool isLifetimeCast(User* U) {
+	BitCastInst* BC = dyn_cast<BitCastInst>(U);
+	if (!BC)
+		return false;
+	for (auto castUser : BC->users()) {
+		IntrinsicInst* II = dyn_cast<IntrinsicInst>(castUser);
+		if (!II || ( (II->getIntrinsicID() != Intrinsic::lifetime_start) &&
+				(II->getIntrinsicID() != Intrinsic::lifetime_end) ))
+			return false;
+	}
+	return true;
+}
+
+
+static bool canInterleaveElements(std::vector<Value*> &copies, Type* objTy) {
+	if (!isa<ArrayType>(objTy))
+		return false;
+	for (auto copy : copies) {
+		for (auto U : copy->users()) {
+			if (isElementAccess(U))
+				continue;
+			if (isa<AllocaInst>(copy) && isLifetimeCast(U))
+				continue;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Move the uses of one copy over to its slot in the new object.
+ * Element accesses get an extra index for the copy, right after the array index.
+ * Everything that was removed is added to `removed`, so it can be taken out of the clone map.
+ */
+static void rewriteElementUses(Value* copy, Value* newObj, Type* newTy,
+		unsigned copyNum, std::set<Value*> &removed) {
+	std::vector<User*> users(copy->user_begin(), copy->user_end());
+
+	for (auto U : users) {
+		if (GetElementPtrInst* GI = dyn_cast<GetElementPtrInst>(U)) {
+			std::vector<Value*> indices(GI->idx_begin(), GI->idx_end());
+			Type* idxTy = indices[1]->getType();
+			indices.insert(indices.begin() + 2, ConstantInt::get(idxTy, copyNum));
+
+			GetElementPtrInst* newGEP = GetElementPtrInst::Create(newTy, newObj, indices, "", GI);
+			newGEP->setIsInBounds(GI->isInBounds());
+			newGEP->takeName(GI);
+			newGEP->setDebugLoc(GI->getDebugLoc());
+			GI->replaceAllUsesWith(newGEP);
+			removed.insert(GI);
+			GI->eraseFromParent();
+		} else if (ConstantExpr* CE = dyn_cast<ConstantExpr>(U)) {
+			GEPOperator* gep = cast<GEPOperator>(CE);
+			std::vector<Constant*> indices;
+			for (auto idx = gep->idx_begin(); idx != gep->idx_end(); idx++) {
+				indices.push_back(cast<Constant>(*idx));
+			}
+			Type* idxTy = indices[1]->getType();
+			indices.insert(indices.begin() + 2, ConstantInt::get(idxTy, copyNum));
+
+			Constant* newCE = ConstantExpr::getGetElementPtr(newTy, cast<Constant>(newObj),
+					indices, gep->isInBounds());
+			CE->replaceAllUsesWith(newCE);
+			removed.insert(CE);
+			CE->destroyConstant();
+		} else if (BitCastInst* BC = dyn_cast<BitCastInst>(U)) {
+			std::vector<User*> markers(BC->user_begin(), BC->user_end());
+			for (auto marker : markers) {
+				cast<Instruction>(marker)->eraseFromParent();
+			}
+			BC->eraseFromParent();
+		}
+	}
+}
+
+
+/*
+ * Make an initializer for the tuple, or for the array of tuples when interleaving.
+ */
+static Constant* getLayoutInitializer(std::vector<GlobalVariable*> &copies,
+		ArrayType* newTy, bool byElement) {
+	bool allZero = true;
+	for (auto g : copies) {
+		if (!g->getInitializer()->isNullValue())
+			allZero = false;
+	}
+	if (allZero)
+		return ConstantAggregateZero::get(newTy);
+
+	if (!byElement) {
+		std::vector<Constant*> inits;
+		for (auto g : copies) {
+			inits.push_back(g->getInitializer());
+		}
+		return ConstantArray::get(newTy, inits);
+	}
+
+	ArrayType* tupleTy = cast<ArrayType>(newTy->getElementType());
+	std::vector<Constant*> elements;
+	for (uint64_t i = 0; i < newTy->getNumElements(); i++) {
+		std::vector<Constant*> tuple;
+		for (auto g : copies) {
+			tuple.push_back(g->getInitializer()->getAggregateElement(i));
+		}
+		elements.push_back(ConstantArray::get(tupleTy, tuple));
+	}
+	return ConstantArray::get(newTy, elements);
+}
+
+
+/*
+ * Put the copies of each replicated global and local together.
+ * Must be called after all of the cloning, synchronization, and moving of clones
+ *  is done, because the copies are replaced by addresses inside of a single new object.
+ */
+void dataflowProtection::interleaveReplicas(Module& M) {
+	if (!interleaveMemFlag || noMemReplicationFlag)
+		return;
+
+	const DataLayout& DL = M.getDataLayout();
+	std::set<Value*> removed;
+	unsigned numInterleaved = 0, numTuples = 0;
+
+	// globals, some of the copies may have been removed already if they weren't used
+	std::vector<GlobalVariable*> origGlobals;
+	std::set<Value*> liveGlobals;
+	for (GlobalVariable & g : M.globals()) {
+		liveGlobals.insert(&g);
+		if (cloneMap.find(&g) != cloneMap.end())
+			origGlobals.push_back(&g);
+	}
+
+	for (auto g : origGlobals) {
+		ValuePair clones = cloneMap[g];
+		if ( (liveGlobals.find(clones.first) == liveGlobals.end()) ||
+				(TMR && liveGlobals.find(clones.second) == liveGlobals.end()) )
+			continue;
+
+		std::vector<GlobalVariable*> copies;
+		copies.push_back(g);
+		copies.push_back(cast<GlobalVariable>(clones.first));
+		if (TMR)
+			copies.push_back(cast<GlobalVariable>(clones.second));
+
+		bool canMove = true;
+		for (auto copy : copies) {
+			if (!copy->hasDefinitiveInitializer() || copy->hasSection() ||
+					copy->isThreadLocal() || (noMainFlag && !copy->hasLocalLinkage()))
+				canMove = false;
+		}
+		if (!canMove || volatileGlobals.find(g) != volatileGlobals.end() ||
+				globalsToRuntimeInit.find(g) != globalsToRuntimeInit.end())
+			continue;
+
+		std::vector<Value*> copyVals(copies.begin(), copies.end());
+		Type* objTy = g->getValueType();
+		bool byElement = canInterleaveElements(copyVals, objTy);
+		if (!byElement && DL.getTypeAllocSize(objTy) > TUPLE_MAX_BYTES)
+			continue;
+
+		ArrayType* newTy;
+		if (byElement) {
+			ArrayType* arrTy = cast<ArrayType>(objTy);
+			ArrayType* tupleTy = ArrayType::get(arrTy->getElementType(), copies.size());
+			newTy = ArrayType::get(tupleTy, arrTy->getNumElements());
+		} else {
+			newTy = ArrayType::get(objTy, copies.size());
+		}
+
+		GlobalVariable* newGlobal = new GlobalVariable(M, newTy, g->isConstant(), g->getLinkage(),
+				getLayoutInitializer(copies, newTy, byElement), g->getName().str() + "_xMR", g);
+		newGlobal->setAlignment(g->getAlignment());
+		newGlobal->setUnnamedAddr(g->getUnnamedAddr());
+
+		for (unsigned i = 0; i < copies.size(); i++) {
+			if (byElement) {
+				rewriteElementUses(copies[i], newGlobal, newTy, i, removed);
+			} else {
+				Constant* idx[] = {
+					ConstantInt::get(Type::getInt32Ty(M.getContext()), 0),
+					ConstantInt::get(Type::getInt32Ty(M.getContext()), i)
+				};
+				copies[i]->replaceAllUsesWith(ConstantExpr::getInBoundsGetElementPtr(newTy, newGlobal, idx));
+			}
+		}
+
+		if (verboseFlag)
+			errs() << "Placing the copies of global " << g->getName() << " together in "
+				   << newGlobal->getName() << (byElement ? " (interleaved)\n" : "\n");
+
+		for (auto copy : copies) {
+			removed.insert(copy);
+			copy->eraseFromParent();
+		}
+		if (byElement)
+			numInterleaved++;
+		else
+			numTuples++;
+	}
+
+	// locals, which are all in the entry block if they have a fixed size
+	for (auto & F : M) {
+		if (F.isDeclaration())
+			continue;
+
+		std::vector<AllocaInst*> origAllocas;
+		std::set<Value*> liveAllocas;
+		for (auto & I : F.getEntryBlock()) {
+			if (AllocaInst* AI = dyn_cast<AllocaInst>(&I)) {
+				liveAllocas.insert(AI);
+				if (cloneMap.find(AI) != cloneMap.end() && AI->isStaticAlloca())
+					origAllocas.push_back(AI);
+			}
+		}
+
+		for (auto AI : origAllocas) {
+			ValuePair clones = cloneMap[AI];
+			if ( (liveAllocas.find(clones.first) == liveAllocas.end()) ||
+					(TMR && liveAllocas.find(clones.second) == liveAllocas.end()) )
+				continue;
+
+			std::vector<AllocaInst*> copies;
+			copies.push_back(AI);
+			copies.push_back(cast<AllocaInst>(clones.first));
+			if (TMR)
+				copies.push_back(cast<AllocaInst>(clones.second));
+
+			bool canMove = true;
+			for (auto copy : copies) {
+				if (!copy->isStaticAlloca() || copy->isArrayAllocation())
+					canMove = false;
+			}
+			if (!canMove)
+				continue;
+
+			std::vector<Value*> copyVals(copies.begin(), copies.end());
+			Type* objTy = AI->getAllocatedType();
+			bool byElement = canInterleaveElements(copyVals, objTy);
+			if (!byElement && DL.getTypeAllocSize(objTy) > TUPLE_MAX_BYTES)
+				continue;
+
+			ArrayType* newTy;
+			if (byElement) {
+				ArrayType* arrTy = cast<ArrayType>(objTy);
+				ArrayType* tupleTy = ArrayType::get(arrTy->getElementType(), copies.size());
+				newTy = ArrayType::get(tupleTy, arrTy->getNumElements());
+			} else {
+				newTy = ArrayType::get(objTy, copies.size());
+			}
+
+			// at the top of the block, so it comes before any use of the copies
+			AllocaInst* newAlloca = new AllocaInst(newTy, AI->getType()->getAddressSpace(),
+					AI->getName() + "_xMR", &*F.getEntryBlock().getFirstInsertionPt());
+			newAlloca->setAlignment(AI->getAlignment());
+
+			for (unsigned i = 0; i < copies.size(); i++) {
+				if (byElement) {
+					rewriteElementUses(copies[i], newAlloca, newTy, i, removed);
+				} else {
+					Value* idx[] = {
+						ConstantInt::get(Type::getInt32Ty(M.getContext()), 0),
+						ConstantInt::get(Type::getInt32Ty(M.getContext()), i)
+					};
+					GetElementPtrInst* slot = GetElementPtrInst::CreateInBounds(newTy, newAlloca, idx,
+							copies[i]->getName(), newAlloca->getNextNode());
+					copies[i]->replaceAllUsesWith(slot);
+				}
+			}
+
+			if (verboseFlag)
+				errs() << "Placing the copies of local " << AI->getName() << " in function '"
+					   << F.getName() << "' together" << (byElement ? " (interleaved)\n" : "\n");
+
+			for (auto copy : copies) {
+				removed.insert(copy);
+				copy->eraseFromParent();
+			}
+			if (byElement)
+				numInterleaved++;
+			else
+				numTuples++;
+		}
+	}
+
+	removeFromCloneMap(removed);
+
+	if (verboseFlag)
+		errs() << info_string << " interleaved " << numInterleaved << " arrays and grouped "
+			   << numTuples << " other objects with their copies\n";
+}
+
+
+//----------------------------------------------------------------------------//
+// Fixed offset replicas
+//----------------------------------------------------------------------------//
+/*
+ * Globals that will be placed in the replica sections.
+ * Constants are left out, because they can't share a section with variables.
+ */
+bool dataflowProtection::isOffsetGlobal(GlobalVariable* g) {
+	if (!replicaOffset || (globalsToClone.find(g) == globalsToClone.end()))
+		return false;
+	if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g->getName().str()) != ignoreGlbl.end())
+		return false;
+	return !g->isConstant() && g->hasDefinitiveInitializer() &&
+			!g->hasSection() && !g->isThreadLocal();
+}
+
+
+/*
+ * Local annotations are processed after the function arguments are cloned,
+ *  so they could still stop the local from being cloned.
+ */
+static bool hasLocalAnnotation(AllocaInst* AI) {
+	for (auto U : AI->users()) {
+		Value* annoUser = U;
+		if (BitCastInst* BC = dyn_cast<BitCastInst>(U)) {
+			if (!BC->hasOneUse())
+				continue;
+			annoUser = BC->user_back();
+		}
+		if (CallInst* CI = dyn_cast<CallInst>(annoUser)) {
+			Function* calledF = CI->getCalledFunction();
+			if (calledF && calledF->getName() == "llvm.var.annotation")
+				return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+ * Add F and every function it calls directly to `reached`.
+ */
+static void addDirectCallees(Function* F, std::set<Function*> &reached) {
+	std::vector<Function*> worklist = {F};
+	while (!worklist.empty()) {
+		Function* next = worklist.back();
+		worklist.pop_back();
+		if (!reached.insert(next).second)
+			continue;
+		for (auto & I : instructions(next)) {
+			Function* callee = nullptr;
+			if (CallInst* CI = dyn_cast<CallInst>(&I))
+				callee = CI->getCalledFunction();
+			else if (InvokeInst* II = dyn_cast<InvokeInst>(&I))
+				callee = II->getCalledFunction();
+			if (callee && !callee->isDeclaration())
+				worklist.push_back(callee);
+		}
+	}
+}
+
+
+/*
+ * The stack reserved by -replicaStackSize is the one main() starts on.  Find the
+ *  functions that are only ever called from main(), since anything that can be
+ *  run from an ISR, or through a pointer, like a task or a thread, could be on
+ *  another stack, which has nothing reserved at the offset from it.
+ */
+void dataflowProtection::findMainStackFns(Module& M) {
+	mainStackFns.clear();
+	Function* mainFn = M.getFunction("main");
+	if (noMainFlag || !mainFn || mainFn->isDeclaration())
+		return;
+
+	std::set<Function*> fromOthers;
+	addDirectCallees(mainFn, mainStackFns);
+	for (auto & F : M) {
+		if (F.isDeclaration() || (&F == mainFn))
+			continue;
+		if (isISR(F) || !onlyDirectCalls(&F))
+			addDirectCallees(&F, fromOthers);
+	}
+	for (auto F : fromOthers) {
+		mainStackFns.erase(F);
+	}
+}
+
+
+/*
+ * A pointer can be used to find its copies by adding the offset if everything
+ *  it could point to is in the replica layout.
+ */
+bool dataflowProtection::isOffsetAddress(Value* ptr) {
+	Module* M = nullptr;
+	if (Instruction* I = dyn_cast<Instruction>(ptr))
+		M = I->getModule();
+	else if (Argument* A = dyn_cast<Argument>(ptr))
+		M = A->getParent()->getParent();
+	else if (GlobalValue* GV = dyn_cast<GlobalValue>(ptr->stripPointerCasts()))
+		M = GV->getParent();
+	if (!M)
+		return false;
+
+	SmallVector<Value*, 4> objects;
+	GetUnderlyingObjects(ptr, objects, M->getDataLayout());
+
+	for (auto obj : objects) {
+		if (GlobalVariable* g = dyn_cast<GlobalVariable>(obj)) {
+			if (!isOffsetGlobal(g))
+				return false;
+		} else if (AllocaInst* AI = dyn_cast<AllocaInst>(obj)) {
+			// the copies of locals are only at the offset if the stack is too
+			if (!replicaStackSize || !AI->isStaticAlloca() || !willBeCloned(AI) ||
+					(mainStackFns.find(AI->getFunction()) == mainStackFns.end()) ||
+					AI->getMetadata(noSliceMDName) || hasLocalAnnotation(AI))
+				return false;
+		} else if (CallInst* CI = dyn_cast<CallInst>(obj)) {
+			// the heap is at the same offset if it's set up to match
+			Function* calledF = CI->getCalledFunction();
+			if (!replicaMallocFlag || noMemReplicationFlag || !calledF ||
+					(fnsToClone.find(CI->getFunction()) == fnsToClone.end()))
+				return false;
+			std::string wrapperFnEnding = "_COAST_WRAPPER";
+			StringRef fnName = calledF->getName();
+			if (!fnName.endswith(wrapperFnEnding) ||
+					!replicaMallocNames.count(fnName.drop_back(wrapperFnEnding.size()).str()))
+				return false;
+		} else if (Argument* A = dyn_cast<Argument>(obj)) {
+			auto found = offsetArgs.find(A->getParent());
+			if ( (found == offsetArgs.end()) ||
+					(found->second.find(A->getArgNo()) == found->second.end()) )
+				return false;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Find the pointer arguments that don't need to be cloned, because every call
+ *  passes a pointer into the replica layout.
+ * Starts by assuming every pointer argument qualifies, then removes the ones
+ *  with a call that passes anything else, until nothing changes.  Arguments
+ *  that are passed along to other functions are handled by the repetition.
+ * Must be called before cloneFunctionArguments().
+ */
+void dataflowProtection::findOffsetArgs(Module& M) {
+	if (!replicaOffset)
+		return;
+
+	if (replicaStackSize) {
+		findMainStackFns(M);
+		if (mainStackFns.empty())
+			errs() << warn_string << " -replicaStackSize needs main() in this module, the copies of locals are left alone\n";
+	}
+
+	for (auto F : fnsToClone) {
+		if (F->isDeclaration() || isISR(*F) || !onlyDirectCalls(F))
+			continue;
+		if (protectedLibList.find(F) != protectedLibList.end())
+			continue;
+		for (auto & arg : F->args()) {
+			if (arg.getType()->isPointerTy())
+				offsetArgs[F].insert(arg.getArgNo());
+		}
+	}
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto & entry : offsetArgs) {
+			Function* F = entry.first;
+			for (auto U : F->users()) {
+				if (isa<ConstantExpr>(U))
+					continue;
+				for (auto argIt = entry.second.begin(); argIt != entry.second.end(); ) {
+					Value* passed;
+					if (CallInst* CI = dyn_cast<CallInst>(U))
+						passed = CI->getArgOperand(*argIt);
+					else
+						passed = cast<InvokeInst>(U)->getArgOperand(*argIt);
+
+					if (!isOffsetAddress(passed)) {
+						argIt = entry.second.erase(argIt);
+						changed = true;
+					} else {
+						argIt++;
+					}
+				}
+			}
+		}
+	}
+
+	for (auto it = offsetArgs.begin(); it != offsetArgs.end(); ) {
+		if (it->second.empty()) {
+			it = offsetArgs.erase(it);
+			continue;
+		}
+		if (verboseFlag) {
+			errs() << "Finding the copies of arguments to '" << it->first->getName() << "' by offset:";
+			for (auto argNum : it->second) {
+				errs() << " " << argNum;
+			}
+			errs() << "\n";
+		}
+		it++;
+	}
+}
+
+
+/*
+ * Make the copies of an argument by adding the offset, at the start of the function.
+ * These instructions are not cloned themselves.
+ */
+void dataflowProtection::addOffsetArgClone(Argument* arg) {
+	Function* F = arg->getParent();
+	IRBuilder<> builder(&*F->getEntryBlock().getFirstInsertionPt());
+	Type* bytePtrTy = Type::getInt8PtrTy(F->getContext(), arg->getType()->getPointerAddressSpace());
+	Value* base = builder.CreateBitCast(arg, bytePtrTy);
+
+	std::vector<Value*> created = {base};
+	std::vector<Value*> copies;
+	for (unsigned i = 1; i <= (TMR ? 2 : 1); i++) {
+		Value* addr = builder.CreateConstGEP1_64(base, (uint64_t)i * replicaOffset);
+		std::string suffix = (i == 1) ? "_DWC" : "_TMR";
+		Value* copy = builder.CreateBitCast(addr, arg->getType(), arg->getName() + suffix);
+		created.push_back(addr);
+		created.push_back(copy);
+		copies.push_back(copy);
+	}
+	for (auto V : created) {
+		if (Instruction* I = dyn_cast<Instruction>(V))
+			instsToSkip.insert(I);
+	}
+
+	cloneMap[arg] = ValuePair(copies[0], TMR ? copies[1] : nullptr);
+}
+
+
+/*
+ * Put the replicated globals and their copies in the replica sections.
+ * The copies are always created right before the original, so the order of
+ *  the globals in each section is the same, and so is the distance between them.
+ * They're marked as used so nothing later removes one copy but not the others.
+ */
+void dataflowProtection::placeReplicaSections(Module& M) {
+	if (!replicaOffset || noMemReplicationFlag)
+		return;
+
+	std::vector<GlobalValue*> placed;
+	for (auto g : globalsToClone) {
+		if (!isOffsetGlobal(g) || (cloneMap.find(g) == cloneMap.end()))
+			continue;
+
+		GlobalVariable* g1 = cast<GlobalVariable>(cloneMap[g].first);
+		g->setSection(xmr_section_name);
+		g1->setSection(xmr_section_name + "_DWC");
+		placed.push_back(g);
+		placed.push_back(g1);
+		if (TMR) {
+			GlobalVariable* g2 = cast<GlobalVariable>(cloneMap[g].second);
+			g2->setSection(xmr_section_name + "_TMR");
+			placed.push_back(g2);
+		}
+	}
+
+	if (placed.size() > 0)
+		appendToUsed(M, placed);
+	if (verboseFlag)
+		errs() << info_string << " placed " << placed.size() << " globals in the replica sections\n";
+}
+
+
+/*
+ * Replace the copies of locals with the address of the original plus the offset.
+ * This only works if the stack is the one reserved by the generated linker script,
+ *  because that also reserves the space at the offset from it, so it's only done
+ *  in the functions from findMainStackFns().
+ * Must be called after the clones are done being moved around.
+ */
+void dataflowProtection::offsetStackReplicas(Module& M) {
+	if (!replicaOffset || !replicaStackSize || noMemReplicationFlag)
+		return;
+
+	// the functions have been replaced by their clones since findOffsetArgs()
+	findMainStackFns(M);
+
+	unsigned numReplaced = 0;
+	unsigned numOtherStack = 0;
+	for (auto & F : M) {
+		if (F.isDeclaration() || (fnsToClone.find(&F) == fnsToClone.end()))
+			continue;
+		if (mainStackFns.find(&F) == mainStackFns.end()) {
+			numOtherStack++;
+			continue;
+		}
+
+		std::vector<AllocaInst*> origAllocas;
+		std::set<Value*> liveAllocas;
+		for (auto & I : F.getEntryBlock()) {
+			if (AllocaInst* AI = dyn_cast<AllocaInst>(&I)) {
+				liveAllocas.insert(AI);
+				if (cloneMap.find(AI) != cloneMap.end() && AI->isStaticAlloca())
+					origAllocas.push_back(AI);
+			}
+		}
+
+		for (auto AI : origAllocas) {
+			ValuePair clones = cloneMap[AI];
+			std::vector<Value*> copies;
+			copies.push_back(clones.first);
+			if (TMR)
+				copies.push_back(clones.second);
+
+			// the original goes first, so it's defined before all of the copies are used
+			AI->moveBefore(&*F.getEntryBlock().getFirstInsertionPt());
+			for (unsigned i = 0; i < copies.size(); i++) {
+				if (liveAllocas.find(copies[i]) == liveAllocas.end())
+					continue;
+				AllocaInst* copy = cast<AllocaInst>(copies[i]);
+
+				IRBuilder<> builder(copy);
+				Type* bytePtrTy = Type::getInt8PtrTy(M.getContext(), AI->getType()->getAddressSpace());
+				Value* base = builder.CreateBitCast(AI, bytePtrTy);
+				Value* addr = builder.CreateConstGEP1_64(base, (uint64_t)(i + 1) * replicaOffset);
+				Value* copyAddr = builder.CreateBitCast(addr, copy->getType());
+				copyAddr->takeName(copy);
+				copy->replaceAllUsesWith(copyAddr);
+				copy->eraseFromParent();
+				numReplaced++;
+			}
+		}
+	}
+
+	if (verboseFlag) {
+		errs() << info_string << " found " << numReplaced << " copies of locals by offset, "
+			   << numOtherStack << " functions can run on another stack and were left alone\n";
+	}
+}
+
+
+/*
+ * Write the linker script that puts the replica sections at the offset.
+ * It's meant to be added to the default script with -T, because of the INSERT
+ *  command, but the SECTIONS can also be copied into the script for a board.
+ */
+void dataflowProtection::writeReplicaLinkerScript(void) {
+	if (!replicaOffset || noMemReplicationFlag)
+		return;
+
+	std::ofstream ofs(replicaLinkerScript, std::ofstream::out);
+	if (!ofs.is_open()) {
+		errs() << err_string << " could not write linker script to '" << replicaLinkerScript << "'\n";
+		return;
+	}
+
+	unsigned numCopies = TMR ? 3 : 2;
+	std::string sfx[] = {"", "_DWC", "_TMR"};
+	std::string offset = "0x" + utohexstr(replicaOffset);
+
+	ofs << "/*\n"
+		<< " * Generated by COAST with -replicaOffset=" << offset << "\n"
+		<< " * Each copy of the replicated memory is " << offset << " bytes after the one before it.\n"
+		<< " * Add this to the default linker script with -T, or copy the SECTIONS into the\n"
+		<< " *  linker script for the board.\n";
+	if (replicaStackSize) {
+		ofs << " * The startup code must set the stack pointer to __COAST_stack_top.\n";
+	}
+	if (!replicaLoadRegion.empty()) {
+		ofs << " * The sections are loaded from " << replicaLoadRegion << ", and the startup code must\n"
+			<< " *  copy __COAST_xmr_size bytes from __COAST_xmr<copy>_load to __COAST_xmr<copy>_start\n"
+			<< " *  for each copy, the same as .data.\n";
+	} else {
+		ofs << " * The sections are loaded where they are linked, so a program started from flash\n"
+			<< " *  needs -replicaLoadRegion.\n";
+	}
+	ofs << " */\n\n";
+
+	// after the section, to load it from somewhere else
+	std::string loadAt = replicaLoadRegion.empty() ? "" : " AT> " + replicaLoadRegion;
+
+	ofs << "SECTIONS\n{\n";
+	ofs << "  " << xmr_section_name << " : ALIGN(64)\n"
+		<< "  {\n"
+		<< "    __COAST_xmr_start = .;\n"
+		<< "    KEEP(*(" << xmr_section_name << "))\n"
+		<< "  }" << loadAt << "\n";
+	if (replicaStackSize) {
+		ofs << "  " << xmr_section_name << "_stack (NOLOAD) : ALIGN(16)\n"
+			<< "  {\n"
+			<< "    __COAST_stack_bottom = .;\n"
+			<< "    . += " << replicaStackSize << ";\n"
+			<< "    __COAST_stack_top = .;\n"
+			<< "  }\n";
+	}
+	ofs << "  __COAST_xmr_end = .;\n";
+
+	for (unsigned i = 1; i < numCopies; i++) {
+		std::string dist = std::to_string(i) + " * " + offset;
+		ofs << "  " << xmr_section_name << sfx[i] << " (__COAST_xmr_start + " << dist << ") :\n"
+			<< "  {\n"
+			<< "    KEEP(*(" << xmr_section_name << sfx[i] << "))\n"
+			<< "  }" << loadAt << "\n";
+		if (replicaStackSize) {
+			ofs << "  " << xmr_section_name << "_stack" << sfx[i]
+				<< " (__COAST_stack_bottom + " << dist << ") (NOLOAD) :\n"
+				<< "  {\n"
+				<< "    . += " << replicaStackSize << ";\n"
+				<< "  }\n";
+		}
+	}
+	ofs << "}\nINSERT AFTER .bss;\n\n";
+
+	if (!replicaLoadRegion.empty()) {
+		ofs << "__COAST_xmr_size = SIZEOF(" << xmr_section_name << ");\n";
+		for (unsigned i = 0; i < numCopies; i++) {
+			std::string sec = xmr_section_name + sfx[i];
+			ofs << "__COAST_xmr" << sfx[i] << "_start = ADDR(" << sec << ");\n"
+				<< "__COAST_xmr" << sfx[i] << "_load = LOADADDR(" << sec << ");\n";
+		}
+		ofs << "\n";
+	}
+
+	ofs << "ASSERT(__COAST_xmr_end - __COAST_xmr_start <= " << offset
+		<< ", \"COAST: replicated memory is bigger than -replicaOffset\");\n";
+	for (unsigned i = 1; i < numCopies; i++) {
+		ofs << "ASSERT(SIZEOF(" << xmr_section_name << sfx[i] << ") == SIZEOF(" << xmr_section_name
+			<< "), \"COAST: the copies of replicated memory are not the same size\");\n";
+	}
+
+	ofs.close();
+	if (verboseFlag) {
+		errs() << info_string << " wrote replica linker script to '" << replicaLinkerScript << "'\n";
+	}
+}
+
+
+//----------------------------------------------------------------------------//
+// Replica banks
+//----------------------------------------------------------------------------//
+/*
+ * Put the original and the copies of large globals in the sections from -replicaBanks.
+ * Each copy goes in a different section, so each can be placed in a different
+ *  memory, and the accesses to the copies don't have to wait on each other.
+ */
+void dataflowProtection::placeReplicaBanks(Module& M) {
+	if (bankSections.empty() || noMemReplicationFlag)
+		return;
+
+	const DataLayout& DL = M.getDataLayout();
+	unsigned numPlaced = 0;
+	for (auto g : globalsToClone) {
+		if (cloneMap.find(g) == cloneMap.end())
+			continue;
+		if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g->getName().str()) != ignoreGlbl.end())
+			continue;
+		// constants can't share a section with variables
+		if (g->isConstant() || g->hasSection() || g->isThreadLocal() || !g->hasDefinitiveInitializer())
+			continue;
+		if (DL.getTypeAllocSize(g->getValueType()) < replicaBankMinSize)
+			continue;
+
+		std::vector<GlobalVariable*> copies = {g, cast<GlobalVariable>(cloneMap[g].first)};
+		if (TMR)
+			copies.push_back(cast<GlobalVariable>(cloneMap[g].second));
+
+		for (unsigned i = 0; i < copies.size() && i < bankSections.size(); i++) {
+			if (bankSections[i].empty())
+				continue;
+			copies[i]->setSection(bankSections[i]);
+		}
+		numPlaced++;
+
+		if (verboseFlag)
+			errs() << "Placing the copies of global " << g->getName() << " in the replica banks\n";
+	}
+
+	if (verboseFlag)
+		errs() << info_string << " placed " << numPlaced << " globals in the replica banks\n";
+}
+
+
+/*
+ * Write the linker script that places the bank sections.
+ * If none of them has a memory region, it's meant to be added to the default script
+ *  with -T, because of the INSERT command.  Each bank starts on a new page, so
+ *  the pages can be bound to different NUMA nodes for testing.
+ * Otherwise the regions have to come from the linker script for the board, so
+ *  the SECTIONS must be copied into it.
+ */
+void dataflowProtection::writeBankLinkerScript(void) {
+	if (bankSections.empty() || noMemReplicationFlag)
+		return;
+
+	std::ofstream ofs(replicaBankScript, std::ofstream::out);
+	if (!ofs.is_open()) {
+		errs() << err_string << " could not write linker script to '" << replicaBankScript << "'\n";
+		return;
+	}
+
+	unsigned numCopies = TMR ? 3 : 2;
+	bool hasRegions = false;
+	for (auto region : bankRegions) {
+		if (!region.empty())
+			hasRegions = true;
+	}
+
+	ofs << "/*\n"
+		<< " * Generated by COAST with -replicaBanks=" << replicaBanks << "\n";
+	if (hasRegions) {
+		ofs << " * Copy the SECTIONS into the linker script for the board, which defines the\n"
+			<< " *  memory regions.\n";
+	} else {
+		ofs << " * Add this to the default linker script with -T.\n";
+	}
+	ofs << " */\n\n";
+
+	ofs << "SECTIONS\n{\n";
+	for (unsigned i = 0; i < numCopies && i < bankSections.size(); i++) {
+		if (bankSections[i].empty())
+			continue;
+		std::string bank = "__COAST_bank" + std::to_string(i);
+		ofs << "  " << bankSections[i] << " : ALIGN(" << (hasRegions ? 64 : 4096) << ")\n"
+			<< "  {\n"
+			<< "    " << bank << "_start = .;\n"
+			<< "    KEEP(*(" << bankSections[i] << "))\n"
+			<< "    " << bank << "_end = .;\n"
+			<< "  }";
+		if (!bankRegions[i].empty())
+			ofs << " > " << bankRegions[i];
+		ofs << "\n";
+	}
+	ofs << "}\n";
+	if (!hasRegions)
+		ofs << "INSERT AFTER .bss;\n";
+
+	ofs.close();
+	if (verboseFlag) {
+		errs() << info_string << " wrote replica bank linker script to '" << replicaBankScript << "'\n";
+	}
+}
+
+//----------------------------------------------------------------------------//
+// Replica heap
+//----------------------------------------------------------------------------//
+/*
+ * Replace the copies of each wrapped malloc() call with a single call to __COAST_malloc().
+ * The heap has a copy for each replica, so the copies of the block are found by adding
+ *  the stride, which is the -replicaOffset if it's used, or else __COAST_heap_stride.
+ * The copies of wrapped free() calls all go to __COAST_free(), which ignores
+ *  the pointers to the copies of the heap.
+ * Must be called after the calls are cloned, but before the sync points are found.
+ */
+void dataflowProtection::mergeReplicaAllocs(Module& M) {
+	if (!replicaMallocFlag || noMemReplicationFlag)
+		return;
+
+	std::vector<CallInst*> mallocCalls, freeCalls;
+	for (auto I : wrapperInsts) {
+		CallInst* CI = dyn_cast<CallInst>(I);
+		if (!CI || !CI->getCalledFunction() || (cloneMap.find(CI) == cloneMap.end()))
+			continue;
+		std::string fnName = CI->getCalledFunction()->getName().str();
+		if (replicaMallocNames.count(fnName) && CI->getNumArgOperands() == 1)
+			mallocCalls.push_back(CI);
+		else if (replicaFreeNames.count(fnName) && CI->getNumArgOperands() == 1)
+			freeCalls.push_back(CI);
+	}
+	if (mallocCalls.empty() && freeCalls.empty())
+		return;
+
+	LLVMContext& C = M.getContext();
+	Type* intPtrTy = M.getDataLayout().getIntPtrType(C);
+	Type* bytePtrTy = Type::getInt8PtrTy(C);
+	Constant* mallocFn = M.getOrInsertFunction("__COAST_malloc",
+			FunctionType::get(bytePtrTy, {intPtrTy}, false));
+	Constant* freeFn = M.getOrInsertFunction("__COAST_free",
+			FunctionType::get(Type::getVoidTy(C), {bytePtrTy}, false));
+	Constant* strideGlobal = nullptr;
+	if (!replicaOffset)
+		strideGlobal = M.getOrInsertGlobal("__COAST_heap_stride", intPtrTy);
+
+	for (auto CI : mallocCalls) {
+		std::vector<Instruction*> oldCalls = {CI, cast<Instruction>(cloneMap[CI].first)};
+		if (TMR)
+			oldCalls.push_back(cast<Instruction>(cloneMap[CI].second));
+
+		IRBuilder<> builder(CI);
+		Value* size = builder.CreateZExtOrTrunc(CI->getArgOperand(0), intPtrTy);
+		CallInst* newCall = builder.CreateCall(mallocFn, {size});
+		newCall->setDebugLoc(CI->getDebugLoc());
+		Value* isNull = builder.CreateIsNull(newCall);
+		Value* stride;
+		if (replicaOffset)
+			stride = ConstantInt::get(intPtrTy, replicaOffset);
+		else
+			stride = builder.CreateLoad(strideGlobal);
+
+		// the copies are null if the block is, so the replicas still agree
+		std::vector<Value*> copies = {builder.CreatePointerCast(newCall, CI->getType())};
+		for (unsigned i = 1; i < oldCalls.size(); i++) {
+			Value* dist = builder.CreateMul(stride, ConstantInt::get(intPtrTy, i));
+			Value* addr = builder.CreateGEP(newCall, dist);
+			Value* copy = builder.CreatePointerCast(addr, CI->getType());
+			copies.push_back(builder.CreateSelect(isNull, Constant::getNullValue(CI->getType()), copy));
+		}
+
+		for (unsigned i = 0; i < oldCalls.size(); i++) {
+			copies[i]->takeName(oldCalls[i]);
+			oldCalls[i]->replaceAllUsesWith(copies[i]);
+		}
+		for (auto oldCall : oldCalls) {
+			instsToClone.erase(oldCall);
+			instsToCloneAnno.erase(oldCall);
+			wrapperInsts.erase(oldCall);
+			oldCall->eraseFromParent();
+		}
+
+		cloneMap.erase(CI);
+		cloneMap[copies[0]] = ValuePair(copies[1], TMR ? copies[2] : nullptr);
+		wrapperInsts.insert(newCall);
+	}
+
+	for (auto CI : freeCalls) {
+		std::vector<CallInst*> calls = {CI, cast<CallInst>(cloneMap[CI].first)};
+		if (TMR)
+			calls.push_back(cast<CallInst>(cloneMap[CI].second));
+
+		for (auto call : calls) {
+			IRBuilder<> builder(call);
+			Value* ptr = builder.CreatePointerCast(call->getArgOperand(0), bytePtrTy);
+			CallInst* newCall = builder.CreateCall(freeFn, {ptr});
+			newCall->setDebugLoc(call->getDebugLoc());
+			instsToClone.erase(call);
+			instsToCloneAnno.erase(call);
+			wrapperInsts.erase(call);
+			wrapperInsts.insert(newCall);
+			call->eraseFromParent();
+		}
+		cloneMap.erase(CI);
+	}
+
+	if (verboseFlag)
+		errs() << info_string << " merged " << mallocCalls.size() << " calls to malloc and "
+			   << freeCalls.size() << " calls to free into the replica heap\n";
+}
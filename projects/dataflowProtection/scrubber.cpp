@@ -0,0 +1,357 @@
+/*
+ * scrubber.cpp
+ *
+ * This file contains the logic for scrubbing the copies of replicated globals.
+ * The copies of a global are only compared when a value is loaded and used, so
+ *  a global that is rarely read can collect an upset in more than one copy.
+ * The function __COAST_SCRUB_MEMORY() compares the copies of a part of the
+ *  replicated globals each time it is called, and picks up where it left off
+ *  the next time.  With TMR, any word that doesn't match is voted on and
+ *  written back to all of the copies.  With DWC, a mismatch is an error.
+ * Protected code writes the original and the copies one after the other, so if
+ *  it were stopped in between, the scrubber would vote the old value back in.
+ *  It can be called from an idle hook, which only runs when everything else is
+ *  blocked.  Anywhere else, like a timer or another thread, the application
+ *  has to define __COAST_SCRUB_LOCK() and __COAST_SCRUB_UNLOCK(), which are
+ *  called around each chunk, to keep the protected code from running.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> scrubMemoryFlag;
+extern cl::opt<unsigned> scrubChunkSize;
+extern cl::opt<bool> noMemReplicationFlag;
+extern cl::opt<bool> ReportErrorsFlag;
+extern cl::opt<bool> verboseFlag;
+extern std::list<std::string> ignoreGlbl;
+
+// shared variables
+extern std::string fault_function_name;
+extern std::string tmr_global_count_name;
+
+
+/*
+ * Get a hook called around each chunk that is scrubbed.  If the application doesn't
+ *  define it in this module, it gets an empty weak definition, which is replaced by
+ *  the one in another file, if there is one.
+ */
+Function* dataflowProtection::getScrubHook(Module& M, const std::string& name) {
+	LLVMContext& C = M.getContext();
+	FunctionType* hookTy = FunctionType::get(Type::getVoidTy(C), false);
+	Function* hook = M.getFunction(name);
+	if (!hook) {
+		hook = Function::Create(hookTy, GlobalValue::ExternalLinkage, name, &M);
+	} else if (hook->getFunctionType() != hookTy) {
+		errs() << err_string << " '" << name << "' must take no arguments and return void\n";
+		exit(-1);
+	}
+
+	if (hook->isDeclaration()) {
+		hook->setLinkage(GlobalValue::WeakAnyLinkage);
+		ReturnInst::Create(C, BasicBlock::Create(C, "entry", hook));
+	}
+	return hook;
+}
+
+
+/*
+ * Fill in the body of the scrubbing function.
+ * There's a table with the address of each replicated global, its copies, and its size.
+ * Each call checks at most -scrubChunk bytes of the originals, a word at a time.
+ *  The comparison loop only ORs together the differences, so it can be vectorized,
+ *  and the words are only voted on if something didn't match.
+ * Bytes at the end of a global that don't make up a whole word are checked one at a time.
+ * Must be called after the unused globals are removed, so they aren't kept by the table.
+ */
+void dataflowProtection::insertMemoryScrubber(Module& M) {
+	if (isLevelSubset)
+		return;
+	Function* scrubFn = M.getFunction(mem_scrub_fn_name);
+	if (!scrubMemoryFlag && !scrubFn)
+		return;
+	if (scrubFn && !scrubFn->isDeclaration())
+		return;
+
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	IntegerType* intPtrTy = DL.getIntPtrType(C);
+	uint64_t wordSize = DL.getTypeAllocSize(intPtrTy);
+
+	if (!scrubFn) {
+		scrubFn = Function::Create(FunctionType::get(i32Ty, false),
+				GlobalValue::ExternalLinkage, mem_scrub_fn_name, &M);
+	}
+
+	// the globals that still have all of their copies
+	std::set<Value*> liveGlobals;
+	for (GlobalVariable & g : M.globals()) {
+		liveGlobals.insert(&g);
+	}
+	std::vector<std::vector<GlobalVariable*> > toScrub;
+	for (auto g : globalsToClone) {
+		if (noMemReplicationFlag || (cloneMap.find(g) == cloneMap.end()))
+			continue;
+		if (std::find(ignoreGlbl.begin(), ignoreGlbl.end(), g->getName().str()) != ignoreGlbl.end())
+			continue;
+		// constants might be in memory that can't be written to
+		if (g->isConstant() || g->isThreadLocal() || (liveGlobals.find(g) == liveGlobals.end()))
+			continue;
+
+		std::vector<GlobalVariable*> copies = {g};
+		copies.push_back(dyn_cast_or_null<GlobalVariable>(cloneMap[g].first));
+		if (TMR)
+			copies.push_back(dyn_cast_or_null<GlobalVariable>(cloneMap[g].second));
+		bool allLive = true;
+		for (auto copy : copies) {
+			if (!copy || (liveGlobals.find(copy) == liveGlobals.end()))
+				allLive = false;
+		}
+		if (allLive)
+			toScrub.push_back(copies);
+	}
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", scrubFn);
+	IRBuilder<> builder(entryBB);
+	if (toScrub.empty()) {
+		// nothing to scrub, but calls to the function still need something to link to
+		builder.CreateRet(ConstantInt::get(i32Ty, 0));
+		return;
+	}
+
+	unsigned numCopies = toScrub.front().size();
+	uint64_t totalBytes = 0;
+	for (auto & copies : toScrub) {
+		totalBytes += DL.getTypeAllocSize(copies[0]->getValueType());
+	}
+
+	GlobalVariable* table = createReplicaTable(M, toScrub, "__COAST_scrub_table");
+	Type* tableTy = table->getValueType();
+	GlobalVariable* cursorEntry = new GlobalVariable(M, intPtrTy, false, GlobalValue::InternalLinkage,
+			ConstantInt::get(intPtrTy, 0), "__COAST_scrub_entry");
+	GlobalVariable* cursorWord = new GlobalVariable(M, intPtrTy, false, GlobalValue::InternalLinkage,
+			ConstantInt::get(intPtrTy, 0), "__COAST_scrub_word");
+	globalsToSkip.insert(table);
+	globalsToSkip.insert(cursorEntry);
+	globalsToSkip.insert(cursorWord);
+
+	Constant* zero = ConstantInt::get(intPtrTy, 0);
+	Constant* one = ConstantInt::get(intPtrTy, 1);
+	Constant* zero32 = ConstantInt::get(i32Ty, 0);
+	uint64_t chunkWords = std::max<uint64_t>(scrubChunkSize / wordSize, 1);
+
+	BasicBlock* headBB = BasicBlock::Create(C, "global", scrubFn);
+	BasicBlock* checkBB = BasicBlock::Create(C, "check", scrubFn);
+	BasicBlock* checkDoneBB = BasicBlock::Create(C, "check.done", scrubFn);
+	BasicBlock* repairBB = TMR ? BasicBlock::Create(C, "repair", scrubFn) : nullptr;
+	BasicBlock* wordsDoneBB = BasicBlock::Create(C, "words.done", scrubFn);
+	BasicBlock* tailCondBB = BasicBlock::Create(C, "tail.cond", scrubFn);
+	BasicBlock* tailBB = BasicBlock::Create(C, "tail", scrubFn);
+	BasicBlock* nextBB = BasicBlock::Create(C, "next", scrubFn);
+	BasicBlock* contBB = BasicBlock::Create(C, "cont", scrubFn);
+	BasicBlock* exitBB = BasicBlock::Create(C, "exit", scrubFn);
+	BasicBlock* errBB = nullptr;
+	if (!TMR) {
+		errBB = BasicBlock::Create(C, "mismatch", scrubFn);
+		Function* errFn = M.getFunction(fault_function_name);
+		assert(errFn && "error function exists");
+		builder.SetInsertPoint(errBB);
+		builder.CreateCall(errFn);
+		builder.CreateUnreachable();
+	}
+
+	// start where the last call stopped
+	builder.SetInsertPoint(entryBB);
+	builder.CreateCall(getScrubHook(M, scrub_lock_fn_name));
+	Value* startEntry = builder.CreateLoad(cursorEntry, "entry.start");
+	Value* startWord = builder.CreateLoad(cursorWord, "word.start");
+	builder.CreateBr(headBB);
+
+	// read the table entry, and find which words to check this time
+	builder.SetInsertPoint(headBB);
+	PHINode* idx = builder.CreatePHI(intPtrTy, 2, "idx");
+	PHINode* off = builder.CreatePHI(intPtrTy, 2, "off");
+	PHINode* budget = builder.CreatePHI(intPtrTy, 2, "budget");
+	PHINode* repaired = builder.CreatePHI(i32Ty, 2, "repaired");
+	idx->addIncoming(startEntry, entryBB);
+	off->addIncoming(startWord, entryBB);
+	budget->addIncoming(ConstantInt::get(intPtrTy, chunkWords), entryBB);
+	repaired->addIncoming(zero32, entryBB);
+
+	std::vector<Value*> bytePtrs, wordPtrs;
+	for (unsigned i = 0; i < numCopies; i++) {
+		Value* fieldAddr = builder.CreateInBoundsGEP(tableTy, table, {zero, idx, builder.getInt32(i)});
+		Value* ptr = builder.CreateLoad(fieldAddr);
+		bytePtrs.push_back(ptr);
+		wordPtrs.push_back(builder.CreateBitCast(ptr, intPtrTy->getPointerTo()));
+	}
+	Value* sizeAddr = builder.CreateInBoundsGEP(tableTy, table, {zero, idx, builder.getInt32(numCopies)});
+	Value* size = builder.CreateLoad(sizeAddr, "size");
+	Value* numWords = builder.CreateUDiv(size, ConstantInt::get(intPtrTy, wordSize), "words");
+	Value* budgetEnd = builder.CreateAdd(off, budget);
+	Value* wordEnd = builder.CreateSelect(builder.CreateICmpULT(budgetEnd, numWords), budgetEnd, numWords, "end");
+	builder.CreateCondBr(builder.CreateICmpULT(off, wordEnd), checkBB, wordsDoneBB);
+
+	// OR together the differences
+	builder.SetInsertPoint(checkBB);
+	PHINode* w = builder.CreatePHI(intPtrTy, 2, "w");
+	PHINode* diff = builder.CreatePHI(intPtrTy, 2, "diff");
+	w->addIncoming(off, headBB);
+	diff->addIncoming(zero, headBB);
+	std::vector<Value*> vals;
+	for (unsigned i = 0; i < numCopies; i++) {
+		vals.push_back(builder.CreateLoad(builder.CreateGEP(wordPtrs[i], w)));
+	}
+	Value* wordDiff = builder.CreateXor(vals[0], vals[1]);
+	if (TMR)
+		wordDiff = builder.CreateOr(wordDiff, builder.CreateXor(vals[0], vals[2]));
+	Value* nextDiff = builder.CreateOr(diff, wordDiff, "diff.next");
+	Value* nextW = builder.CreateAdd(w, one);
+	w->addIncoming(nextW, checkBB);
+	diff->addIncoming(nextDiff, checkBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextW, wordEnd), checkBB, checkDoneBB);
+
+	builder.SetInsertPoint(checkDoneBB);
+	builder.CreateCondBr(builder.CreateICmpEQ(nextDiff, zero), wordsDoneBB, TMR ? repairBB : errBB);
+
+	// vote on each word, and write the result back to all of the copies
+	Value* repairedWords = nullptr;
+	if (TMR) {
+		builder.SetInsertPoint(repairBB);
+		PHINode* rw = builder.CreatePHI(intPtrTy, 2, "rw");
+		PHINode* count = builder.CreatePHI(i32Ty, 2, "count");
+		rw->addIncoming(off, checkDoneBB);
+		count->addIncoming(repaired, checkDoneBB);
+		std::vector<Value*> addrs, rvals;
+		for (unsigned i = 0; i < numCopies; i++) {
+			addrs.push_back(builder.CreateGEP(wordPtrs[i], rw));
+			rvals.push_back(builder.CreateLoad(addrs[i]));
+		}
+		Value* voted = builder.CreateOr(builder.CreateOr(
+				builder.CreateAnd(rvals[0], rvals[1]), builder.CreateAnd(rvals[0], rvals[2])),
+				builder.CreateAnd(rvals[1], rvals[2]), "voted");
+		Value* mismatch = builder.CreateICmpNE(builder.CreateOr(
+				builder.CreateXor(rvals[0], rvals[1]), builder.CreateXor(rvals[0], rvals[2])), zero);
+		for (auto addr : addrs) {
+			builder.CreateStore(voted, addr);
+		}
+		Value* nextCount = builder.CreateAdd(count, builder.CreateZExt(mismatch, i32Ty));
+		Value* nextRw = builder.CreateAdd(rw, one);
+		rw->addIncoming(nextRw, repairBB);
+		count->addIncoming(nextCount, repairBB);
+		builder.CreateCondBr(builder.CreateICmpULT(nextRw, wordEnd), repairBB, wordsDoneBB);
+		repairedWords = nextCount;
+	}
+
+	// stop here if the chunk ran out before the end of the global
+	builder.SetInsertPoint(wordsDoneBB);
+	PHINode* afterWords = builder.CreatePHI(i32Ty, 3, "repaired.words");
+	afterWords->addIncoming(repaired, headBB);
+	afterWords->addIncoming(repaired, checkDoneBB);
+	if (TMR)
+		afterWords->addIncoming(repairedWords, repairBB);
+	Value* nextBudget = builder.CreateSub(budget, builder.CreateSub(wordEnd, off), "budget.next");
+	builder.CreateCondBr(builder.CreateICmpEQ(wordEnd, numWords), tailCondBB, exitBB);
+
+	// the bytes that don't make up a whole word
+	builder.SetInsertPoint(tailCondBB);
+	Value* tailStart = builder.CreateMul(numWords, ConstantInt::get(intPtrTy, wordSize));
+	builder.CreateCondBr(builder.CreateICmpULT(tailStart, size), tailBB, nextBB);
+
+	builder.SetInsertPoint(tailBB);
+	PHINode* b = builder.CreatePHI(intPtrTy, 2, "b");
+	PHINode* tailCount = builder.CreatePHI(i32Ty, 2, "count.tail");
+	b->addIncoming(tailStart, tailCondBB);
+	tailCount->addIncoming(afterWords, tailCondBB);
+	std::vector<Value*> byteAddrs, byteVals;
+	for (unsigned i = 0; i < numCopies; i++) {
+		byteAddrs.push_back(builder.CreateGEP(bytePtrs[i], b));
+		byteVals.push_back(builder.CreateLoad(byteAddrs[i]));
+	}
+	Value* nextTailCount = tailCount;
+	Value* byteDiff = builder.CreateXor(byteVals[0], byteVals[1]);
+	if (TMR) {
+		byteDiff = builder.CreateOr(byteDiff, builder.CreateXor(byteVals[0], byteVals[2]));
+		Value* voted = builder.CreateOr(builder.CreateOr(
+				builder.CreateAnd(byteVals[0], byteVals[1]), builder.CreateAnd(byteVals[0], byteVals[2])),
+				builder.CreateAnd(byteVals[1], byteVals[2]), "voted");
+		for (auto addr : byteAddrs) {
+			builder.CreateStore(voted, addr);
+		}
+		Value* mismatch = builder.CreateICmpNE(byteDiff, builder.getInt8(0));
+		nextTailCount = builder.CreateAdd(tailCount, builder.CreateZExt(mismatch, i32Ty));
+	}
+	// with DWC, a byte that doesn't match is an error
+	BasicBlock* tailLatchBB = tailBB;
+	if (!TMR) {
+		tailLatchBB = BasicBlock::Create(C, "tail.ok", scrubFn, nextBB);
+		builder.CreateCondBr(builder.CreateICmpEQ(byteDiff, builder.getInt8(0)), tailLatchBB, errBB);
+		builder.SetInsertPoint(tailLatchBB);
+	}
+	Value* nextB = builder.CreateAdd(b, one);
+	b->addIncoming(nextB, tailLatchBB);
+	tailCount->addIncoming(nextTailCount, tailLatchBB);
+	builder.CreateCondBr(builder.CreateICmpULT(nextB, size), tailBB, nextBB);
+
+	// go on to the next global, or back to the first one after a full pass
+	builder.SetInsertPoint(nextBB);
+	PHINode* afterTail = builder.CreatePHI(i32Ty, 2, "repaired.tail");
+	afterTail->addIncoming(afterWords, tailCondBB);
+	afterTail->addIncoming(nextTailCount, tailLatchBB);
+	Value* nextIdx = builder.CreateAdd(idx, one);
+	Value* wrapped = builder.CreateICmpEQ(nextIdx, ConstantInt::get(intPtrTy, toScrub.size()));
+	Value* saveIdx = builder.CreateSelect(wrapped, zero, nextIdx);
+	Value* outOfBudget = builder.CreateICmpEQ(nextBudget, zero);
+	builder.CreateCondBr(builder.CreateOr(wrapped, outOfBudget), exitBB, contBB);
+
+	builder.SetInsertPoint(contBB);
+	builder.CreateBr(headBB);
+	idx->addIncoming(nextIdx, contBB);
+	off->addIncoming(zero, contBB);
+	budget->addIncoming(nextBudget, contBB);
+	repaired->addIncoming(afterTail, contBB);
+
+	// save where to start next time
+	builder.SetInsertPoint(exitBB);
+	PHINode* exitIdx = builder.CreatePHI(intPtrTy, 2, "idx.save");
+	PHINode* exitWord = builder.CreatePHI(intPtrTy, 2, "word.save");
+	PHINode* exitCount = builder.CreatePHI(i32Ty, 2, "repaired.total");
+	exitIdx->addIncoming(idx, wordsDoneBB);
+	exitWord->addIncoming(wordEnd, wordsDoneBB);
+	exitCount->addIncoming(afterWords, wordsDoneBB);
+	exitIdx->addIncoming(saveIdx, nextBB);
+	exitWord->addIncoming(zero, nextBB);
+	exitCount->addIncoming(afterTail, nextBB);
+	builder.CreateStore(exitIdx, cursorEntry);
+	builder.CreateStore(exitWord, cursorWord);
+
+	// corrections are counted along with the rest of them
+	GlobalVariable* TMRErrorDetected = M.getGlobalVariable(tmr_global_count_name);
+	if (TMR && ReportErrorsFlag && TMRErrorDetected) {
+		Value* oldCount = builder.CreateLoad(TMRErrorDetected);
+		builder.CreateStore(builder.CreateAdd(oldCount, exitCount), TMRErrorDetected);
+	}
+	builder.CreateCall(getScrubHook(M, scrub_unlock_fn_name));
+	builder.CreateRet(exitCount);
+
+	if (verboseFlag)
+		errs() << info_string << " scrubbing " << toScrub.size() << " globals (" << totalBytes
+			   << " bytes) in " << mem_scrub_fn_name << "(), " << chunkWords * wordSize << " bytes per call\n";
+}
@@ -0,0 +1,517 @@
+/*
+ * shadowMemory.cpp
+ *
+ * This file contains the logic for protecting memory with a shadow of check bits
+ *  instead of with copies of the memory.
+ * Each protected global and local variable keeps a single copy in memory, the
+ *  same as with -noMemReplication, and a shadow array with one byte of check bits
+ *  for every 32-bit word in the variable.
+ * The shadow is updated after every store, and checked before every load in
+ *  protected code.  With parity, an upset is detected.  With SEC-DED (Hsiao code),
+ *  a single bit upset is corrected in place and a double bit upset is detected.
+ * Only variables whose address never leaves the loads and stores that use it can
+ *  have a shadow, otherwise a store that COAST can't see would make it stale.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <string>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<std::string> shadowMemMode;
+extern cl::opt<bool> noMainFlag;
+extern cl::opt<bool> verboseFlag;
+
+// shared variables
+extern std::string fault_function_name;
+std::string shadow_check_fn_name = "__COAST_shadowCheck";
+std::string shadow_update_fn_name = "__COAST_shadowUpdate";
+
+// helpers from constChecksum.cpp
+bool getInitializerBytes(Constant* C, const DataLayout &DL, std::vector<uint8_t> &bytes);
+
+// Hsiao (39,32) code: every data bit is covered by 3 of the 7 check bits
+const unsigned secded_check_bits = 7;
+const uint8_t syndrome_check_bit = 0xFE;
+const uint8_t syndrome_uncorrectable = 0xFF;
+
+
+/*
+ * The column of the check matrix for each data bit.
+ * These are the first 32 of the 35 7-bit numbers with exactly 3 bits set.
+ */
+static std::vector<uint8_t> getHsiaoColumns() {
+	std::vector<uint8_t> columns;
+	for (unsigned c = 0; (c < 128) && (columns.size() < 32); c++) {
+		if (countPopulation(c) == 3)
+			columns.push_back(c);
+	}
+	return columns;
+}
+
+
+/*
+ * Which data bits go into each check bit
+ */
+static std::vector<uint32_t> getCheckMasks() {
+	std::vector<uint8_t> columns = getHsiaoColumns();
+	std::vector<uint32_t> masks(secded_check_bits, 0);
+	for (unsigned i = 0; i < 32; i++) {
+		for (unsigned j = 0; j < secded_check_bits; j++) {
+			if (columns[i] & (1 << j))
+				masks[j] |= (1u << i);
+		}
+	}
+	return masks;
+}
+
+
+/*
+ * Check bits for a word, the same as the generated code computes them
+ */
+static uint8_t encodeWord(uint32_t word, bool secded) {
+	if (!secded)
+		return countPopulation(word) & 1;
+
+	uint8_t code = 0;
+	std::vector<uint32_t> masks = getCheckMasks();
+	for (unsigned j = 0; j < secded_check_bits; j++) {
+		code |= (countPopulation(word & masks[j]) & 1) << j;
+	}
+	return code;
+}
+
+
+/*
+ * Returns true if the only things done with the address of the variable are
+ *  loading from it and storing to it.
+ */
+static bool onlyLoadsAndStores(Value* obj) {
+	std::vector<Value*> worklist;
+	std::set<Value*> visited;
+	worklist.push_back(obj);
+
+	while (!worklist.empty()) {
+		Value* v = worklist.back();
+		worklist.pop_back();
+		if (visited.find(v) != visited.end())
+			continue;
+		visited.insert(v);
+
+		for (auto U : v->users()) {
+			if (isa<GEPOperator>(U) || isa<BitCastOperator>(U)) {
+				worklist.push_back(U);
+			} else if (isa<LoadInst>(U) || isa<ICmpInst>(U)) {
+				continue;
+			} else if (StoreInst* SI = dyn_cast<StoreInst>(U)) {
+				// storing the address lets it be used somewhere else
+				if (SI->getValueOperand() == v)
+					return false;
+			} else if (isa<DbgInfoIntrinsic>(U)) {
+				continue;
+			} else if (IntrinsicInst* II = dyn_cast<IntrinsicInst>(U)) {
+				if ( (II->getIntrinsicID() != Intrinsic::lifetime_start) &&
+					 (II->getIntrinsicID() != Intrinsic::lifetime_end) )
+					return false;
+			} else {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+/*
+ * Choose which variables get a shadow.  The rest are left with a single copy,
+ *  the same as -noMemReplication.
+ * Must be called after cloneFunctionArguments() so the pointers aren't stale,
+ *  and before cloneInsns() so the clones don't count as uses.
+ */
+void dataflowProtection::selectShadowObjects(Module& M) {
+	if (shadowMemMode.empty())
+		return;
+
+	bool secded = (shadowMemMode == "secded");
+	const DataLayout &DL = M.getDataLayout();
+	std::vector<Value*> candidates;
+
+	// constant globals can't be stored to, so they don't need it
+	// without main, other modules may store to the globals that aren't static
+	for (auto g : globalsToClone) {
+		if (g->isConstant() || !g->hasDefinitiveInitializer())
+			continue;
+		if (noMainFlag && !g->hasLocalLinkage())
+			continue;
+		candidates.push_back(g);
+	}
+	for (auto F : fnsToClone) {
+		for (auto & I : F->getEntryBlock()) {
+			if (AllocaInst* AI = dyn_cast<AllocaInst>(&I)) {
+				if (AI->isStaticAlloca() && !willBeSkipped(AI))
+					candidates.push_back(AI);
+			}
+		}
+	}
+
+	uint64_t protectedBytes = 0;
+	for (auto obj : candidates) {
+		Type* objType;
+		if (GlobalVariable* g = dyn_cast<GlobalVariable>(obj))
+			objType = g->getValueType();
+		else
+			objType = cast<AllocaInst>(obj)->getAllocatedType();
+
+		// the shadow is kept by word
+		uint64_t size = DL.getTypeAllocSize(objType);
+		if ( (size == 0) || (size % 4 != 0) )
+			continue;
+		if (!onlyLoadsAndStores(obj)) {
+			if (verboseFlag)
+				errs() << info_string << " address of '" << obj->getName()
+					   << "' escapes, it will not have a shadow\n";
+			continue;
+		}
+
+		// the shadow of a global starts out matching its initializer
+		std::vector<uint8_t> codes;
+		if (GlobalVariable* g = dyn_cast<GlobalVariable>(obj)) {
+			std::vector<uint8_t> bytes;
+			if (!getInitializerBytes(g->getInitializer(), DL, bytes))
+				continue;
+			for (size_t i = 0; i < bytes.size(); i += 4) {
+				uint32_t word = 0;
+				for (size_t b = 0; b < 4; b++) {
+					unsigned shift = DL.isLittleEndian() ? (b * 8) : ((3 - b) * 8);
+					word |= ((uint32_t)bytes[i + b]) << shift;
+				}
+				codes.push_back(encodeWord(word, secded));
+			}
+			if (g->getAlignment() < 4)
+				g->setAlignment(4);
+		} else {
+			codes.resize(size / 4, 0);
+			AllocaInst* AI = cast<AllocaInst>(obj);
+			if (AI->getAlignment() < 4)
+				AI->setAlignment(4);
+		}
+
+		shadowObjects[obj] = codes;
+		protectedBytes += size;
+	}
+
+	if (verboseFlag && shadowObjects.size() > 0) {
+		uint64_t replicaBytes = protectedBytes * (TMR ? 2 : 1);
+		errs() << info_string << " shadow memory: " << shadowObjects.size() << " variables, "
+			   << protectedBytes << " bytes protected with " << (protectedBytes / 4)
+			   << " bytes of check bits (copies would use " << replicaBytes << " bytes)\n";
+	}
+}
+
+
+/*
+ * Creates the function that computes the check bits of a word
+ */
+static Function* getEncodeFunction(Module& M, bool secded) {
+	std::string fnName = "__COAST_shadowEncode";
+	if (Function* existing = M.getFunction(fnName))
+		return existing;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i8Ty = Type::getInt8Ty(C);
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	FunctionType* fnTy = FunctionType::get(i8Ty, {i32Ty}, false);
+	Function* encodeFn = Function::Create(fnTy, GlobalValue::InternalLinkage, fnName, &M);
+	Argument* word = &*encodeFn->arg_begin();
+	word->setName("word");
+
+	BasicBlock* entryBB = BasicBlock::Create(C, "entry", encodeFn);
+	IRBuilder<> builder(entryBB);
+	Function* ctpop = Intrinsic::getDeclaration(&M, Intrinsic::ctpop, {i32Ty});
+
+	if (!secded) {
+		Value* count = builder.CreateCall(ctpop, {word});
+		Value* parity = builder.CreateAnd(count, builder.getInt32(1));
+		builder.CreateRet(builder.CreateTrunc(parity, i8Ty));
+		return encodeFn;
+	}
+
+	std::vector<uint32_t> masks = getCheckMasks();
+	Value* code = builder.getInt32(0);
+	for (unsigned j = 0; j < secded_check_bits; j++) {
+		Value* covered = builder.CreateAnd(word, builder.getInt32(masks[j]));
+		Value* count = builder.CreateCall(ctpop, {covered});
+		Value* bit = builder.CreateAnd(count, builder.getInt32(1));
+		code = builder.CreateOr(code, builder.CreateShl(bit, j));
+	}
+	builder.CreateRet(builder.CreateTrunc(code, i8Ty));
+	return encodeFn;
+}
+
+
+/*
+ * Start of a loop over the words in [off, off + size).
+ * Returns the word index, the caller fills in the body and calls finishWordLoop().
+ */
+static PHINode* startWordLoop(IRBuilder<> &builder, Function* F, Value* off, Value* size,
+		BasicBlock* &loopBB, Value* &lastWord) {
+	LLVMContext& C = F->getContext();
+	Value* firstWord = builder.CreateLShr(off, 2, "first");
+	Value* end = builder.CreateSub(builder.CreateAdd(off, size), builder.getInt32(1));
+	lastWord = builder.CreateLShr(end, 2, "last");
+	BasicBlock* entryBB = builder.GetInsertBlock();
+	loopBB = BasicBlock::Create(C, "loop", F);
+	builder.CreateBr(loopBB);
+
+	builder.SetInsertPoint(loopBB);
+	PHINode* idx = builder.CreatePHI(builder.getInt32Ty(), 2, "i");
+	idx->addIncoming(firstWord, entryBB);
+	return idx;
+}
+
+static void finishWordLoop(IRBuilder<> &builder, Function* F, PHINode* idx,
+		BasicBlock* loopBB, Value* lastWord) {
+	BasicBlock* doneBB = BasicBlock::Create(F->getContext(), "done", F);
+	Value* nextIdx = builder.CreateAdd(idx, builder.getInt32(1), "i.next");
+	Value* more = builder.CreateICmpULE(nextIdx, lastWord, "more");
+	idx->addIncoming(nextIdx, builder.GetInsertBlock());
+	builder.CreateCondBr(more, loopBB, doneBB);
+	builder.SetInsertPoint(doneBB);
+	builder.CreateRetVoid();
+}
+
+
+/*
+ * Creates the functions that update and check the shadow of a range of memory.
+ * Both take the start of the variable, the start of its shadow, and the offset
+ *  and size of the access.
+ * The loads are volatile so the check can't be folded away using the last update.
+ */
+static void getShadowFunctions(Module& M, bool secded, Function* errFn,
+		Function* &updateFn, Function* &checkFn) {
+	updateFn = M.getFunction(shadow_update_fn_name);
+	checkFn = M.getFunction(shadow_check_fn_name);
+	if (updateFn && checkFn)
+		return;
+
+	LLVMContext& C = M.getContext();
+	Type* i8PtrTy = Type::getInt8PtrTy(C);
+	Type* i32PtrTy = Type::getInt32PtrTy(C);
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	FunctionType* fnTy = FunctionType::get(Type::getVoidTy(C), {i8PtrTy, i8PtrTy, i32Ty, i32Ty}, false);
+	Function* encodeFn = getEncodeFunction(M, secded);
+
+	// update
+	updateFn = Function::Create(fnTy, GlobalValue::InternalLinkage, shadow_update_fn_name, &M);
+	{
+		auto argIt = updateFn->arg_begin();
+		Value* base = &*argIt++;
+		Value* shadow = &*argIt++;
+		Value* off = &*argIt++;
+		Value* size = &*argIt;
+
+		IRBuilder<> builder(BasicBlock::Create(C, "entry", updateFn));
+		Value* words = builder.CreateBitCast(base, i32PtrTy);
+		BasicBlock* loopBB;
+		Value* lastWord;
+		PHINode* idx = startWordLoop(builder, updateFn, off, size, loopBB, lastWord);
+		Value* word = builder.CreateLoad(builder.CreateGEP(words, idx), true, "word");
+		Value* code = builder.CreateCall(encodeFn, {word}, "code");
+		builder.CreateStore(code, builder.CreateGEP(shadow, idx));
+		finishWordLoop(builder, updateFn, idx, loopBB, lastWord);
+	}
+
+	// check
+	checkFn = Function::Create(fnTy, GlobalValue::InternalLinkage, shadow_check_fn_name, &M);
+	{
+		auto argIt = checkFn->arg_begin();
+		Value* base = &*argIt++;
+		Value* shadow = &*argIt++;
+		Value* off = &*argIt++;
+		Value* size = &*argIt;
+
+		IRBuilder<> builder(BasicBlock::Create(C, "entry", checkFn));
+		Value* words = builder.CreateBitCast(base, i32PtrTy);
+		BasicBlock* loopBB;
+		Value* lastWord;
+		PHINode* idx = startWordLoop(builder, checkFn, off, size, loopBB, lastWord);
+		Value* wordAddr = builder.CreateGEP(words, idx);
+		Value* codeAddr = builder.CreateGEP(shadow, idx);
+		Value* word = builder.CreateLoad(wordAddr, true, "word");
+		Value* saved = builder.CreateLoad(codeAddr, true, "saved");
+		Value* code = builder.CreateCall(encodeFn, {word}, "code");
+		Value* syndrome = builder.CreateXor(code, saved, "syndrome");
+
+		BasicBlock* nextBB = BasicBlock::Create(C, "next", checkFn);
+		BasicBlock* badBB = BasicBlock::Create(C, "bad", checkFn);
+		BasicBlock* errBB = BasicBlock::Create(C, "error", checkFn);
+		builder.CreateCondBr(builder.CreateICmpEQ(syndrome, builder.getInt8(0)), nextBB, badBB);
+
+		builder.SetInsertPoint(errBB);
+		builder.CreateCall(errFn);
+		builder.CreateUnreachable();
+
+		builder.SetInsertPoint(badBB);
+		if (!secded) {
+			builder.CreateBr(errBB);
+		} else {
+			// what to do for each syndrome
+			std::vector<uint8_t> syndromeTable(128, syndrome_uncorrectable);
+			std::vector<uint8_t> columns = getHsiaoColumns();
+			for (unsigned i = 0; i < columns.size(); i++)
+				syndromeTable[columns[i]] = i;
+			for (unsigned j = 0; j < secded_check_bits; j++)
+				syndromeTable[1 << j] = syndrome_check_bit;
+			Constant* tableInit = ConstantDataArray::get(C, syndromeTable);
+			GlobalVariable* table = new GlobalVariable(M, tableInit->getType(), true,
+					GlobalValue::InternalLinkage, tableInit, "__COAST_shadowSyndromes");
+
+			Value* entry = builder.CreateLoad(builder.CreateInBoundsGEP(table,
+					{builder.getInt32(0), builder.CreateZExt(syndrome, i32Ty)}), "fix");
+			BasicBlock* fixCodeBB = BasicBlock::Create(C, "fixCode", checkFn);
+			BasicBlock* notCodeBB = BasicBlock::Create(C, "notCode", checkFn);
+			BasicBlock* fixWordBB = BasicBlock::Create(C, "fixWord", checkFn);
+			builder.CreateCondBr(builder.CreateICmpEQ(entry, builder.getInt8(syndrome_check_bit)),
+					fixCodeBB, notCodeBB);
+
+			// a check bit flipped
+			builder.SetInsertPoint(fixCodeBB);
+			builder.CreateStore(code, codeAddr, true);
+			builder.CreateBr(nextBB);
+
+			builder.SetInsertPoint(notCodeBB);
+			builder.CreateCondBr(builder.CreateICmpEQ(entry, builder.getInt8(syndrome_uncorrectable)),
+					errBB, fixWordBB);
+
+			// a data bit flipped
+			builder.SetInsertPoint(fixWordBB);
+			Value* flip = builder.CreateShl(builder.getInt32(1), builder.CreateZExt(entry, i32Ty));
+			builder.CreateStore(builder.CreateXor(word, flip), wordAddr, true);
+			builder.CreateBr(nextBB);
+		}
+
+		builder.SetInsertPoint(nextBB);
+		finishWordLoop(builder, checkFn, idx, loopBB, lastWord);
+	}
+}
+
+
+/*
+ * Give each chosen variable its shadow, and update or check it at every store and load.
+ */
+void dataflowProtection::insertShadowChecks(Module& M) {
+	if (shadowObjects.size() == 0)
+		return;
+
+	LLVMContext& C = M.getContext();
+	const DataLayout &DL = M.getDataLayout();
+	Type* i8PtrTy = Type::getInt8PtrTy(C);
+	Type* intPtrTy = DL.getIntPtrType(C);
+	Function* errFn = M.getFunction(fault_function_name);
+	assert(errFn && "error function exists");
+
+	Function* updateFn;
+	Function* checkFn;
+	getShadowFunctions(M, (shadowMemMode == "secded"), errFn, updateFn, checkFn);
+
+	// the clones of loads read the same memory, so only the original is checked
+	std::set<Value*> clones;
+	for (auto entry : cloneMap) {
+		clones.insert(entry.second.first);
+		clones.insert(entry.second.second);
+	}
+
+	unsigned numLoads = 0, numStores = 0;
+	for (auto entry : shadowObjects) {
+		Value* obj = entry.first;
+		ArrayType* shadowTy = ArrayType::get(Type::getInt8Ty(C), entry.second.size());
+		Value* shadow;
+
+		if (GlobalVariable* g = dyn_cast<GlobalVariable>(obj)) {
+			GlobalVariable* shadowGlbl = new GlobalVariable(M, shadowTy, false, GlobalValue::InternalLinkage,
+					ConstantDataArray::get(C, entry.second), g->getName() + ".shadow");
+			globalsToSkip.insert(shadowGlbl);
+			shadow = shadowGlbl;
+		} else {
+			// locals start out as zero, so the shadow matches
+			AllocaInst* AI = cast<AllocaInst>(obj);
+			AllocaInst* shadowAlloca = new AllocaInst(shadowTy, AI->getType()->getAddressSpace(),
+					AI->getName() + ".shadow", AI->getNextNode());
+			Instruction* initPt = &*AI->getParent()->getFirstInsertionPt();
+			while (isa<AllocaInst>(initPt))
+				initPt = initPt->getNextNode();
+			IRBuilder<> builder(initPt);
+			builder.CreateMemSet(AI, builder.getInt8(0), DL.getTypeAllocSize(AI->getAllocatedType()),
+					AI->getAlignment());
+			builder.CreateMemSet(shadowAlloca, builder.getInt8(0), entry.second.size(), 1);
+			shadow = shadowAlloca;
+		}
+
+		// find all of the loads and stores
+		std::vector<Value*> worklist;
+		std::set<Value*> visited;
+		std::vector<Instruction*> accesses;
+		worklist.push_back(obj);
+		while (!worklist.empty()) {
+			Value* v = worklist.back();
+			worklist.pop_back();
+			if (visited.find(v) != visited.end())
+				continue;
+			visited.insert(v);
+			for (auto U : v->users()) {
+				if (isa<GEPOperator>(U) || isa<BitCastOperator>(U)) {
+					worklist.push_back(U);
+				} else if (LoadInst* LI = dyn_cast<LoadInst>(U)) {
+					Function* parentF = LI->getFunction();
+					if ( (clones.find(LI) == clones.end()) && (fnsToClone.find(parentF) != fnsToClone.end()) )
+						accesses.push_back(LI);
+				} else if (StoreInst* SI = dyn_cast<StoreInst>(U)) {
+					if (SI->getPointerOperand() == v)
+						accesses.push_back(SI);
+				}
+			}
+		}
+
+		for (auto I : accesses) {
+			bool isLoad = isa<LoadInst>(I);
+			Value* ptr = isLoad ? cast<LoadInst>(I)->getPointerOperand() : cast<StoreInst>(I)->getPointerOperand();
+			Type* accessTy = cast<PointerType>(ptr->getType())->getElementType();
+			uint64_t accessSize = DL.getTypeStoreSize(accessTy);
+
+			// before loads, after stores
+			IRBuilder<> builder(isLoad ? I : I->getNextNode());
+			builder.SetCurrentDebugLocation(I->getDebugLoc());
+			Value* baseInt = builder.CreatePtrToInt(obj, intPtrTy);
+			Value* ptrInt = builder.CreatePtrToInt(ptr, intPtrTy);
+			Value* off = builder.CreateZExtOrTrunc(builder.CreateSub(ptrInt, baseInt), builder.getInt32Ty());
+			Value* args[] = {
+				builder.CreateBitCast(obj, i8PtrTy),
+				builder.CreateBitCast(shadow, i8PtrTy),
+				off,
+				builder.getInt32(accessSize)
+			};
+			builder.CreateCall(isLoad ? checkFn : updateFn, args);
+			if (isLoad)
+				numLoads++;
+			else
+				numStores++;
+		}
+	}
+
+	if (verboseFlag)
+		errs() << info_string << " shadow memory: checking " << numLoads << " loads, updating after "
+			   << numStores << " stores\n";
+}
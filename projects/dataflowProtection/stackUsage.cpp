@@ -0,0 +1,190 @@
+/*
+ * stackUsage.cpp
+ *
+ * This file contains the logic for reducing and reporting how much the stack
+ *  grows because the local variables are replicated.
+ * With -promoteLocals, local variables whose address is only used to load and
+ *  store them are promoted to registers, along with all of their copies, after
+ *  all of the synchronization logic has been added.  The copies that are left
+ *  are placed together in the frame, after the original locals.
+ * With -stackReport, the size of the locals and of their copies is printed for
+ *  each protected function.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> promoteLocalsFlag;
+extern cl::opt<bool> stackReportFlag;
+extern cl::opt<bool> verboseFlag;
+
+
+// sizes of the locals in a function, before and after promotion
+struct StackUsage {
+	uint64_t localBytes = 0;
+	uint64_t copyBytes = 0;
+	uint64_t promotedBytes = 0;
+	unsigned promoted = 0;
+};
+
+
+/*
+ * Everything that promoting the local will delete, so it can be taken out of the clone map.
+ */
+static void collectAllocaUsers(Value* V, std::set<Value*> &users) {
+	for (auto U : V->users()) {
+		users.insert(U);
+		if (isa<BitCastInst>(U) || isa<GetElementPtrInst>(U))
+			collectAllocaUsers(U, users);
+	}
+}
+
+
+/*
+ * Promote the locals that can be kept in registers, and put the copies of the rest together.
+ * This is done after the clones are moved, so nothing but the clone map still
+ *  refers to the loads and stores that are removed.
+ */
+void dataflowProtection::shrinkReplicaStack(Module& M) {
+	if (!promoteLocalsFlag && !stackReportFlag)
+		return;
+
+	const DataLayout& DL = M.getDataLayout();
+	std::map<Function*, StackUsage> usage;
+	std::set<Value*> removed;
+
+	for (auto F : fnsToClone) {
+		if (F->isDeclaration())
+			continue;
+
+		// only the static locals, which make up the frame
+		std::vector<AllocaInst*> origAllocas;
+		std::set<Value*> copyAllocas;
+		for (auto & I : F->getEntryBlock()) {
+			AllocaInst* AI = dyn_cast<AllocaInst>(&I);
+			if (!AI || !AI->isStaticAlloca())
+				continue;
+			if (cloneMap.find(AI) != cloneMap.end()) {
+				origAllocas.push_back(AI);
+				copyAllocas.insert(cloneMap[AI].first);
+				if (TMR)
+					copyAllocas.insert(cloneMap[AI].second);
+			}
+		}
+		if (origAllocas.empty())
+			continue;
+
+		StackUsage& fnUsage = usage[F];
+		for (auto & I : F->getEntryBlock()) {
+			AllocaInst* AI = dyn_cast<AllocaInst>(&I);
+			if (!AI || !AI->isStaticAlloca())
+				continue;
+			uint64_t bytes = DL.getTypeAllocSize(AI->getAllocatedType());
+			if (copyAllocas.find(AI) != copyAllocas.end())
+				fnUsage.copyBytes += bytes;
+			else
+				fnUsage.localBytes += bytes;
+		}
+
+		if (!promoteLocalsFlag)
+			continue;
+
+		// all of the copies have to be promoted, or none of them
+		std::vector<AllocaInst*> toPromote;
+		for (auto AI : origAllocas) {
+			std::vector<AllocaInst*> copies = {AI};
+			copies.push_back(dyn_cast<AllocaInst>(cloneMap[AI].first));
+			if (TMR)
+				copies.push_back(dyn_cast<AllocaInst>(cloneMap[AI].second));
+
+			bool canPromote = true;
+			for (auto copy : copies) {
+				if (!copy || (copy->getParent() != AI->getParent()) || !isAllocaPromotable(copy))
+					canPromote = false;
+			}
+			if (!canPromote)
+				continue;
+
+			for (auto copy : copies) {
+				removed.insert(copy);
+				collectAllocaUsers(copy, removed);
+				toPromote.push_back(copy);
+			}
+			fnUsage.promotedBytes += DL.getTypeAllocSize(AI->getAllocatedType()) * (copies.size() - 1);
+			fnUsage.promoted++;
+		}
+
+		if (!toPromote.empty()) {
+			DominatorTree DT(*F);
+			PromoteMemToReg(toPromote, DT);
+		}
+
+		// put the copies that are left after the originals, DWC first, then TMR
+		std::vector<AllocaInst*> frame;
+		Instruction* firstNonAlloca = nullptr;
+		for (auto & I : F->getEntryBlock()) {
+			if (!isa<AllocaInst>(&I)) {
+				firstNonAlloca = &I;
+				break;
+			}
+			frame.push_back(cast<AllocaInst>(&I));
+		}
+		std::vector<AllocaInst*> lane1, lane2;
+		for (auto AI : frame) {
+			if (cloneMap.find(AI) == cloneMap.end())
+				continue;
+			AllocaInst* copy1 = dyn_cast<AllocaInst>(cloneMap[AI].first);
+			if (copy1 && std::find(frame.begin(), frame.end(), copy1) != frame.end())
+				lane1.push_back(copy1);
+			if (TMR) {
+				AllocaInst* copy2 = dyn_cast<AllocaInst>(cloneMap[AI].second);
+				if (copy2 && std::find(frame.begin(), frame.end(), copy2) != frame.end())
+					lane2.push_back(copy2);
+			}
+		}
+		lane1.insert(lane1.end(), lane2.begin(), lane2.end());
+		for (auto copy : lane1) {
+			copy->moveBefore(firstNonAlloca);
+		}
+	}
+
+	removeFromCloneMap(removed);
+
+	if (stackReportFlag) {
+		errs() << info_string << " stack used by local variables (bytes):\n";
+		errs() << "  function                           locals     copies   promoted    growth\n";
+		for (auto & entry : usage) {
+			StackUsage &u = entry.second;
+			std::string name = entry.first->getName().str();
+			uint64_t copiesLeft = u.copyBytes - u.promotedBytes;
+			errs() << "  " << format("%-32s %8lu %10lu %10lu %8.0f%%\n", name.c_str(),
+					(unsigned long)u.localBytes, (unsigned long)copiesLeft, (unsigned long)u.promotedBytes,
+					u.localBytes ? (100.0 * copiesLeft / u.localBytes) : 0.0);
+		}
+	}
+
+	if (verboseFlag && promoteLocalsFlag) {
+		unsigned numPromoted = 0;
+		for (auto & entry : usage) {
+			numPromoted += entry.second.promoted;
+		}
+		errs() << info_string << " promoted " << numPromoted << " locals and their copies to registers\n";
+	}
+}
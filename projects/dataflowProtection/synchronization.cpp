@@ -11,6 +11,8 @@
 #include <llvm/IR/Dominators.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
 
 using namespace llvm;
 
@@ -42,10 +44,7 @@ std::string gep_cmp_name = "gcmp";
 std::string call_cmp_name = "ccmp";
 std::string store_cmp_name = "scmp";
 std::string terminator_cmp_name = "tcmp";
-
-// dynamically count the number of times we synchronize
-std::string dynCountName = "__SYNC_COUNT";
-GlobalVariable* dynamicSyncCount = nullptr;
+std::string signature_name = "sig";
 
 /* commonly used comparison predicates
  * The "ordered" type of comparisons ensure that, if the operand is a vector type,
@@ -87,6 +86,18 @@ CmpInst::Predicate getComparisonPredicate(Type* opType) {
 	}
 }
 
+/*
+ * Values that fit in the 64-bit signature.  Pointers are different in each copy.
+ */
+static bool canFoldSignature(Type* opType) {
+	if (opType->isPtrOrPtrVectorTy())
+		return false;
+	if (!opType->isIntOrIntVectorTy() && !opType->isFPOrFPVectorTy())
+		return false;
+	unsigned bits = opType->getPrimitiveSizeInBits();
+	return (bits > 0) && (bits <= 64);
+}
+
 
 //----------------------------------------------------------------------------//
 // Obtain synchronization points
@@ -98,27 +109,9 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 	#endif
 
 	/*
-	 * Create counter that will count the number of times a syncpoint is reached
+	 * Create counters that will count the number of times each syncpoint is reached
 	 */
-	if (countSyncsFlag) {
-		dynamicSyncCount = M.getGlobalVariable(dynCountName);
-		if (!dynamicSyncCount) {
-			dynamicSyncCount = cast<GlobalVariable>(M.getOrInsertGlobal(dynCountName,
-																	IntegerType::getInt64Ty(M.getContext())));
-			// if there is no main in this module, keep this global as extern
-			if (noMainFlag) {
-				dynamicSyncCount->setExternallyInitialized(true);
-				dynamicSyncCount->setLinkage(GlobalValue::LinkageTypes::ExternalLinkage);
-			} else {
-				// otherwise, will be initialized to 0
-				dynamicSyncCount->setConstant(false);
-				dynamicSyncCount->setInitializer(ConstantInt::getNullValue(IntegerType::getInt64Ty(M.getContext())));
-				dynamicSyncCount->setUnnamedAddr( GlobalValue::UnnamedAddr() );
-				dynamicSyncCount->setAlignment(8);
-			}
-			globalsToSkip.insert(dynamicSyncCount);
-		}
-	}
+	createSyncCounts(M);
 
 	// delay printing error messages
 	std::set<CallInst*> skippedIndirectCalls;
@@ -134,6 +127,8 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 		}
 		#endif
 
+		SyncLevel level = getSyncLevel(F);
+
 		for (auto & bb : *F) {
 			#ifdef DBG_POP_SYNC_PTS
 			if (debugFlag)
@@ -142,6 +137,10 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 
 			for (auto & I : bb) {
 
+				// left out at a lower -syncLevel
+				if (!keepsSyncPoint(&I, level))
+					continue;
+
 				// Sync before branches
 				if (I.isTerminator()) {
 					// skip syncing on unreachable instructions
@@ -177,6 +176,11 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 						}
 					}
 
+					// functions that can't change memory are treated like any other instruction
+					if (pureCallFns.find(calledF) != pureCallFns.end()) {
+						continue;
+					}
+
 					// skip functions that are marked as "wrapper" functions
 					//  see updateFnWrappers()
 					if (wrapperInsts.find(CI) != wrapperInsts.end()) {
@@ -188,6 +192,14 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 						syncPoints.push_back(&I);
 //						errs() << "Adding " << CI->getCalledFunction()->getName() << " to syncpoints\n";
 					}
+					// also sync before calls to functions protected at a different level
+					else if (crossLevelFns.find(calledF) != crossLevelFns.end()) {
+						syncPoints.push_back(&I);
+					}
+					// and before calls that take a voted value instead of the copies
+					else if (votedArgNums.find(calledF) != votedArgNums.end()) {
+						syncPoints.push_back(&I);
+					}
 					#ifdef DBG_POP_SYNC_PTS
 					if (debugFlag)
 						PRINT_VALUE(&I);
@@ -263,7 +275,7 @@ void dataflowProtection::populateSyncPoints(Module& M) {
 // Insert synchronization logic
 //----------------------------------------------------------------------------//
 void dataflowProtection::processSyncPoints(Module & M, int numClones) {
-	if (syncPoints.size() == 0)
+	if ( (syncPoints.size() == 0) && (regionInsts.size() == 0) )
 		return;
 
 	GlobalVariable* TMRErrorDetected = M.getGlobalVariable(tmr_global_count_name);
@@ -389,6 +401,12 @@ void dataflowProtection::processSyncPoints(Module & M, int numClones) {
 
 	}
 
+	// values leaving xMR regions
+	syncRegionExits(TMRErrorDetected);
+
+	// compare the signatures folded in above
+	insertSignatureChecks();
+
 	// delete the now-invalid pointers
 	for (auto it : deleteItLater) {
 		syncPoints.erase(std::find(syncPoints.begin(), syncPoints.end(), it));
@@ -509,6 +527,16 @@ void dataflowProtection::syncStoreInst(StoreInst* currStoreInst, GlobalVariable*
 	Instruction::OtherOps cmp_op = getComparisonType(opType);
 	CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
 
+	if (dwcSignature && canFoldSignature(opType)) {
+		Instruction* foldStart = foldSignature(orig, clone1, currStoreInst);
+		startOfSyncLogic[currStoreInst] = foldStart ? foldStart : currStoreInst;
+		// memory with only one copy can't wait for the next check
+		if (forceFlag || noMemReplicationFlag) {
+			signatureChecks[currStoreInst->getFunction()].push_back(currStoreInst);
+		}
+		return;
+	}
+
 	Instruction* cmp = CmpInst::Create(cmp_op, cmp_eq, orig, clone1, store_cmp_name, currStoreInst);
 	cmp->removeFromParent();
 	cmp->insertBefore(currStoreInst);
@@ -577,11 +605,21 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 		argVals.push_back(dyn_cast<Value>(arg));
 	}
 
+	// the signature has to be checked before anything leaves the copies
+	if (dwcSignature) {
+		signatureChecks[enclosingFunction].push_back(currCallInst);
+	}
+
+	// calls to protected functions only vote on the arguments that aren't passed as copies
+	auto votedIt = votedArgNums.find(currCallInst->getCalledFunction());
+
 	std::deque<Value*> cloneableOperandsList;
 	for (unsigned int it = 0; it < currCallInst->getNumArgOperands(); it++) {
 		if (isa<Constant>(currCallInst->getArgOperand(it))
 				|| isa<GetElementPtrInst>(currCallInst->getArgOperand(it)))
 			continue;
+		if ( (votedIt != votedArgNums.end()) && (votedIt->second.find(it) == votedIt->second.end()) )
+			continue;
 		if (isa<PointerType>(currCallInst->getArgOperand(it)->getType()))
 			continue;
 		cloneableOperandsList.push_back(currCallInst->getArgOperand(it));
@@ -591,6 +629,13 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 		return;
 	}
 
+	// fold the arguments into the signature instead, unless some of them don't fit
+	bool foldArgs = dwcSignature;
+	for (auto orig : cloneableOperandsList) {
+		if (isCloned(orig) && !orig->getType()->isArrayTy() && !canFoldSignature(orig->getType()))
+			foldArgs = false;
+	}
+
 	// We now have a list of (an unknown number of) operands, insert comparisons for all of them
 	std::deque<Value*> cmpInstList;
 	std::vector<Instruction*> syncHelperList;
@@ -611,6 +656,14 @@ void dataflowProtection::processCallSync(CallInst* currCallInst, GlobalVariable*
 		if (opType->isArrayTy()) {
 			continue;
 		}
+		if (foldArgs) {
+			Instruction* foldStart = foldSignature(orig, clones.first, currCallInst);
+			if (firstIteration && foldStart) {
+				startOfSyncLogic[currCallInst] = foldStart;
+				firstIteration = false;
+			}
+			continue;
+		}
 		// Make sure we're inserting the right type of comparison
 		Instruction::OtherOps cmp_op = getComparisonType(opType);
 		CmpInst::Predicate cmp_eq = getComparisonPredicate(opType);
@@ -971,6 +1024,14 @@ void dataflowProtection::syncTerminator(TerminatorInst* currTerminator, GlobalVa
 			return;
 		}
 
+		// fold it into the signature, which is checked at the next call, return, or loop exit
+		if (dwcSignature && canFoldSignature(opType) && (isa<BranchInst>(currTerminator) ||
+				isa<SwitchInst>(currTerminator) || isa<ReturnInst>(currTerminator))) {
+			Instruction* foldStart = foldSignature(currTerminator->getOperand(0), clone, currTerminator);
+			startOfSyncLogic[currTerminator] = foldStart ? foldStart : currTerminator;
+			return;
+		}
+
 		if (opType->isFPOrFPVectorTy()) {
 			cmp_op = fpCmpType;
 			cmp_eq = fpCmpEqual;
@@ -1192,6 +1253,125 @@ Instruction* dataflowProtection::splitBlocks(Instruction* I, BasicBlock* errBloc
 }
 
 
+//----------------------------------------------------------------------------//
+// DWC signatures
+//----------------------------------------------------------------------------//
+/*
+ * Instead of comparing the copies at each sync point with -dwcSignature, the bits
+ *  where they differ are ORed into a running signature for the function.  It stays
+ *  0 as long as the copies agree, and can't be cancelled out by a second difference.
+ * Returns the first instruction inserted, or nullptr if there was nothing to fold.
+ */
+Instruction* dataflowProtection::foldSignature(Value* orig, Value* clone, Instruction* insertBefore) {
+	Function* F = insertBefore->getFunction();
+	Type* accTy = Type::getInt64Ty(F->getContext());
+
+	// one signature for each function, it goes in a register later
+	AllocaInst*& acc = signatureAccs[F];
+	if (!acc) {
+		IRBuilder<> entryBuilder(&*F->getEntryBlock().getFirstInsertionPt());
+		acc = entryBuilder.CreateAlloca(accTy, nullptr, signature_name + ".acc");
+		entryBuilder.CreateStore(ConstantInt::get(accTy, 0), acc);
+	}
+
+	Instruction* prev = insertBefore->getPrevNode();
+	IRBuilder<> builder(insertBefore);
+	Type* intTy = builder.getIntNTy(orig->getType()->getPrimitiveSizeInBits());
+	Value* diff = builder.CreateXor(builder.CreateBitCast(orig, intTy),
+			builder.CreateBitCast(clone, intTy), signature_name + ".diff");
+	// both constants
+	if (isa<Constant>(diff))
+		return nullptr;
+
+	diff = builder.CreateZExt(diff, accTy);
+	builder.CreateStore(builder.CreateOr(builder.CreateLoad(acc), diff, signature_name), acc);
+
+	return prev ? prev->getNextNode() : &insertBefore->getParent()->front();
+}
+
+
+/*
+ * Branch to the error block if the signature isn't 0 when I is reached.
+ */
+void dataflowProtection::insertSignatureCheck(Instruction* I) {
+	Function* F = I->getFunction();
+
+	// values folded in right before I have to stay after their clones when segmenting
+	Instruction* foldStart = nullptr;
+	bool hasLogic = (startOfSyncLogic.find(I) != startOfSyncLogic.end());
+	if (hasLogic && (startOfSyncLogic[I] != I) && (startOfSyncLogic[I]->getParent() == I->getParent()))
+		foldStart = startOfSyncLogic[I];
+
+	LoadInst* sig = new LoadInst(signatureAccs[F], signature_name, I);
+	Instruction* cmp = CmpInst::Create(intCmpType, intCmpEqual, sig,
+			ConstantInt::get(sig->getType(), 0), signature_name + ".cmp", I);
+	Instruction* newCmp = splitBlocks(cmp, errBlockMap[F]);
+
+	// see note in processCallSync()
+	if (hasLogic)
+		startOfSyncLogic[I] = I;
+	if (foldStart) {
+		Instruction* newTerm = newCmp->getParent()->getTerminator();
+		newSyncPoints.push_back(newTerm);
+		startOfSyncLogic[newTerm] = foldStart;
+	}
+}
+
+
+/*
+ * Check the signature of each function before the calls and stores found while
+ *  syncing, and before it returns or leaves a loop.  Then the signature is
+ *  moved into a register.
+ */
+void dataflowProtection::insertSignatureChecks() {
+	unsigned numChecks = 0;
+
+	for (auto accPair : signatureAccs) {
+		Function* F = accPair.first;
+		AllocaInst* acc = accPair.second;
+		std::vector<Instruction*> checkPoints = signatureChecks[F];
+
+		for (auto & bb : *F) {
+			TerminatorInst* TI = bb.getTerminator();
+			if (isa<ReturnInst>(TI) || isa<ResumeInst>(TI))
+				checkPoints.push_back(TI);
+		}
+
+		// only the outermost loops, so the inner ones don't add a check to each iteration
+		DominatorTree DT(*F);
+		LoopInfo LI(DT);
+		for (auto L : LI) {
+			SmallVector<BasicBlock*, 8> exitBlocks;
+			L->getUniqueExitBlocks(exitBlocks);
+			for (auto exitBB : exitBlocks) {
+				if (exitBB->isEHPad() || (exitBB == errBlockMap[F]))
+					continue;
+				checkPoints.push_back(&*exitBB->getFirstInsertionPt());
+			}
+		}
+
+		std::set<Instruction*> checked;
+		for (auto I : checkPoints) {
+			if (!checked.insert(I).second)
+				continue;
+			insertSignatureCheck(I);
+			numChecks++;
+		}
+
+		if (isAllocaPromotable(acc)) {
+			DominatorTree newDT(*F);
+			std::vector<AllocaInst*> toPromote = {acc};
+			PromoteMemToReg(toPromote, newDT);
+		}
+	}
+
+	if (verboseFlag && !signatureAccs.empty()) {
+		errs() << info_string << " checking signatures of " << signatureAccs.size()
+			   << " functions at " << numChecks << " places\n";
+	}
+}
+
+
 //----------------------------------------------------------------------------//
 // DWC error handling function/blocks
 //----------------------------------------------------------------------------//
@@ -1204,9 +1384,9 @@ void dataflowProtection::insertErrorFunction(Module &M, int numClones) {
 	 * 3) it does not exist
 	 */
 
-	// Will be created if either 1) DWC or 2) Stack Protection
+	// Will be created if either 1) DWC or 2) Stack Protection or 3) checksummed constants or shadow memory
 	Constant* c;
-	if ( (numClones == 2) || (protectStackFlag) ) {
+	if ( (numClones == 2) || (protectStackFlag) || (checksumGlobals.size() > 0) || (shadowObjects.size() > 0) ) {
 		c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
 	} else {
 		return;
@@ -1271,9 +1451,9 @@ void dataflowProtection::createErrorBlocks(Module &M, int numClones) {
 	Type* t_void = Type::getVoidTy(M.getContext());
 
 	// Create an error handler block for each function - they can't share one
-	// Will be created if either 1) DWC or 2) Stack Protection
+	// Will be created if either 1) DWC or 2) Stack Protection or 3) checksummed constants or shadow memory
 	Constant* c;
-	if ( (numClones == 2) || (protectStackFlag) ) {
+	if ( (numClones == 2) || (protectStackFlag) || (checksumGlobals.size() > 0) || (shadowObjects.size() > 0) ) {
 		c = M.getOrInsertFunction(fault_function_name, t_void, NULL);
 	} else {
 		return;
@@ -1390,6 +1570,13 @@ void dataflowProtection::insertTMRCorrectionCount(Instruction* cmpInst, GlobalVa
 	// compare the original with the 2nd clone
 	Instruction* cmpInst2 = CmpInst::Create(cmp_op, cmp_eq, orig, clone2, "cmp", nextInst);
 
+	// the same ID is used for the sync count, the correction log, and the site table
+	unsigned siteId = 0;
+	if (countSyncsFlag || correctionLog)
+		siteId = addSyncSite(cmpInst);
+	if (countSyncsFlag)
+		insertSyncCount(cmpInst, siteId);
+
 	/* Trying to add support to detecting errors in vector types */
 	if (cmpInst->getType()->isVectorTy()) {
 		insertVectorTMRCorrectionCount(cmpInst, cmpInst2, TMRErrorDetected);
@@ -1412,23 +1599,18 @@ void dataflowProtection::insertTMRCorrectionCount(Instruction* cmpInst, GlobalVa
 			"errorHandler." + Twine(originalBlock->getParent()->getName()),
 			originalBlock->getParent(), originalBlock);
 
-	if (countSyncsFlag) {
-		/*
-		 * Increment global sync counter
-		 */
-		// Populate new block -- load global counter, increment, store
-		LoadInst* loadSyncCounter = new LoadInst(dynamicSyncCount, "ldSyncCnt", cmpInst);
-		Constant* one = ConstantInt::get(loadSyncCounter->getType(), 1, false);
-		BinaryOperator* incSyncCounter = BinaryOperator::CreateAdd(
-										loadSyncCounter, one, "incSyncCnt", cmpInst);
-		StoreInst* SI = new StoreInst(incSyncCounter, dynamicSyncCount, cmpInst);
-	}
-
 	// Populate new block -- load global counter, increment, store
-	LoadInst* LI = new LoadInst(TMRErrorDetected, "errFlagLoad", errBlock);
-	Constant* one = ConstantInt::get(LI->getType(), 1, false);
-	BinaryOperator* BI = BinaryOperator::CreateAdd(LI, one, "errFlagAdd", errBlock);
-	StoreInst* SI = new StoreInst(BI, TMRErrorDetected, errBlock);
+	if (correctionLog) {
+		// it can be counted from more than one task at a time
+		Constant* one = ConstantInt::get(TMRErrorDetected->getValueType(), 1, false);
+		new AtomicRMWInst(AtomicRMWInst::Add, TMRErrorDetected, one,
+				AtomicOrdering::Monotonic, SyncScope::System, errBlock);
+	} else {
+		LoadInst* LI = new LoadInst(TMRErrorDetected, "errFlagLoad", errBlock);
+		Constant* one = ConstantInt::get(LI->getType(), 1, false);
+		BinaryOperator* BI = BinaryOperator::CreateAdd(LI, one, "errFlagAdd", errBlock);
+		StoreInst* SI = new StoreInst(BI, TMRErrorDetected, errBlock);
+	}
 
 	// Split blocks, deal with terminators
 	const Twine& name = originalBlock->getParent()->getName() + ".cont";
@@ -1442,6 +1624,13 @@ void dataflowProtection::insertTMRCorrectionCount(Instruction* cmpInst, GlobalVa
 	// add a branch instruction to the error block to unconditionally go to the continue block
 	BranchInst* returnToBB = BranchInst::Create(originalBlockContinued, errBlock);
 	errBlock->moveAfter(originalBlock);
+	insertCorrectionLog(cmpInst, cmpInst2, errBlock, siteId);
+
+	// corrections are rare, so keep the counting out of the way of the rest of the code
+	if (correctionLog) {
+		MDBuilder MDB(originalBlock->getContext());
+		condGoToErrBlock->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(2000, 1));
+	}
 
 	// if terminator for originalBlock was a sync point, be sure to mark the new terminator as such as well
 	if (updateSyncPoint) {
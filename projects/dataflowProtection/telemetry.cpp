@@ -0,0 +1,245 @@
+/*
+ * telemetry.cpp
+ *
+ * This file contains the logic for logging where TMR corrected a fault.
+ * Each sync point that votes is given an ID, and the table written to
+ *  -siteTable maps each ID to the function and source location it came from.
+ * With -correctionLog, the block that counts a correction also calls
+ *  __COAST_LOG_CORRECTION() with the ID of the sync point and which copy was
+ *  different.  That block is only run when the copies don't match, so the code
+ *  doesn't do any more work when there aren't any faults.  The ring buffer and
+ *  the per-task counts are in COAST_telemetry.h.
+ * With -countSyncs, each sync point adds to its own entry of an array, indexed
+ *  by the same IDs.  The array can only be sized once every sync point has been
+ *  inserted, so the counters point into a placeholder until then.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <fstream>
+#include <string>
+#include <vector>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/MDBuilder.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<bool> countSyncsFlag;
+extern cl::opt<unsigned> syncSampleRate;
+extern cl::opt<std::string> siteTableFile;
+extern cl::opt<bool> verboseFlag;
+
+// the same IDs are used by every instance of the pass, so they don't overlap
+struct SyncSite {
+	std::string function;
+	DebugLoc loc;
+};
+static std::vector<SyncSite> syncSites;
+
+
+/*
+ * Give the sync point that I is part of the next ID.
+ * The location is the first one found from I to the end of its block, since the
+ *  logic COAST adds doesn't have one, but the sync point after it does.
+ */
+unsigned dataflowProtection::addSyncSite(Instruction* I) {
+	SyncSite site;
+	site.function = I->getFunction()->getName().str();
+	for (Instruction* next = I; next; next = next->getNextNode()) {
+		if (next->getDebugLoc()) {
+			site.loc = next->getDebugLoc();
+			break;
+		}
+	}
+
+	syncSites.push_back(site);
+	return syncSites.size() - 1;
+}
+
+
+/*
+ * Call the logging function from the block that counts a correction.
+ * The syndrome has a bit for each copy that didn't match the original:
+ *  1 means the first copy was wrong, 2 the second, and 3 the original.
+ */
+void dataflowProtection::insertCorrectionLog(Instruction* cmpInst, Instruction* cmpInst2, BasicBlock* errBlock, unsigned id) {
+	if (!correctionLog)
+		return;
+
+	Module* M = errBlock->getModule();
+	LLVMContext& C = M->getContext();
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	Constant* logFn = M->getOrInsertFunction(log_correction_fn_name,
+			FunctionType::get(Type::getVoidTy(C), {i32Ty, i32Ty}, false));
+
+	IRBuilder<> builder(errBlock->getTerminator());
+	Value* firstBad = builder.CreateZExt(builder.CreateNot(cmpInst), i32Ty);
+	Value* secondBad = builder.CreateZExt(builder.CreateNot(cmpInst2), i32Ty);
+	Value* syndrome = builder.CreateOr(firstBad, builder.CreateShl(secondBad, 1), "syndrome");
+	CallInst* logCall = builder.CreateCall(logFn, {ConstantInt::get(i32Ty, id), syndrome});
+
+	// the call needs a location if the function it's in has debug info
+	DebugLoc loc = syncSites[id].loc;
+	Function* F = errBlock->getParent();
+	if (!loc && F->getSubprogram())
+		loc = DebugLoc::get(F->getSubprogram()->getLine(), 0, F->getSubprogram());
+	logCall->setDebugLoc(loc);
+}
+
+
+/*
+ * Make the placeholder for the counts, and the counter used for sampling.
+ * If the program already declared the counts (COAST_telemetry.h does), that
+ *  declaration is used instead.
+ */
+void dataflowProtection::createSyncCounts(Module& M) {
+	if (!countSyncsFlag)
+		return;
+
+	LLVMContext& C = M.getContext();
+	GlobalVariable* counts = M.getGlobalVariable(sync_counts_name);
+	if (!counts) {
+		counts = new GlobalVariable(M, ArrayType::get(Type::getInt64Ty(C), 0), false,
+				GlobalValue::ExternalLinkage, nullptr, sync_counts_name);
+	} else if (!counts->isDeclaration()) {
+		errs() << err_string << " '" << sync_counts_name << "' is filled in by COAST, it can't be defined\n";
+		exit(-1);
+	}
+	globalsToSkip.insert(counts);
+
+	if ( (syncSampleRate > 1) && !M.getGlobalVariable(sync_tick_name) ) {
+		IntegerType* i32Ty = Type::getInt32Ty(C);
+		GlobalVariable* tick = new GlobalVariable(M, i32Ty, false,
+				GlobalValue::InternalLinkage, ConstantInt::get(i32Ty, 0), sync_tick_name);
+		globalsToSkip.insert(tick);
+	}
+}
+
+
+/*
+ * Count each time the sync point with this ID is reached, right before insertBefore.
+ * With -syncSampleRate=N, only every Nth sync point reached is counted, and it
+ *  adds N, so the counts are still close to the totals.  The rest of the time it
+ *  only takes one counter, which stays in the cache, and a branch that is
+ *  almost never taken.
+ */
+void dataflowProtection::insertSyncCount(Instruction* insertBefore, unsigned id) {
+	Module* M = insertBefore->getModule();
+	LLVMContext& C = M->getContext();
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	IntegerType* i64Ty = Type::getInt64Ty(C);
+
+	GlobalVariable* counts = M->getGlobalVariable(sync_counts_name);
+	assert(counts && "placeholder for the sync counts");
+	Constant* indices[] = {ConstantInt::get(i32Ty, 0), ConstantInt::get(i32Ty, id)};
+	Constant* counter = ConstantExpr::getGetElementPtr(counts->getValueType(), counts, indices);
+
+	Instruction* countBefore = insertBefore;
+	if (syncSampleRate > 1) {
+		GlobalVariable* tick = M->getGlobalVariable(sync_tick_name);
+		LoadInst* loadTick = new LoadInst(tick, "ldSyncTick", insertBefore);
+		BinaryOperator* incTick = BinaryOperator::CreateAdd(
+				loadTick, ConstantInt::get(i32Ty, 1), "incSyncTick", insertBefore);
+		new StoreInst(incTick, tick, insertBefore);
+		BinaryOperator* sample = BinaryOperator::CreateAnd(
+				incTick, ConstantInt::get(i32Ty, syncSampleRate - 1), "syncSample", insertBefore);
+		ICmpInst* takeSample = new ICmpInst(insertBefore, ICmpInst::ICMP_EQ,
+				sample, ConstantInt::get(i32Ty, 0), "takeSample");
+
+		// the sync point goes on in a new block, like the blocks that count errors
+		BasicBlock* thisBlock = insertBefore->getParent();
+		BasicBlock* restBlock = thisBlock->splitBasicBlock(insertBefore, thisBlock->getName() + ".sampled");
+		BasicBlock* sampleBlock = BasicBlock::Create(C,
+				"syncSample." + Twine(thisBlock->getParent()->getName()),
+				thisBlock->getParent(), restBlock);
+		thisBlock->getTerminator()->eraseFromParent();
+		BranchInst* condGoToSample = BranchInst::Create(sampleBlock, restBlock, takeSample, thisBlock);
+		MDBuilder MDB(C);
+		condGoToSample->setMetadata(LLVMContext::MD_prof,
+				MDB.createBranchWeights(1, syncSampleRate - 1));
+		countBefore = BranchInst::Create(restBlock, sampleBlock);
+	}
+
+	LoadInst* loadCount = new LoadInst(counter, "ldSyncCnt", countBefore);
+	BinaryOperator* incCount = BinaryOperator::CreateAdd(
+			loadCount, ConstantInt::get(i64Ty, syncSampleRate), "incSyncCnt", countBefore);
+	new StoreInst(incCount, counter, countBefore);
+}
+
+
+/*
+ * Now that every sync point has an ID, replace the placeholder with an array
+ *  of counts that is big enough for them, and say how big it is.
+ */
+void dataflowProtection::finishSyncCounts(Module& M) {
+	GlobalVariable* placeholder = M.getGlobalVariable(sync_counts_name);
+	if (!countSyncsFlag || !placeholder)
+		return;
+
+	LLVMContext& C = M.getContext();
+	IntegerType* i32Ty = Type::getInt32Ty(C);
+	ArrayType* countsTy = ArrayType::get(Type::getInt64Ty(C), syncSites.size());
+	GlobalVariable* counts = new GlobalVariable(M, countsTy, false,
+			GlobalValue::ExternalLinkage, ConstantAggregateZero::get(countsTy), "", placeholder);
+	counts->setAlignment(8);
+	placeholder->replaceAllUsesWith(ConstantExpr::getBitCast(counts, placeholder->getType()));
+	counts->takeName(placeholder);
+	placeholder->eraseFromParent();
+
+	// the program might have declared this one too
+	GlobalVariable* numSites = new GlobalVariable(M, i32Ty, true,
+			GlobalValue::ExternalLinkage, ConstantInt::get(i32Ty, syncSites.size()));
+	if (GlobalVariable* decl = M.getGlobalVariable(sync_sites_name)) {
+		decl->replaceAllUsesWith(ConstantExpr::getBitCast(numSites, decl->getType()));
+		numSites->takeName(decl);
+		decl->eraseFromParent();
+	} else {
+		numSites->setName(sync_sites_name);
+	}
+
+	if (verboseFlag) {
+		errs() << info_string << " counting " << syncSites.size() << " sync points in '"
+			   << sync_counts_name << "'\n";
+	}
+}
+
+
+/*
+ * Write the table of sync point IDs, as comma separated values.
+ */
+void dataflowProtection::writeSiteTable(void) {
+	if (syncSites.empty())
+		return;
+
+	std::ofstream ofs(siteTableFile, std::ofstream::out);
+	if (!ofs.is_open()) {
+		errs() << err_string << " could not write the sync point table to '" << siteTableFile << "'\n";
+		return;
+	}
+
+	ofs << "id,function,file,line,column\n";
+	for (unsigned id = 0; id < syncSites.size(); id++) {
+		SyncSite& site = syncSites[id];
+		ofs << id << "," << site.function << ",";
+		if (DILocation* loc = site.loc.get()) {
+			ofs << loc->getFilename().str() << "," << loc->getLine() << "," << loc->getColumn() << "\n";
+		} else {
+			ofs << ",0,0\n";
+		}
+	}
+
+	ofs.close();
+	if (verboseFlag) {
+		errs() << info_string << " wrote the locations of " << syncSites.size()
+			   << " sync points to '" << siteTableFile << "'\n";
+	}
+}
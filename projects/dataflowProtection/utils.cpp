@@ -362,6 +362,24 @@ void dataflowProtection::checkForUnusedClones(Module & M) {
 	}
 }
 
+/*
+ * Don't leave anything in the clone map that no longer exists.
+ * Any entry where the original or one of its copies is in `removed` is taken out.
+ */
+void dataflowProtection::removeFromCloneMap(std::set<Value*> &removed) {
+	if (removed.empty())
+		return;
+	for (auto it = cloneMap.begin(); it != cloneMap.end(); ) {
+		if ( (removed.find(it->first) != removed.end()) ||
+				(removed.find(it->second.first) != removed.end()) ||
+				(TMR && removed.find(it->second.second) != removed.end()) ) {
+			it = cloneMap.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
 
 //----------------------------------------------------------------------------//
 // Synchronization utilities
@@ -626,6 +644,41 @@ void dataflowProtection::recursivelyVisitCalls(Module& M, Function* F, std::set<
 
 }
 
+/*
+ * Build a table with an entry { original, copies..., size in bytes } for each global,
+ *  which the run-time functions walk through.  Each entry in `globals` is the original
+ *  followed by its copies.
+ */
+GlobalVariable* dataflowProtection::createReplicaTable(Module& M,
+		std::vector<std::vector<GlobalVariable*> > &globals, std::string name) {
+	LLVMContext& C = M.getContext();
+	const DataLayout& DL = M.getDataLayout();
+	Type* intPtrTy = DL.getIntPtrType(C);
+	Type* bytePtrTy = Type::getInt8PtrTy(C);
+	unsigned wordSize = DL.getTypeAllocSize(intPtrTy);
+
+	std::vector<Type*> fieldTypes(globals.front().size(), bytePtrTy);
+	fieldTypes.push_back(intPtrTy);
+	StructType* entryTy = StructType::get(C, fieldTypes);
+
+	std::vector<Constant*> entries;
+	for (auto & copies : globals) {
+		std::vector<Constant*> fields;
+		for (auto copy : copies) {
+			// whole words can be accessed if everything is aligned to them
+			if (copy->getAlignment() < wordSize)
+				copy->setAlignment(wordSize);
+			fields.push_back(ConstantExpr::getBitCast(copy, bytePtrTy));
+		}
+		fields.push_back(ConstantInt::get(intPtrTy, DL.getTypeAllocSize(copies[0]->getValueType())));
+		entries.push_back(ConstantStruct::get(entryTy, fields));
+	}
+
+	ArrayType* tableTy = ArrayType::get(entryTy, entries.size());
+	return new GlobalVariable(M, tableTy, true, GlobalValue::InternalLinkage,
+			ConstantArray::get(tableTy, entries), name);
+}
+
 
 //----------------------------------------------------------------------------//
 // Miscellaneous
@@ -927,3 +980,46 @@ void dataflowProtection::dumpModule(Module& M) {
 	}
 	errs() << "\n";
 }
+
+// each level of loop nesting is assumed to run this many more times than its parent
+static const double loopTripEstimate = 8.0;
+// don't let deep loop nests swamp everything else
+static const unsigned maxLoopDepth = 4;
+
+/*
+ * How many times a block at this loop depth is assumed to run each time its
+ *  function is called, without any profile counts.
+ */
+double dataflowProtection::getLoopWeight(unsigned loopDepth) {
+	unsigned depth = std::min(loopDepth, maxLoopDepth);
+	double weight = 1.0;
+	for (unsigned i = 0; i < depth; i++)
+		weight *= loopTripEstimate;
+	return weight;
+}
+
+/*
+ * Check that the function is only ever called directly, so every call to it can be
+ *  found and changed.  Casts that are only used by global annotations are allowed.
+ */
+bool dataflowProtection::onlyDirectCalls(Function* F) {
+	for (auto U : F->users()) {
+		if (CallInst* CI = dyn_cast<CallInst>(U)) {
+			if (CI->getCalledFunction() != F)
+				return false;
+		} else if (InvokeInst* II = dyn_cast<InvokeInst>(U)) {
+			if (II->getCalledFunction() != F)
+				return false;
+		} else if (ConstantExpr* CE = dyn_cast<ConstantExpr>(U)) {
+			if (!CE->isCast())
+				return false;
+			for (auto castUser : CE->users()) {
+				if (isa<Instruction>(castUser))
+					return false;
+			}
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
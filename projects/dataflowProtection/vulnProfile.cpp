@@ -0,0 +1,136 @@
+/*
+ * vulnProfile.cpp
+ *
+ * This file contains the logic for using the results of a fault injection
+ *  campaign to decide which instructions are worth protecting.
+ * The profile is made by simulation/platform/jsonParser.py (--vuln-profile),
+ *  which maps each injection back to a source line through the debug info.
+ * Instructions on lines where every fault injected was masked are not cloned,
+ *  which also removes the synchronization logic that would check them.
+ */
+
+#include "dataflowProtection.h"
+
+// standard library includes
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// LLVM includes
+#include <llvm/IR/Module.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include "llvm/Support/CommandLine.h"
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+
+// Command line options
+extern cl::opt<std::string> vulnProfileFile;
+extern cl::opt<unsigned> vulnMinInjections;
+extern cl::opt<bool> verboseFlag;
+
+
+// outcomes of the injections at a single source line
+struct VulnRecord {
+	unsigned masked = 0;
+	unsigned sdc = 0;
+	unsigned crash = 0;
+	unsigned detected = 0;
+};
+
+
+/*
+ * Read the profile file.  Each line looks like
+ *   file.c:42 masked sdc crash detected
+ * Lines that start with a hash (#) are ignored.
+ * Returns false if the file can't be opened.
+ */
+static bool readVulnProfile(std::string fname, std::map<std::string, VulnRecord> &profile) {
+	std::ifstream ifs(fname);
+	if (!ifs.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(ifs, line)) {
+		if (line.size() == 0 || line[0] == '#')
+			continue;
+
+		std::istringstream iss(line);
+		std::string loc;
+		VulnRecord rec;
+		if (!(iss >> loc >> rec.masked >> rec.sdc >> rec.crash >> rec.detected))
+			continue;
+
+		// only the file name is kept, the paths from the debug info may not match
+		size_t colon = loc.rfind(':');
+		if (colon == std::string::npos)
+			continue;
+		std::string key = sys::path::filename(loc.substr(0, colon)).str() + loc.substr(colon);
+
+		VulnRecord& entry = profile[key];
+		entry.masked += rec.masked;
+		entry.sdc += rec.sdc;
+		entry.crash += rec.crash;
+		entry.detected += rec.detected;
+	}
+	return true;
+}
+
+
+/*
+ * Don't clone instructions whose faults were always masked in the campaign.
+ * Stores, calls, terminators, and anything that makes a pointer are left alone,
+ *  because skipping them would leave the copies of memory or control flow out of sync.
+ * Must be called after cloneFunctionArguments() so the pointers aren't stale.
+ */
+void dataflowProtection::applyVulnProfile(Module& M) {
+	if (vulnProfileFile.empty())
+		return;
+
+	std::map<std::string, VulnRecord> profile;
+	if (!readVulnProfile(vulnProfileFile, profile)) {
+		errs() << err_string << " could not open vulnerability profile '" << vulnProfileFile << "'\n";
+		std::exit(-1);
+	}
+
+	unsigned skippedInsts = 0;
+	std::set<std::string> usedLines;
+	for (auto F : fnsToClone) {
+		for (auto & I : instructions(F)) {
+			if (isa<StoreInst>(&I) || isa<CallInst>(&I) || isa<InvokeInst>(&I) ||
+					isa<TerminatorInst>(&I) || I.getType()->isPtrOrPtrVectorTy())
+				continue;
+
+			const DebugLoc& loc = I.getDebugLoc();
+			if (!loc)
+				continue;
+			DILocation* diLoc = loc.get();
+			std::string key = sys::path::filename(diLoc->getFilename()).str() + ":" +
+					std::to_string(diLoc->getLine());
+
+			auto found = profile.find(key);
+			if (found == profile.end())
+				continue;
+			VulnRecord& rec = found->second;
+			if (rec.masked < vulnMinInjections)
+				continue;
+			if (rec.sdc + rec.crash + rec.detected > 0)
+				continue;
+
+			instsToSkip.insert(&I);
+			usedLines.insert(key);
+			skippedInsts++;
+		}
+	}
+
+	if (verboseFlag) {
+		errs() << info_string << " vulnerability profile: not cloning " << skippedInsts
+			   << " instructions from " << usedLines.size() << " source lines\n";
+		for (auto key : usedLines) {
+			errs() << "    " << key << "\n";
+		}
+	}
+}
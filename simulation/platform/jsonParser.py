@@ -6,6 +6,7 @@ import os
 import sys
 import json
 import argparse
+import subprocess
 import statistics as stats
 from datetime import timedelta
 
@@ -92,10 +93,12 @@ def parseCommandLine():
 	parser.add_argument('--register-errors', '-r', action='store_true', help="Report how many injections into each register caused an error.")
 	parser.add_argument('--examine-error-addresses', type=str, metavar="BIN_PATH", help="Path to objdump appropriate for the target architecture.")
 	parser.add_argument('--symbol-injection-count', type=str, metavar="BIN_PATH", help="Path to objdump appropriate for the target architecture.")
+	parser.add_argument('--vuln-profile', type=str, metavar="OUTFILE", help="Write the outcome of the injections at each source line, for use with -vulnProfile")
+	parser.add_argument('--addr2line', type=str, metavar="BIN_PATH", help="Path to addr2line appropriate for the target architecture.", default="arm-none-eabi-addr2line")
 
 	args = parser.parse_args()
 	# validate the file paths
-	if not (args.compare_dirs or args.parse_dir or args.register_errors or args.examine_error_addresses or args.symbol_injection_count) \
+	if not (args.compare_dirs or args.parse_dir or args.register_errors or args.examine_error_addresses or args.symbol_injection_count or args.vuln_profile) \
 			and not os.path.isfile(os.path.realpath(args.filename)):
 		print("Error, file {} does not exist!".format(args.filename))
 		sys.exit(-1)
@@ -455,6 +458,88 @@ def examineSymbolInjections(d0, objPath=None):
 	return
 
 
+def classifyRun(run):
+	"""Returns which of masked, sdc, crash, or detected the run was, or None if it isn't valid"""
+	res = run.result
+	if isinstance(res, AssertionFailResult):
+		return "sdc"
+	elif isinstance(res, RunResult):
+		if res.errors > 0:
+			return "sdc"
+		elif res.faults > 0:
+			return "detected"
+		else:
+			return "masked"
+	elif isinstance(res, (TimeoutResult, AbortResult, StackOverflowResult)):
+		return "crash"
+	return None
+
+
+def writeVulnProfile(d0, outName, a2lPath):
+	"""Map each injection back to a source line, and write how many of each outcome there were
+	d0 - directory of log files
+	outName - file to write the profile to
+	a2lPath - path to addr2line binary
+	"""
+	sum0, runs = parseOneDir(d0, keepRuns=True)
+	outcomes = ["masked", "sdc", "crash", "detected"]
+
+	# the program counter when each fault was injected
+	pcRuns = {}
+	for run in runs:
+		kind = classifyRun(run)
+		if kind is None:
+			continue
+		try:
+			pc = int(str(run.pcVal).split()[0], 0)
+		except (ValueError, IndexError):
+			continue
+		if pc not in pcRuns:
+			pcRuns[pc] = []
+		pcRuns[pc].append(kind)
+
+	# look up all of the addresses at once
+	pcList = sorted(pcRuns)
+	cmd = [a2lPath, "-f", "-e", sum0.name] + ["0x{:x}".format(pc) for pc in pcList]
+	try:
+		a2lOut = subprocess.check_output(cmd, universal_newlines=True).splitlines()
+	except (OSError, subprocess.CalledProcessError) as e:
+		print("Error, could not run {}: {}".format(a2lPath, e))
+		sys.exit(-1)
+
+	# two lines per address, function name then file:line
+	lineMap = {}
+	fnMap = {}
+	for i, pc in enumerate(pcList):
+		fnName = a2lOut[2*i]
+		loc = a2lOut[2*i+1].split(" (discriminator")[0]
+		if loc.startswith("??") or loc.endswith(":?") or loc.endswith(":0"):
+			continue
+		if loc not in lineMap:
+			lineMap[loc] = dict.fromkeys(outcomes, 0)
+			fnMap[loc] = fnName
+		for kind in pcRuns[pc]:
+			lineMap[loc][kind] += 1
+
+	with open(outName, 'w') as f:
+		f.write("# vulnerability profile for {}\n".format(sum0.name))
+		f.write("# location masked sdc crash detected\n")
+		for loc in sorted(lineMap):
+			counts = lineMap[loc]
+			f.write("{} {}\n".format(loc, " ".join(str(counts[k]) for k in outcomes)))
+
+	# print out the lines that matter the most
+	print("Examining {}".format(d0))
+	print("  {} source lines, {} injections without a line".format(len(lineMap),
+			len(runs) - sum(sum(c.values()) for c in lineMap.values())))
+	for loc in sorted(lineMap, key=lambda l: lineMap[l]['sdc'] + lineMap[l]['crash'], reverse=True):
+		counts = lineMap[loc]
+		print("{} ({}), {}".format(loc, fnMap[loc],
+				", ".join("{}: {}".format(k, counts[k]) for k in outcomes)))
+	print("Profile written to {}".format(outName))
+	return
+
+
 def compareRuns(sum0, sum1):
 	# size comparison
 	sz0 = os.path.getsize(sum0.name)
@@ -581,6 +666,8 @@ def main():
 		examineErrorAddresses(args.filename, args.examine_error_addresses)
 	elif args.symbol_injection_count:
 		examineSymbolInjections(args.filename, args.symbol_injection_count)
+	elif args.vuln_profile:
+		writeVulnProfile(args.filename, args.vuln_profile, args.addr2line)
 	elif args.compare_dirs:
 		compareDirectories(args.filename, args.compare_dirs)
 	elif args.compare_files:
@@ -0,0 +1,118 @@
+#!/usr/bin/python3
+
+"""Matches the sync point counts from -countSyncs with their source locations.
+
+Run the program compiled with -countSyncs, and save what it prints after it
+calls COAST_DUMP_SYNC_COUNTS().  This reads the "COAST_SYNC,<id>,<count>" lines
+out of that, looks up each ID in the table written by -siteTable, and lists the
+sync points that were reached the most.
+"""
+
+import csv
+import sys
+import argparse
+
+
+class SyncSite(object):
+	"""One sync point, and how many times it was reached."""
+	def __init__(self, id, function, file, line, column):
+		self.id = id
+		self.function = function
+		self.file = file
+		self.line = line
+		self.column = column
+		self.count = 0
+
+	def location(self):
+		if not self.file:
+			return "?"
+		return "{}:{}:{}".format(self.file, self.line, self.column)
+
+
+def parseCommandLine():
+	parser = argparse.ArgumentParser(description="Match sync point counts from -countSyncs with their source locations")
+	parser.add_argument('logfile', type=str, nargs='+', help="output of the program, with the lines printed by COAST_DUMP_SYNC_COUNTS()")
+	parser.add_argument('--sites', '-s', type=str, default="coast.sites.csv", help="table written by -siteTable (default coast.sites.csv)")
+	parser.add_argument('--by', '-b', choices=['site', 'line', 'function'], default='site', help="add up the counts for each sync point, source line, or function")
+	parser.add_argument('--top', '-n', type=int, default=20, help="how many to list, 0 for all of them")
+	parser.add_argument('--csv', '-c', type=str, metavar="OUTFILE", help="also write all of them to a CSV file")
+	return parser.parse_args()
+
+
+def readSites(fileName):
+	sites = {}
+	with open(fileName, 'r') as f:
+		for row in csv.DictReader(f):
+			id = int(row['id'])
+			sites[id] = SyncSite(id, row['function'], row['file'], int(row['line']), int(row['column']))
+	return sites
+
+
+def readCounts(fileNames, sites):
+	"""Adds up the counts in each log, in case the program was run more than once."""
+	unknown = 0
+	for fileName in fileNames:
+		with open(fileName, 'r', errors='replace') as f:
+			for line in f:
+				# the line might have other output in front of it
+				start = line.find("COAST_SYNC,")
+				if start < 0:
+					continue
+				fields = line[start:].strip().split(',')
+				if len(fields) != 3:
+					continue
+				id, count = int(fields[1]), int(fields[2])
+				if id not in sites:
+					unknown += 1
+					continue
+				sites[id].count += count
+	if unknown:
+		print("Warning: {} counts are for IDs that aren't in the site table, was it from another build?".format(unknown), file=sys.stderr)
+
+
+def groupCounts(sites, by):
+	"""Returns a list of (name, location, count), the largest first."""
+	groups = {}
+	for site in sites.values():
+		if by == 'site':
+			key = (site.function, site.location() + " #{}".format(site.id))
+		elif by == 'line':
+			key = (site.function, "{}:{}".format(site.file, site.line) if site.file else "?")
+		else:
+			key = (site.function, site.file if site.file else "?")
+		groups[key] = groups.get(key, 0) + site.count
+	rows = [(k[0], k[1], c) for k, c in groups.items() if c > 0]
+	rows.sort(key=lambda r: r[2], reverse=True)
+	return rows
+
+
+def main():
+	args = parseCommandLine()
+	sites = readSites(args.sites)
+	readCounts(args.logfile, sites)
+	rows = groupCounts(sites, args.by)
+
+	total = sum(r[2] for r in rows)
+	if total == 0:
+		print("No sync points were counted")
+		return
+
+	print("{} sync points reached {} times\n".format(len([s for s in sites.values() if s.count]), total))
+	print("{:>14} {:>7} {:>7}  {:<24} {}".format("count", "%", "cum %", "function", "location"))
+	shown = rows if args.top <= 0 else rows[:args.top]
+	cumulative = 0
+	for function, location, count in shown:
+		cumulative += count
+		print("{:>14} {:>6.2f}% {:>6.2f}%  {:<24} {}".format(count, 100.0 * count / total,
+			100.0 * cumulative / total, function, location))
+
+	if args.csv:
+		with open(args.csv, 'w', newline='') as f:
+			writer = csv.writer(f)
+			writer.writerow(["function", "location", "count"])
+			for row in rows:
+				writer.writerow(row)
+
+
+if __name__ == '__main__':
+	main()
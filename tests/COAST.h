@@ -7,6 +7,8 @@
  * See documentation for how to use these properly.
  */
 
+#include <stdint.h>
+
 // Macros for variables, functions
 #define __NO_xMR __attribute__((annotate("no_xMR")))
 #define __xMR __attribute__((annotate("xMR")))
@@ -33,6 +35,9 @@
 // This function will be a protected library function (don't change signature)
 #define __xMR_PROT_LIB __attribute((annotate("protected_lib")))
 
+// This matrix multiply is checked with row and column sums instead of replicated
+#define __xMR_ABFT __attribute__((annotate("xMR_abft")))
+
 // Clone function arguments *after* the call (ie. for scanf)
 // There is a version which clones all of the args for every function call
 #define __xMR_ALL_AFTER_CALL __attribute((annotate("clone-after-call-")))
@@ -63,6 +68,78 @@
 //  on the function multiple times.
 #define __NO_xMR_ARG(num) __attribute__((annotate("no_xMR_arg-"#num)))
 
+// Protect this function or variable at a different level than the rest of the code
+#define __DWC __attribute__((annotate("xMR_level_DWC")))
+#define __TMR __attribute__((annotate("xMR_level_TMR")))
+
+// Keep more or fewer sync points in this function than -syncLevel says
+#define __xMR_SYNC_ALL __attribute__((annotate("xMR_sync_all")))
+#define __xMR_SYNC_MEMORY __attribute__((annotate("xMR_sync_memory")))
+#define __xMR_SYNC_BOUNDARY __attribute__((annotate("xMR_sync_boundary")))
+
+// Also keep an unprotected version of this function, called when protection is turned off
+#define __xMR_MULTI_VERSION __attribute__((annotate("xMR_multi_version")))
+
+// Mark a global variable, or the return value of a function, as an output.
+// Only the code that can affect the outputs will be replicated.
+#define __xMR_OUTPUT __attribute__((annotate("xMR_output")))
+
+// The functions below are found by name, so they can't be mangled in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Only replicate the code between these markers, the rest of the function is not protected
+// Values leaving the region are voted on
+void __COAST_xMR_REGION_BEGIN(void);
+void __COAST_xMR_REGION_END(void);
+#define COAST_xMR_BEGIN() __COAST_xMR_REGION_BEGIN()
+#define COAST_xMR_END() __COAST_xMR_REGION_END()
+
+// Check the constant globals kept as a single copy (-checksumConstGlbls)
+// The body of this function is filled in by COAST
+void __COAST_CHECK_CONSTANTS(void);
+#define COAST_CHECK_CONSTANTS() __COAST_CHECK_CONSTANTS()
+
+// Check and repair part of the copies of the replicated globals
+// Returns the number of words repaired.  The body is filled in by COAST
+unsigned __COAST_SCRUB_MEMORY(void);
+#define COAST_SCRUB_MEMORY() __COAST_SCRUB_MEMORY()
+// Called around each call to it, to keep the protected code from running in the
+//  middle.  Define them (with __NO_xMR) if it isn't only called from an idle hook
+void __COAST_SCRUB_LOCK(void);
+void __COAST_SCRUB_UNLOCK(void);
+
+// Choose which version of the functions marked with __xMR_MULTI_VERSION is called
+// 0 calls the unprotected versions, anything else the protected ones (the default)
+// It can be changed at any time.  The body is filled in by COAST
+void __COAST_SET_PROTECTION(int on);
+#define COAST_SET_PROTECTION(x) __COAST_SET_PROTECTION(x)
+
+// Corrections logged with -correctionLog.  The functions are in COAST_telemetry.h
+typedef struct {
+    uint64_t time;          // COAST_TELEMETRY_TIME() when it was corrected
+    uint32_t site;          // ID of the sync point, see -siteTable
+    uint32_t syndrome;      // 1: the first copy was wrong, 2: the second copy, 3: the original
+} __COAST_correction_t;
+void __COAST_LOG_CORRECTION(uint32_t site, uint32_t syndrome);
+// Copy up to max of the logged corrections to out, oldest first, and return how many
+unsigned __COAST_DRAIN_CORRECTIONS(__COAST_correction_t* out, unsigned max);
+uint32_t __COAST_TASK_CORRECTIONS(unsigned task);
+uint32_t __COAST_DROPPED_CORRECTIONS(void);
+#define COAST_DRAIN_CORRECTIONS(out, max) __COAST_DRAIN_CORRECTIONS((out), (max))
+#define COAST_TASK_CORRECTIONS(task) __COAST_TASK_CORRECTIONS(task)
+#define COAST_DROPPED_CORRECTIONS() __COAST_DROPPED_CORRECTIONS()
+
+// Print how many times each sync point was reached with -countSyncs, one line
+//  per sync point, for syncProfile.py.  Returns how many lines were printed
+unsigned __COAST_DUMP_SYNC_COUNTS(void);
+#define COAST_DUMP_SYNC_COUNTS() __COAST_DUMP_SYNC_COUNTS()
+
+#ifdef __cplusplus
+}
+#endif
+
 // convenience for no-inlining functions
 #define __COAST_NO_INLINE __attribute__((noinline))
 
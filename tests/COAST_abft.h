@@ -0,0 +1,144 @@
+#ifndef __COAST_ABFT__
+#define __COAST_ABFT__
+
+/*
+ * This file contains the checks for matrix multiply kernels marked with
+ *  __xMR_ABFT or -abftFns.  COAST calls the kernel once, and then calls the
+ *  matching function here on its inputs and result.
+ * For C = A * B, the sum of each row of C has to match A times the row sums
+ *  of B, and the sum of each column of C has to match the column sums of A
+ *  times B.  These only take O(n^2) work to check.  If exactly one row and
+ *  one column are off by the same amount, the element where they cross is
+ *  corrected.  The math is done modulo the size of the type, the same as
+ *  the kernel, so overflow doesn't matter.
+ * The kernel and the checks only read the original inputs, so before the
+ *  call COAST votes on each input with its copies with __COAST_abft_vote_*.
+ *  With DWC the second copy is NULL, and they're only compared.
+ * Each function returns how many elements were corrected, or -1 if the
+ *  result can't be corrected, which COAST reports as a fault.
+ *
+ * Define COAST_ABFT_IMPLEMENTATION in exactly one source file before including this.
+ * The sums are kept on the stack, 2 * m elements.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+int __COAST_abft_matmul_i8(uint8_t* A, uint8_t* B, uint8_t* C, size_t n, size_t m, size_t p);
+int __COAST_abft_matmul_i16(uint16_t* A, uint16_t* B, uint16_t* C, size_t n, size_t m, size_t p);
+int __COAST_abft_matmul_i32(uint32_t* A, uint32_t* B, uint32_t* C, size_t n, size_t m, size_t p);
+int __COAST_abft_matmul_i64(uint64_t* A, uint64_t* B, uint64_t* C, size_t n, size_t m, size_t p);
+int __COAST_abft_vote_i8(uint8_t* X, uint8_t* X1, uint8_t* X2, size_t count);
+int __COAST_abft_vote_i16(uint16_t* X, uint16_t* X1, uint16_t* X2, size_t count);
+int __COAST_abft_vote_i32(uint32_t* X, uint32_t* X1, uint32_t* X2, size_t count);
+int __COAST_abft_vote_i64(uint64_t* X, uint64_t* X1, uint64_t* X2, size_t count);
+
+
+#ifdef COAST_ABFT_IMPLEMENTATION
+
+#include "COAST.h"
+
+/*
+ * A is n x m, B is m x p, and C is n x p, all stored by rows.
+ * The multiplications are done in unsigned int at least, so they wrap instead of overflowing.
+ */
+#define COAST_ABFT_DEFINE(bits, type, math)                                       \
+__NO_xMR                                                                          \
+int __COAST_abft_matmul_i##bits(type* A, type* B, type* C,                        \
+                                size_t n, size_t m, size_t p) {                   \
+    type rowSumsB[m];                                                             \
+    type colSumsA[m];                                                             \
+    size_t i, j, k;                                                               \
+    size_t badRows = 0, badCols = 0, badRow = 0, badCol = 0;                      \
+    type rowErr = 0, colErr = 0;                                                  \
+                                                                                  \
+    for (k = 0; k < m; k++) {                                                     \
+        math sum = 0;                                                             \
+        for (j = 0; j < p; j++)                                                   \
+            sum += B[k * p + j];                                                  \
+        rowSumsB[k] = (type)sum;                                                  \
+        sum = 0;                                                                  \
+        for (i = 0; i < n; i++)                                                   \
+            sum += A[i * m + k];                                                  \
+        colSumsA[k] = (type)sum;                                                  \
+    }                                                                             \
+                                                                                  \
+    for (i = 0; i < n; i++) {                                                     \
+        math expected = 0, actual = 0;                                            \
+        for (k = 0; k < m; k++)                                                   \
+            expected += (math)A[i * m + k] * rowSumsB[k];                         \
+        for (j = 0; j < p; j++)                                                   \
+            actual += C[i * p + j];                                               \
+        if ((type)(actual - expected) != 0) {                                     \
+            badRows++;                                                            \
+            badRow = i;                                                           \
+            rowErr = (type)(actual - expected);                                   \
+        }                                                                         \
+    }                                                                             \
+    for (j = 0; j < p; j++) {                                                     \
+        math expected = 0, actual = 0;                                            \
+        for (k = 0; k < m; k++)                                                   \
+            expected += (math)colSumsA[k] * B[k * p + j];                         \
+        for (i = 0; i < n; i++)                                                   \
+            actual += C[i * p + j];                                               \
+        if ((type)(actual - expected) != 0) {                                     \
+            badCols++;                                                            \
+            badCol = j;                                                           \
+            colErr = (type)(actual - expected);                                   \
+        }                                                                         \
+    }                                                                             \
+                                                                                  \
+    if ((badRows == 0) && (badCols == 0))                                         \
+        return 0;                                                                 \
+    if ((badRows == 1) && (badCols == 1) && (rowErr == colErr)) {                 \
+        C[badRow * p + badCol] -= rowErr;                                         \
+        return 1;                                                                 \
+    }                                                                             \
+    return -1;                                                                    \
+}
+
+COAST_ABFT_DEFINE(8, uint8_t, unsigned int)
+COAST_ABFT_DEFINE(16, uint16_t, unsigned int)
+COAST_ABFT_DEFINE(32, uint32_t, uint32_t)
+COAST_ABFT_DEFINE(64, uint64_t, uint64_t)
+
+#undef COAST_ABFT_DEFINE
+
+/*
+ * X1 and X2 are the copies of X, count elements long.  Each element that doesn't
+ *  match is voted on, and the result written back to all three.
+ */
+#define COAST_ABFT_VOTE_DEFINE(bits, type)                                        \
+__NO_xMR                                                                          \
+int __COAST_abft_vote_i##bits(type* X, type* X1, type* X2, size_t count) {        \
+    size_t i;                                                                     \
+    int fixed = 0;                                                                \
+                                                                                  \
+    for (i = 0; i < count; i++) {                                                 \
+        if ((X[i] == X1[i]) && (!X2 || (X[i] == X2[i])))                          \
+            continue;                                                             \
+        if (!X2)                                                                  \
+            return -1;                                                            \
+        if (X1[i] == X2[i])                                                       \
+            X[i] = X1[i];                                                         \
+        else if (X[i] == X1[i])                                                   \
+            X2[i] = X[i];                                                         \
+        else if (X[i] == X2[i])                                                   \
+            X1[i] = X[i];                                                         \
+        else                                                                      \
+            return -1;                                                            \
+        fixed++;                                                                  \
+    }                                                                             \
+    return fixed;                                                                 \
+}
+
+COAST_ABFT_VOTE_DEFINE(8, uint8_t)
+COAST_ABFT_VOTE_DEFINE(16, uint16_t)
+COAST_ABFT_VOTE_DEFINE(32, uint32_t)
+COAST_ABFT_VOTE_DEFINE(64, uint64_t)
+
+#undef COAST_ABFT_VOTE_DEFINE
+
+#endif /* COAST_ABFT_IMPLEMENTATION */
+
+#endif /* __COAST_ABFT__ */
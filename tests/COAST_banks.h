@@ -0,0 +1,66 @@
+#ifndef __COAST_BANKS__
+#define __COAST_BANKS__
+
+/*
+ * This file contains helpers for the sections made by the -replicaBanks option.
+ * The linker script from COAST defines the start and end of each bank, where
+ *  bank 0 holds the originals, bank 1 the DWC copies, and bank 2 the TMR copies.
+ *  Banks that weren't used are NULL.
+ * On Linux, __COAST_bind_banks() moves the pages of each bank to a NUMA node,
+ *  which can be used to test the placement without the board.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COAST_NUM_BANKS 3
+
+extern char __COAST_bank0_start[] __attribute__((weak));
+extern char __COAST_bank0_end[] __attribute__((weak));
+extern char __COAST_bank1_start[] __attribute__((weak));
+extern char __COAST_bank1_end[] __attribute__((weak));
+extern char __COAST_bank2_start[] __attribute__((weak));
+extern char __COAST_bank2_end[] __attribute__((weak));
+
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// from numaif.h, which is part of libnuma
+#define COAST_MPOL_BIND 2
+#define COAST_MPOL_MF_MOVE (1 << 1)
+
+/*
+ * Bind the pages of each bank to the NUMA node in `nodes`, or leave it alone if the node is negative.
+ * Returns 0 on success, or -1 if the kernel wouldn't do it.
+ */
+static inline int __COAST_bind_banks(const int nodes[COAST_NUM_BANKS]) {
+    char* starts[COAST_NUM_BANKS] = { __COAST_bank0_start, __COAST_bank1_start, __COAST_bank2_start };
+    char* ends[COAST_NUM_BANKS] = { __COAST_bank0_end, __COAST_bank1_end, __COAST_bank2_end };
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+    for (int i = 0; i < COAST_NUM_BANKS; i++) {
+        if ( (starts[i] == NULL) || (nodes[i] < 0) || (ends[i] == starts[i]) )
+            continue;
+
+        uintptr_t begin = (uintptr_t)starts[i] & ~(pageSize - 1);
+        uintptr_t end = ((uintptr_t)ends[i] + pageSize - 1) & ~(pageSize - 1);
+        unsigned long mask = 1UL << nodes[i];
+        if (syscall(SYS_mbind, (void*)begin, end - begin, COAST_MPOL_BIND,
+                &mask, sizeof(mask) * 8, COAST_MPOL_MF_MOVE) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+#else
+
+static inline int __COAST_bind_banks(const int nodes[COAST_NUM_BANKS]) {
+    (void)nodes;
+    return -1;
+}
+
+#endif /* __linux__ */
+
+#endif /* __COAST_BANKS__ */
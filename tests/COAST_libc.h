@@ -0,0 +1,217 @@
+#ifndef __COAST_LIBC__
+#define __COAST_LIBC__
+
+/*
+ * This file contains versions of common C library routines that can be
+ *  compiled with COAST, for use with the -protectedLibc option.
+ * Calls to functions that are only declared, like strcmp(), are sync points,
+ *  so the arguments are voted on before every call, and the call itself runs
+ *  once without any protection.  With -protectedLibc, COAST changes direct
+ *  calls from protected code to call the __COAST_ version instead, if there
+ *  is one in the module.  These are protected like any other function, so
+ *  the copies of the arguments are passed straight through.
+ * Because every instruction in them is replicated, they work a word at a
+ *  time wherever the pointers are aligned, which keeps the number of
+ *  replicated instructions down.  The word loops in strlen() and strcmp()
+ *  can read past the end of the string, but never past the aligned word it
+ *  ends in, so they never cross into another page.
+ *
+ * Define COAST_LIBC_IMPLEMENTATION in exactly one source file before including this.
+ * The functions need to be in the Scope of Replication, which they are by
+ *  default if they're called from main().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void* __COAST_memcpy(void* dst, const void* src, size_t n);
+void* __COAST_memset(void* dst, int c, size_t n);
+int __COAST_memcmp(const void* s1, const void* s2, size_t n);
+size_t __COAST_strlen(const char* s);
+int __COAST_strcmp(const char* s1, const char* s2);
+int __COAST_strncmp(const char* s1, const char* s2, size_t n);
+void* __COAST_bsearch(const void* key, const void* base, size_t num, size_t size,
+                      int (*compar)(const void*, const void*));
+
+
+#ifdef COAST_LIBC_IMPLEMENTATION
+
+// words can be used to read any type
+typedef uintptr_t __attribute__((__may_alias__)) __COAST_word_t;
+
+#define COAST_LIBC_WORD   sizeof(__COAST_word_t)
+#define COAST_LIBC_ONES   ((uintptr_t)-1 / 0xFF)
+#define COAST_LIBC_HIGHS  (COAST_LIBC_ONES * 0x80)
+// non-zero if any byte in the word is zero
+#define COAST_LIBC_HAS_ZERO(w) (((w) - COAST_LIBC_ONES) & ~(w) & COAST_LIBC_HIGHS)
+#define COAST_LIBC_MISALIGN(p) ((uintptr_t)(p) & (COAST_LIBC_WORD - 1))
+
+
+void* __COAST_memcpy(void* dst, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (COAST_LIBC_MISALIGN(d) == COAST_LIBC_MISALIGN(s)) {
+        while (n && COAST_LIBC_MISALIGN(d)) {
+            *d++ = *s++;
+            n--;
+        }
+        while (n >= COAST_LIBC_WORD) {
+            *(__COAST_word_t*)d = *(const __COAST_word_t*)s;
+            d += COAST_LIBC_WORD;
+            s += COAST_LIBC_WORD;
+            n -= COAST_LIBC_WORD;
+        }
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dst;
+}
+
+
+void* __COAST_memset(void* dst, int c, size_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    uintptr_t fill = COAST_LIBC_ONES * (uint8_t)c;
+
+    while (n && COAST_LIBC_MISALIGN(d)) {
+        *d++ = (uint8_t)c;
+        n--;
+    }
+    while (n >= COAST_LIBC_WORD) {
+        *(__COAST_word_t*)d = fill;
+        d += COAST_LIBC_WORD;
+        n -= COAST_LIBC_WORD;
+    }
+    while (n--) {
+        *d++ = (uint8_t)c;
+    }
+    return dst;
+}
+
+
+int __COAST_memcmp(const void* s1, const void* s2, size_t n) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+
+    // skip the words that match, the bytes find which one is different
+    if (COAST_LIBC_MISALIGN(a) == COAST_LIBC_MISALIGN(b)) {
+        while (n && COAST_LIBC_MISALIGN(a)) {
+            if (*a != *b)
+                return *a - *b;
+            a++;
+            b++;
+            n--;
+        }
+        while ((n >= COAST_LIBC_WORD) &&
+               (*(const __COAST_word_t*)a == *(const __COAST_word_t*)b)) {
+            a += COAST_LIBC_WORD;
+            b += COAST_LIBC_WORD;
+            n -= COAST_LIBC_WORD;
+        }
+    }
+    for (; n; n--, a++, b++) {
+        if (*a != *b)
+            return *a - *b;
+    }
+    return 0;
+}
+
+
+size_t __COAST_strlen(const char* s) {
+    const char* p = s;
+
+    while (COAST_LIBC_MISALIGN(p)) {
+        if (*p == '\0')
+            return p - s;
+        p++;
+    }
+    while (!COAST_LIBC_HAS_ZERO(*(const __COAST_word_t*)p)) {
+        p += COAST_LIBC_WORD;
+    }
+    while (*p != '\0') {
+        p++;
+    }
+    return p - s;
+}
+
+
+int __COAST_strcmp(const char* s1, const char* s2) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+
+    if (COAST_LIBC_MISALIGN(a) == COAST_LIBC_MISALIGN(b)) {
+        while (COAST_LIBC_MISALIGN(a)) {
+            if ((*a != *b) || (*a == '\0'))
+                return *a - *b;
+            a++;
+            b++;
+        }
+        // stop at the first word that is different or has the end of the string
+        while (1) {
+            uintptr_t wa = *(const __COAST_word_t*)a;
+            if ((wa != *(const __COAST_word_t*)b) || COAST_LIBC_HAS_ZERO(wa))
+                break;
+            a += COAST_LIBC_WORD;
+            b += COAST_LIBC_WORD;
+        }
+    }
+    while ((*a == *b) && (*a != '\0')) {
+        a++;
+        b++;
+    }
+    return *a - *b;
+}
+
+
+int __COAST_strncmp(const char* s1, const char* s2, size_t n) {
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+
+    if (COAST_LIBC_MISALIGN(a) == COAST_LIBC_MISALIGN(b)) {
+        while (n && COAST_LIBC_MISALIGN(a)) {
+            if ((*a != *b) || (*a == '\0'))
+                return *a - *b;
+            a++;
+            b++;
+            n--;
+        }
+        while (n >= COAST_LIBC_WORD) {
+            uintptr_t wa = *(const __COAST_word_t*)a;
+            if ((wa != *(const __COAST_word_t*)b) || COAST_LIBC_HAS_ZERO(wa))
+                break;
+            a += COAST_LIBC_WORD;
+            b += COAST_LIBC_WORD;
+            n -= COAST_LIBC_WORD;
+        }
+    }
+    for (; n; n--, a++, b++) {
+        if ((*a != *b) || (*a == '\0'))
+            return *a - *b;
+    }
+    return 0;
+}
+
+
+void* __COAST_bsearch(const void* key, const void* base, size_t num, size_t size,
+                      int (*compar)(const void*, const void*)) {
+    const uint8_t* lo = (const uint8_t*)base;
+
+    while (num > 0) {
+        const uint8_t* mid = lo + (num / 2) * size;
+        int result = compar(key, mid);
+        if (result == 0)
+            return (void*)mid;
+        if (result > 0) {
+            lo = mid + size;
+            num = num - num / 2 - 1;
+        } else {
+            num = num / 2;
+        }
+    }
+    return NULL;
+}
+
+#endif /* COAST_LIBC_IMPLEMENTATION */
+
+#endif /* __COAST_LIBC__ */
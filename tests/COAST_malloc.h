@@ -0,0 +1,168 @@
+#ifndef __COAST_MALLOC__
+#define __COAST_MALLOC__
+
+/*
+ * This file contains the heap used by the -replicaMalloc option.
+ * COAST changes the replicated calls to wrapped malloc() and free() functions
+ *  into a single call to __COAST_malloc() or __COAST_free().  The heap has
+ *  a copy for each replica, each one __COAST_heap_stride bytes after the last,
+ *  so one allocation serves all of the copies.  Freeing the original block
+ *  frees all of the copies, so the pointers to the copies are ignored.
+ * Blocks are given out in power of two size classes, and freed blocks are kept
+ *  on a list for each class.  The bookkeeping is not replicated.
+ *
+ * Define COAST_MALLOC_IMPLEMENTATION in exactly one source file before including this.
+ * These can also be defined to change the heap:
+ *   COAST_HEAP_SIZE            bytes in each copy of the heap (default 64 KiB)
+ *   COAST_HEAP_COPIES          copies to reserve space for, 2 is enough for DWC (default 3)
+ *   COAST_REPLICA_OFFSET       put the heap in the -replicaOffset sections, must match the option
+ *   COAST_HEAP_LOCK(),
+ *   COAST_HEAP_UNLOCK()        keep the heap from being used by more than one thread at a time
+ *   COAST_HEAP_FALLBACK_FREE() what to do with pointers that aren't from this heap (default free())
+ *   COAST_HEAP_FREERTOS        also define pvPortMalloc() and vPortFree(), instead of heap_4.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+void* __COAST_malloc(size_t size);
+void __COAST_free(void* ptr);
+extern const uintptr_t __COAST_heap_stride;
+
+
+#ifdef COAST_MALLOC_IMPLEMENTATION
+
+#include <stdlib.h>
+#include "COAST.h"
+
+#ifndef COAST_HEAP_SIZE
+#define COAST_HEAP_SIZE (64 * 1024)
+#endif
+
+#ifndef COAST_HEAP_COPIES
+#define COAST_HEAP_COPIES 3
+#endif
+
+#ifdef COAST_HEAP_FREERTOS
+#include "FreeRTOS.h"
+#include "task.h"
+#ifndef COAST_HEAP_LOCK
+#define COAST_HEAP_LOCK() vTaskSuspendAll()
+#define COAST_HEAP_UNLOCK() (void)xTaskResumeAll()
+#endif
+#endif
+
+#ifndef COAST_HEAP_LOCK
+#define COAST_HEAP_LOCK()
+#define COAST_HEAP_UNLOCK()
+#endif
+
+#ifndef COAST_HEAP_FALLBACK_FREE
+#define COAST_HEAP_FALLBACK_FREE(ptr) free(ptr)
+#endif
+
+// every block starts with a header, which also keeps the blocks aligned
+#define COAST_HEAP_ALIGN 16
+#define COAST_HEAP_MIN_SHIFT 5
+#define COAST_HEAP_NUM_CLASSES 27
+
+
+#ifdef COAST_REPLICA_OFFSET
+// the linker script from -replicaOffset places the copies at the offset
+__NO_xMR __attribute__((section(".xmr"), aligned(COAST_HEAP_ALIGN), used))
+static uint8_t __COAST_heap[COAST_HEAP_SIZE];
+__NO_xMR __attribute__((section(".xmr_DWC"), aligned(COAST_HEAP_ALIGN), used))
+static uint8_t __COAST_heap_DWC[COAST_HEAP_SIZE];
+#if COAST_HEAP_COPIES > 2
+__NO_xMR __attribute__((section(".xmr_TMR"), aligned(COAST_HEAP_ALIGN), used))
+static uint8_t __COAST_heap_TMR[COAST_HEAP_SIZE];
+#endif
+__NO_xMR const uintptr_t __COAST_heap_stride = COAST_REPLICA_OFFSET;
+#else
+__NO_xMR __attribute__((aligned(COAST_HEAP_ALIGN)))
+static uint8_t __COAST_heap[COAST_HEAP_COPIES * COAST_HEAP_SIZE];
+__NO_xMR const uintptr_t __COAST_heap_stride = COAST_HEAP_SIZE;
+#endif
+
+typedef struct {
+    size_t sizeClass;
+} __attribute__((aligned(COAST_HEAP_ALIGN))) __COAST_heap_header;
+
+__NO_xMR static void* __COAST_heap_free_lists[COAST_HEAP_NUM_CLASSES];
+__NO_xMR static size_t __COAST_heap_used = 0;
+
+
+__NO_xMR
+void* __COAST_malloc(size_t size) {
+    size_t needed = size + sizeof(__COAST_heap_header);
+    unsigned sizeClass = 0;
+    uint8_t* block = NULL;
+
+    // find the smallest class that fits
+    while (((size_t)1 << (sizeClass + COAST_HEAP_MIN_SHIFT)) < needed) {
+        sizeClass++;
+        if (sizeClass >= COAST_HEAP_NUM_CLASSES)
+            return NULL;
+    }
+    size_t blockSize = (size_t)1 << (sizeClass + COAST_HEAP_MIN_SHIFT);
+
+    COAST_HEAP_LOCK();
+    if (__COAST_heap_free_lists[sizeClass] != NULL) {
+        block = (uint8_t*)__COAST_heap_free_lists[sizeClass];
+        __COAST_heap_free_lists[sizeClass] = *(void**)(block + sizeof(__COAST_heap_header));
+    } else if (blockSize <= COAST_HEAP_SIZE - __COAST_heap_used) {
+        block = &__COAST_heap[__COAST_heap_used];
+        __COAST_heap_used += blockSize;
+    }
+    COAST_HEAP_UNLOCK();
+
+    if (block == NULL)
+        return NULL;
+    ((__COAST_heap_header*)block)->sizeClass = sizeClass;
+    return block + sizeof(__COAST_heap_header);
+}
+
+
+__NO_xMR
+void __COAST_free(void* ptr) {
+    uint8_t* p = (uint8_t*)ptr;
+    uintptr_t dist = (uintptr_t)p - (uintptr_t)&__COAST_heap[0];
+    unsigned copy;
+    if (p == NULL)
+        return;
+
+    // the copies are freed along with the original
+    for (copy = 1; copy < COAST_HEAP_COPIES; copy++) {
+        if (dist - copy * __COAST_heap_stride < COAST_HEAP_SIZE)
+            return;
+    }
+    if (dist >= COAST_HEAP_SIZE) {
+        COAST_HEAP_FALLBACK_FREE(ptr);
+        return;
+    }
+
+    uint8_t* block = p - sizeof(__COAST_heap_header);
+    size_t sizeClass = ((__COAST_heap_header*)block)->sizeClass;
+
+    COAST_HEAP_LOCK();
+    *(void**)p = __COAST_heap_free_lists[sizeClass];
+    __COAST_heap_free_lists[sizeClass] = block;
+    COAST_HEAP_UNLOCK();
+}
+
+
+#ifdef COAST_HEAP_FREERTOS
+__NO_xMR
+void* pvPortMalloc(size_t size) {
+    return __COAST_malloc(size);
+}
+
+__NO_xMR
+void vPortFree(void* ptr) {
+    __COAST_free(ptr);
+}
+#endif
+
+#endif /* COAST_MALLOC_IMPLEMENTATION */
+
+#endif /* __COAST_MALLOC__ */
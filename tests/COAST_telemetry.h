@@ -0,0 +1,161 @@
+#ifndef __COAST_TELEMETRY__
+#define __COAST_TELEMETRY__
+
+/*
+ * This file contains the run-time side of -correctionLog.  Each time TMR
+ *  corrects a value, COAST calls __COAST_LOG_CORRECTION() with the ID of the
+ *  sync point and which copy was different.  The IDs can be looked up in the
+ *  table COAST writes to -siteTable.
+ * The corrections go into a ring buffer that can be written from any task or
+ *  interrupt without a lock, and read with COAST_DRAIN_CORRECTIONS().  If it
+ *  fills up, new corrections are dropped and counted instead.  Each task also
+ *  has its own count of corrections.
+ * None of this is called unless something was corrected, so it doesn't slow
+ *  down the code when there aren't any faults.
+ * With -countSyncs, COAST counts how many times each sync point is reached.
+ *  COAST_DUMP_SYNC_COUNTS() prints the counts, and syncProfile.py matches them
+ *  up with the table from -siteTable.
+ *
+ * Define COAST_TELEMETRY_IMPLEMENTATION in exactly one source file before including this.
+ * These can also be defined before that, to fit the target:
+ *   COAST_TELEMETRY_SIZE     entries in the ring buffer, a power of 2 (default 64)
+ *   COAST_TELEMETRY_TASKS    how many tasks get their own count (default 8)
+ *   COAST_TELEMETRY_TIME()   timestamp of each entry (default clock())
+ *   COAST_TELEMETRY_TASK()   number of the task that is running (default 0)
+ *   COAST_TELEMETRY_PRINTF   how to print the sync point counts (default printf)
+ * For example, with FreeRTOS:
+ *   #define COAST_TELEMETRY_TIME() xTaskGetTickCountFromISR()
+ *   #define COAST_TELEMETRY_TASK() uxTaskGetTaskNumber(xTaskGetCurrentTaskHandle())
+ * The atomic operations are the GCC and Clang __atomic builtins.
+ */
+
+#include <stdint.h>
+
+#include "COAST.h"
+
+
+#ifdef COAST_TELEMETRY_IMPLEMENTATION
+
+#ifndef COAST_TELEMETRY_SIZE
+#define COAST_TELEMETRY_SIZE 64
+#endif
+#ifndef COAST_TELEMETRY_TASKS
+#define COAST_TELEMETRY_TASKS 8
+#endif
+#ifndef COAST_TELEMETRY_TIME
+#include <time.h>
+#define COAST_TELEMETRY_TIME() ((uint64_t)clock())
+#endif
+#ifndef COAST_TELEMETRY_TASK
+#define COAST_TELEMETRY_TASK() 0
+#endif
+#ifndef COAST_TELEMETRY_PRINTF
+#include <stdio.h>
+#define COAST_TELEMETRY_PRINTF printf
+#endif
+
+#if (COAST_TELEMETRY_SIZE & (COAST_TELEMETRY_SIZE - 1)) != 0
+#error "COAST_TELEMETRY_SIZE must be a power of 2"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Each entry gets a ticket from head.  The entry with ticket t is in slot
+ *  t % COAST_TELEMETRY_SIZE, and its slot in __COAST_log_ready is set to t + 1
+ *  once it has been written.  Entries before tail have been drained.
+ */
+__NO_xMR static __COAST_correction_t __COAST_log[COAST_TELEMETRY_SIZE];
+__NO_xMR static uint32_t __COAST_log_ready[COAST_TELEMETRY_SIZE];
+__NO_xMR static uint32_t __COAST_log_head = 0;
+__NO_xMR static uint32_t __COAST_log_tail = 0;
+__NO_xMR static uint32_t __COAST_log_dropped = 0;
+__NO_xMR static uint32_t __COAST_task_corrections[COAST_TELEMETRY_TASKS];
+
+
+__NO_xMR __COAST_VOLATILE
+void __COAST_LOG_CORRECTION(uint32_t site, uint32_t syndrome) {
+    uint32_t task = (uint32_t)(COAST_TELEMETRY_TASK()) % COAST_TELEMETRY_TASKS;
+    __atomic_fetch_add(&__COAST_task_corrections[task], 1, __ATOMIC_RELAXED);
+
+    // take the next ticket, unless the buffer is full
+    uint32_t ticket = __atomic_load_n(&__COAST_log_head, __ATOMIC_RELAXED);
+    do {
+        uint32_t tail = __atomic_load_n(&__COAST_log_tail, __ATOMIC_ACQUIRE);
+        if (ticket - tail >= COAST_TELEMETRY_SIZE) {
+            __atomic_fetch_add(&__COAST_log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&__COAST_log_head, &ticket, ticket + 1, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    uint32_t slot = ticket % COAST_TELEMETRY_SIZE;
+    __COAST_log[slot].time = COAST_TELEMETRY_TIME();
+    __COAST_log[slot].site = site;
+    __COAST_log[slot].syndrome = syndrome;
+    __atomic_store_n(&__COAST_log_ready[slot], ticket + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Only one task should drain the buffer.  It stops at an entry that is still
+ *  being written, and picks up there the next time.
+ */
+__NO_xMR __COAST_VOLATILE
+unsigned __COAST_DRAIN_CORRECTIONS(__COAST_correction_t* out, unsigned max) {
+    unsigned count = 0;
+    uint32_t tail = __atomic_load_n(&__COAST_log_tail, __ATOMIC_RELAXED);
+
+    while (count < max) {
+        uint32_t slot = tail % COAST_TELEMETRY_SIZE;
+        if (__atomic_load_n(&__COAST_log_ready[slot], __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        out[count++] = __COAST_log[slot];
+        tail++;
+        // the slot can be used again
+        __atomic_store_n(&__COAST_log_tail, tail, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+__NO_xMR __COAST_VOLATILE
+uint32_t __COAST_TASK_CORRECTIONS(unsigned task) {
+    return __atomic_load_n(&__COAST_task_corrections[task % COAST_TELEMETRY_TASKS], __ATOMIC_RELAXED);
+}
+
+__NO_xMR __COAST_VOLATILE
+uint32_t __COAST_DROPPED_CORRECTIONS(void) {
+    return __atomic_load_n(&__COAST_log_dropped, __ATOMIC_RELAXED);
+}
+
+/*
+ * These are only there when the program was compiled with -countSyncs, so
+ *  they're weak, and the function doesn't print anything without them.
+ */
+extern uint64_t __COAST_sync_counts[] __attribute__((weak));
+extern const uint32_t __COAST_sync_sites __attribute__((weak));
+
+__NO_xMR __COAST_VOLATILE
+unsigned __COAST_DUMP_SYNC_COUNTS(void) {
+    unsigned printed = 0;
+    if (!&__COAST_sync_sites)
+        return 0;
+
+    for (uint32_t id = 0; id < __COAST_sync_sites; id++) {
+        if (__COAST_sync_counts[id] == 0)
+            continue;
+        COAST_TELEMETRY_PRINTF("COAST_SYNC,%lu,%llu\n", (unsigned long)id,
+                               (unsigned long long)__COAST_sync_counts[id]);
+        printed++;
+    }
+    return printed;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COAST_TELEMETRY_IMPLEMENTATION */
+
+#endif /* __COAST_TELEMETRY__ */
@@ -88,8 +88,10 @@ class runConfig(object):
 # keep this up to date manually
 # dictionary of specific flags for each unitTest
 customConfigs = [
+    runConfig("abftMatmul.c"),
     runConfig("annotations.c"),
     runConfig("argAttrs.c"),
+    runConfig("argReplication.c", op="-argReplication=auto -argRegs=4"),
     runConfig("argSync.c", xc="-O3"),
     runConfig("arm_locks.c", brd="pynq", hk=True),
     runConfig("atomics.c", nm="__SKIP_THIS",
@@ -97,8 +99,11 @@ customConfigs = [
     runConfig("basicIR.c"),
     runConfig("bsearch_strcmp.c"),
     runConfig("classTest.cpp"),
+    runConfig("constChecksum.c", sn=True, op="-checksumConstGlbls"),
     runConfig("cloneAfterCall.c", sn=True,
         rgx=re.compile(r"Bob \(16\): 3.7[0-9]*\nSuccess!\n", re.MULTILINE)),
+    runConfig("correctionLog.c", op="-correctionLog"),
+    runConfig("dwcSignature.c", op="-dwcSignature"),
     runConfig("exceptions.cpp", \
         op="-replicateFnCalls=_ZNSt12_Vector_baseIiSaIiEE11_M_allocateEm,_ZSt27__uninitialized_default_n_aIPimiET_S1_T0_RSaIT1_E",  \
         nm="-ignoreFns=_ZNSt12_Vector_baseIiSaIiEE13_M_deallocateEPim"),
@@ -107,25 +112,46 @@ customConfigs = [
         ef="fSigTypes_ext.c"),
     runConfig("funcPtrStruct.c",
         rgx=re.compile(r"100 150\n(1 2 3\n){1,3}Finished", re.MULTILINE)),
+    runConfig("fuseMemOps.c", op="-fuseMemOps -fuseMemVote"),
     runConfig("globalPointers.c", \
         xc="-g3", cf=True, sn=True),
     runConfig("halfProtected.c", op="-skipLibCalls=malloc"),
     runConfig("helloWorld.cpp"),
     runConfig("inlining.c", \
         xc="-O2"),
+    runConfig("interleaveMem.c", op="-interleaveMem"),
     runConfig("linkedList.c", xc="-g3", cf=True, sn=True),
     runConfig("load_store.c"),
     runConfig("mallocTest.c", sn=True,
         rgx=re.compile(r"^Finished", re.MULTILINE)),
+    runConfig("mixedLevels.c"),
+    runConfig("mixedLevels.c", op="-tmrFns=nextState -dwcSignature"),
+    runConfig("mixedLevels.c", op="-tmrFns=nextState -correctionLog"),
+    runConfig("multiVersion.c", sn=True),
     runConfig("nestedCalls.c", xc="-O2",\
         op="-replicateFnCalls=memset"),
+    runConfig("outputSlice.c"),
+    runConfig("overheadBudget.c", op="-overheadBudget=50"),
     runConfig("ptrArith.c", rgx=ptrArithRegex),
+    runConfig("promoteLocals.c", op="-promoteLocals -stackReport"),
     runConfig("protectedLib.c", op="-protectedLibFn=sharedFunc"),
+    runConfig("protectedLibc.c", op="-protectedLibc"),
+    runConfig("pureCalls.c", op="-inferCalls -callReport", xl="-lm"),
+    runConfig("regions.c", sn=True),
+    runConfig("replicaBanks.c", sn=True, nm="__SKIP_THIS",
+        op="-replicaBanks=,.coast_bank1,.coast_bank2 -replicaBankMinSize=256",
+        xl="-Wl,-T,coast.banks.ld"),
+    runConfig("replicaMalloc.c", sn=True, op="-replicaMalloc"),
+    runConfig("replicaOffset.c", sn=True, nm="__SKIP_THIS",
+        op="-replicaOffset=0x10000", xl="-Wl,-T,coast.replicas.ld"),
     runConfig("replReturn.c", sn=True, nm="__SKIP_THIS",
         op="-cloneReturn=returnTest -replicateFnCalls=malloc -cloneFns=testWrapper",
         rgx=re.compile(r"(0x[0-9A-Fa-f]+\n){2,3}Success!\n", re.MULTILINE)),
     runConfig("returnPointer.c"),
+    runConfig("runtimeInit.c", op="-runtimeInitAll"),
     runConfig("segmenting.c"),
+    runConfig("scrubMemory.c", sn=True, op="-scrubChunk=64"),
+    runConfig("shadowMemory.c", op="-shadowMem=secded"),
     runConfig("signalHandlers.c", hk=True,
         op="-skipLibCalls=__sysv_signal,signal"),
     runConfig("simd.c", \
@@ -133,6 +159,9 @@ customConfigs = [
     runConfig("stackAttack.c", xc="-g3"),
     runConfig("stackProtect.c", qtm=1, xc="-g3", op="-protectStack"),
     runConfig("structCompare.c"),
+    runConfig("syncCounts.c", op="-countErrors -countSyncs -syncSampleRate=4"),
+    runConfig("syncLevel.c", op="-syncLevel=boundary"),
+    runConfig("temporalPure.c", op="-temporalPure -callReport"),
     runConfig("testFuncPtrs.c"),
     runConfig("time_c.c", op="-skipLibCalls=clock -cloneAfterCall=time",
         rgx=timeCRegex),
@@ -0,0 +1,118 @@
+/*
+ * abftMatmul.c
+ *
+ * This unit test checks that a matrix multiply can be protected with row and
+ *  column checksums instead of being replicated.  matmul() is marked with
+ *  __xMR_ABFT, so it should be called once and checked afterwards, and the
+ *  rest of the code uses the copies of the result like normal.
+ * The checks themselves are also tested on their own, outside of the Scope of
+ *  Replication, by changing the result by hand.  One wrong element should be
+ *  corrected, and two should be caught.  The vote on the inputs should fix a
+ *  wrong element in any of the copies, and catch one that differs in all three.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+#define COAST_ABFT_IMPLEMENTATION
+#include "COAST_abft.h"
+
+
+#define ROWS 6
+#define INNER 5
+#define COLS 4
+
+int32_t first[ROWS][INNER];
+int32_t second[INNER][COLS];
+int32_t result[ROWS][COLS];
+
+
+__xMR_ABFT
+void matmul(int32_t a[][INNER], int32_t b[][COLS], int32_t c[][COLS]) {
+    for (int i = 0; i < ROWS; i++) {
+        for (int j = 0; j < COLS; j++) {
+            int32_t sum = 0;
+            for (int k = 0; k < INNER; k++) {
+                sum += a[i][k] * b[k][j];
+            }
+            c[i][j] = sum;
+        }
+    }
+}
+
+void fillInputs() {
+    for (int i = 0; i < ROWS; i++) {
+        for (int k = 0; k < INNER; k++) {
+            first[i][k] = (i * 7 + k * 3) % 11 - 5;
+        }
+    }
+    for (int k = 0; k < INNER; k++) {
+        for (int j = 0; j < COLS; j++) {
+            second[k][j] = (k * 13 + j * 5) * 1000 - 20000;
+        }
+    }
+}
+
+uint32_t hashResult() {
+    uint32_t hash = 0;
+    for (int i = 0; i < ROWS; i++) {
+        for (int j = 0; j < COLS; j++) {
+            hash = hash * 31 + (uint32_t)result[i][j];
+        }
+    }
+    return hash;
+}
+
+__NO_xMR
+int checkCorrection() {
+    int32_t a[2][3] = { {1, 2, 3}, {4, 5, 6} };
+    int32_t b[3][2] = { {7, 8}, {9, 10}, {11, 12} };
+    int32_t c[2][2] = { {58, 64}, {139, 154} };
+    int fixedNone, fixedOne, fixedTwo;
+
+    fixedNone = __COAST_abft_matmul_i32((uint32_t*)a, (uint32_t*)b, (uint32_t*)c, 2, 3, 2);
+    c[1][0] = 1000;
+    fixedOne = __COAST_abft_matmul_i32((uint32_t*)a, (uint32_t*)b, (uint32_t*)c, 2, 3, 2);
+    if (c[1][0] != 139)
+        return 0;
+    c[0][0] = 1;
+    c[1][1] = 2;
+    fixedTwo = __COAST_abft_matmul_i32((uint32_t*)a, (uint32_t*)b, (uint32_t*)c, 2, 3, 2);
+
+    return (fixedNone == 0) && (fixedOne == 1) && (fixedTwo == -1);
+}
+
+__NO_xMR
+int checkInputVote() {
+    int32_t x[4] = {1, 2, 3, 4};
+    int32_t x1[4] = {1, 2, 9, 4};
+    int32_t x2[4] = {5, 2, 3, 4};
+    int fixed, bad;
+
+    fixed = __COAST_abft_vote_i32((uint32_t*)x, (uint32_t*)x1, (uint32_t*)x2, 4);
+    if ((x[0] != 1) || (x1[2] != 3) || (x2[0] != 1))
+        return 0;
+    x[3] = 6;
+    x1[3] = 7;
+    bad = __COAST_abft_vote_i32((uint32_t*)x, (uint32_t*)x1, (uint32_t*)x2, 4);
+
+    return (fixed == 2) && (bad == -1);
+}
+
+
+int main() {
+    fillInputs();
+    matmul(first, second, result);
+    uint32_t hash = hashResult();
+    int corrected = checkCorrection() && checkInputVote();
+    printf("%u %d\n", hash, corrected);
+
+    if ((hash == 1866226080u) && corrected) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * argReplication.c
+ *
+ * This unit test checks that some arguments can be voted on at the call
+ *  instead of being passed as copies.  mixPixel() takes five integer
+ *  arguments, which is fifteen with TMR.  With only four argument registers,
+ *  the arguments that are used the least before being voted on should be
+ *  passed as a single value.
+ *
+ * Run with the command line parameters -argReplication=auto -argRegs=4
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define WIDTH 24
+#define HEIGHT 16
+
+static uint8_t image[HEIGHT][WIDTH];
+
+
+uint32_t mixPixel(uint32_t x, uint32_t y, uint32_t scale, uint32_t bias, uint32_t shift) {
+    uint32_t value = (x * scale + y * (scale ^ 5)) >> shift;
+    return (value + bias) & 0xFF;
+}
+
+void render(uint32_t scale, uint32_t bias) {
+    for (uint32_t y = 0; y < HEIGHT; y++) {
+        for (uint32_t x = 0; x < WIDTH; x++) {
+            image[y][x] = (uint8_t)mixPixel(x, y, scale, bias, 1);
+        }
+    }
+}
+
+uint32_t checksum() {
+    uint32_t sum = 0;
+    for (uint32_t y = 0; y < HEIGHT; y++) {
+        for (uint32_t x = 0; x < WIDTH; x++) {
+            sum = sum * 31 + image[y][x];
+        }
+    }
+    return sum;
+}
+
+
+int main() {
+    render(7, 3);
+    uint32_t sum = checksum();
+    printf("%u\n", sum);
+
+    if (sum == 1556079168) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
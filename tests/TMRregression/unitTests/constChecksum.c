@@ -0,0 +1,76 @@
+/*
+ * constChecksum.c
+ *
+ * This unit test checks that constant lookup tables can be kept as a single
+ *  copy protected by a checksum, instead of being replicated.
+ * The S-box is indexed by data computed at run time, and the CRC check value
+ *  makes sure the table contents weren't changed.
+ *
+ * Run with the command line parameter -checksumConstGlbls
+ * Use -verbose to see which tables were not cloned.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 64
+
+// PRESENT cipher S-box
+static const uint8_t sbox[16] = {
+    0xC, 0x5, 0x6, 0xB, 0x9, 0x0, 0xA, 0xD,
+    0x3, 0xE, 0xF, 0x8, 0x4, 0x7, 0x1, 0x2
+};
+
+// CRC-32, 4 bits at a time
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint8_t data[DATA_SIZE];
+
+
+uint32_t crc32(const uint8_t* buf, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        crc = (crc >> 4) ^ crcTable[crc & 0xF];
+        crc = (crc >> 4) ^ crcTable[crc & 0xF];
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+
+void substitute(uint8_t* buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = (sbox[buf[i] >> 4] << 4) | sbox[buf[i] & 0xF];
+    }
+}
+
+
+int main() {
+    const uint8_t checkStr[] = "123456789";
+    uint32_t check = crc32(checkStr, 9);
+
+    for (int i = 0; i < DATA_SIZE; i++) {
+        data[i] = (uint8_t)(i * 7 + 3);
+    }
+    substitute(data, DATA_SIZE);
+    uint32_t result = crc32(data, DATA_SIZE);
+
+    // also check the tables all at once
+    COAST_CHECK_CONSTANTS();
+
+    if ( (check != 0xCBF43926) || (result != 0x88FDFB54) ) {
+        printf("Error: %08X %08X\n", check, result);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
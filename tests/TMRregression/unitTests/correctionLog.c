@@ -0,0 +1,88 @@
+/*
+ * correctionLog.c
+ *
+ * This unit test checks that logging the corrections doesn't change the
+ *  program, and that the ring buffer in COAST_telemetry.h works.  Without any
+ *  faults, nothing should be logged by the protected code.  The logging
+ *  function is also called by hand, outside of the Scope of Replication, to
+ *  check that the entries come back out in order, and that the ones that
+ *  don't fit are dropped and counted.
+ *
+ * Run with the command line parameter -correctionLog
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+#define COAST_TELEMETRY_IMPLEMENTATION
+#include "COAST_telemetry.h"
+
+
+#define DATA_SIZE 48
+#define EXTRA 6
+
+static uint32_t data[DATA_SIZE];
+
+
+uint32_t mixData() {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        data[i] = (i * 2654435761u) ^ (data[(i + DATA_SIZE - 1) % DATA_SIZE] >> 3);
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+__NO_xMR
+int checkLog() {
+    __COAST_correction_t out[COAST_TELEMETRY_SIZE + EXTRA];
+    unsigned count;
+
+    // nothing was corrected by the protected code
+    if ((COAST_TASK_CORRECTIONS(0) != 0) || (COAST_DRAIN_CORRECTIONS(out, 1) != 0))
+        return 0;
+
+    for (uint32_t i = 0; i < 3; i++) {
+        __COAST_LOG_CORRECTION(10 + i, i + 1);
+    }
+    count = COAST_DRAIN_CORRECTIONS(out, COAST_TELEMETRY_SIZE);
+    if (count != 3)
+        return 0;
+    for (uint32_t i = 0; i < 3; i++) {
+        if ((out[i].site != 10 + i) || (out[i].syndrome != i + 1))
+            return 0;
+        if ((i > 0) && (out[i].time < out[i - 1].time))
+            return 0;
+    }
+
+    // more than fit
+    for (uint32_t i = 0; i < COAST_TELEMETRY_SIZE + EXTRA; i++) {
+        __COAST_LOG_CORRECTION(i, 3);
+    }
+    count = COAST_DRAIN_CORRECTIONS(out, COAST_TELEMETRY_SIZE + EXTRA);
+    if ((count != COAST_TELEMETRY_SIZE) || (COAST_DROPPED_CORRECTIONS() != EXTRA))
+        return 0;
+    if ((out[0].site != 0) || (out[count - 1].site != COAST_TELEMETRY_SIZE - 1))
+        return 0;
+
+    return COAST_TASK_CORRECTIONS(0) == 3 + COAST_TELEMETRY_SIZE + EXTRA;
+}
+
+
+int main() {
+    uint32_t hash = 0;
+    for (uint32_t round = 0; round < 4; round++) {
+        hash ^= mixData() + round;
+    }
+    int logged = checkLog();
+    printf("%u %d\n", hash, logged);
+
+    if ((hash == 1393899944u) && logged) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
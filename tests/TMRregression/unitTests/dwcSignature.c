@@ -0,0 +1,101 @@
+/*
+ * dwcSignature.c
+ *
+ * This unit test checks that the DWC sync points can be folded into a
+ *  signature, which is only checked before calls to external functions,
+ *  returns, and loop exits.  There are branches, a switch, and stores inside
+ *  the loops, and values of different types and sizes, which all have to be
+ *  folded in, and a printf() inside a loop, which has to check the signature
+ *  in the middle of it.  With TMR, the option is ignored.
+ *
+ * Run with the command line parameter -dwcSignature
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 48
+
+static uint32_t data[DATA_SIZE];
+static uint16_t small[DATA_SIZE];
+static float scaled[DATA_SIZE];
+static uint64_t total = 0;
+
+
+uint32_t classify(uint32_t x) {
+    switch (x % 5) {
+        case 0:
+            return x * 3;
+        case 1:
+            return x ^ 0x5a5a;
+        case 2:
+            return x + 17;
+        case 3:
+            return x >> 2;
+        default:
+            return x;
+    }
+}
+
+float scale(uint32_t x) {
+    if (x & 1)
+        return (float)x * 0.5f;
+    else
+        return (float)x * 1.25f;
+}
+
+void fill() {
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        data[i] = (i * 2654435761u) >> 7;
+        small[i] = (uint16_t)(data[i] & 0xffff);
+    }
+}
+
+uint32_t process() {
+    uint32_t checks = 0;
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        uint32_t c = classify(data[i]);
+        if (c > small[i]) {
+            data[i] = c - small[i];
+        } else {
+            data[i] = small[i] - c;
+        }
+        scaled[i] = scale(data[i]);
+        total += (uint64_t)data[i] * (i + 1);
+
+        // the signature has to be checked here
+        if ((i % 16) == 15) {
+            printf("%u: %u\n", i, data[i]);
+            checks++;
+        }
+    }
+    return checks;
+}
+
+uint32_t hash() {
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        result = result * 31 + data[i];
+        result ^= (uint32_t)scaled[i];
+    }
+    return result ^ (uint32_t)total ^ (uint32_t)(total >> 32);
+}
+
+
+int main() {
+    fill();
+    uint32_t checks = process();
+    uint32_t result = hash();
+    printf("%u %u\n", result, checks);
+
+    if ((result == 1391488765u) && (checks == 3)) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
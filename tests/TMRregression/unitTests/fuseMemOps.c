@@ -0,0 +1,87 @@
+/*
+ * fuseMemOps.c
+ *
+ * This unit test checks that the copies of memcpy and memset can be fused
+ *  into a single loop.  The struct copies and the buffer copy are turned into
+ *  calls to llvm.memcpy, and the buffer length isn't a whole number of words,
+ *  so the loop for the extra bytes is used as well.
+ *
+ * Run with the command line parameters -fuseMemOps -fuseMemVote
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "COAST.h"
+
+
+#define BUF_SIZE 1003
+#define NUM_RECORDS 16
+
+typedef struct {
+    uint32_t id;
+    uint16_t flags;
+    uint8_t name[10];
+    uint64_t total;
+} record_t;
+
+static record_t records[NUM_RECORDS];
+static record_t backup[NUM_RECORDS];
+static uint8_t inBuf[BUF_SIZE];
+static uint8_t outBuf[BUF_SIZE];
+
+
+void fillRecords() {
+    for (uint32_t i = 0; i < NUM_RECORDS; i++) {
+        record_t r;
+        memset(&r, 0, sizeof(r));
+        r.id = i * 31;
+        r.flags = (uint16_t)(i ^ 0x5A);
+        r.name[i % 10] = (uint8_t)i;
+        r.total = (uint64_t)i * 1000003;
+        records[i] = r;
+    }
+}
+
+uint32_t copyBuffer(uint32_t len) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        inBuf[i] = (uint8_t)(i * 13 + 7);
+    }
+    memset(outBuf, 0xFF, BUF_SIZE);
+    memcpy(outBuf, inBuf, len);
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        sum += outBuf[i];
+    }
+    return sum;
+}
+
+uint64_t checkRecords() {
+    uint64_t sum = 0;
+    memcpy(backup, records, sizeof(records));
+    for (uint32_t i = 0; i < NUM_RECORDS; i++) {
+        sum += backup[i].id + backup[i].flags + backup[i].total;
+        for (uint32_t j = 0; j < 10; j++) {
+            sum += backup[i].name[j];
+        }
+    }
+    return sum;
+}
+
+
+int main() {
+    fillRecords();
+    uint64_t recordSum = checkRecords();
+    uint32_t bufSum = copyBuffer(BUF_SIZE - 2);
+
+    printf("%lu %u\n", (unsigned long)recordSum, bufSum);
+
+    if ( (recordSum == 120005600) && (bufSum == 127841) ) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
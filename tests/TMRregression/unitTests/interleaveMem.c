@@ -0,0 +1,80 @@
+/*
+ * interleaveMem.c
+ *
+ * This unit test checks that the copies of globals and locals can be placed
+ *  next to each other in memory.
+ * The arrays that are indexed directly should be interleaved by element, the
+ *  counter should be grouped with its copies, and the array whose address is
+ *  passed to a function should be left alone.
+ *
+ * Run with the command line parameter -interleaveMem
+ * Use -verbose to see which variables were moved.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 16
+
+struct point {
+    int16_t x;
+    int16_t y;
+};
+
+static uint32_t table[DATA_SIZE] = { 3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 8, 9, 7, 9, 3 };
+static struct point points[DATA_SIZE];
+static uint32_t counter = 0;
+static uint32_t escaped[DATA_SIZE];
+
+
+void fillPoints() {
+    for (int i = 0; i < DATA_SIZE; i++) {
+        points[i].x = table[i] * i;
+        points[i].y = table[DATA_SIZE - 1 - i] - i;
+    }
+    counter++;
+}
+
+
+__attribute__((noinline))
+uint32_t sum(uint32_t* p, int n) {
+    uint32_t result = 0;
+    for (int i = 0; i < n; i++) {
+        result += p[i];
+    }
+    return result;
+}
+
+
+uint32_t process() {
+    uint32_t local[DATA_SIZE];
+
+    for (int i = 0; i < DATA_SIZE; i++) {
+        local[i] = points[i].x * points[i].y + table[i];
+    }
+    for (int i = 0; i < DATA_SIZE; i++) {
+        escaped[i] = local[i] ^ counter;
+    }
+    return sum(escaped, DATA_SIZE);
+}
+
+
+int main() {
+    uint32_t first, second;
+
+    fillPoints();
+    first = process();
+    fillPoints();
+    second = process();
+
+    if ( (first != 0xFFFFECBE) || (second != 0xFFFFECC2) ) {
+        printf("Error: %08X %08X\n", first, second);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
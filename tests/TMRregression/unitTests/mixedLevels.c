@@ -0,0 +1,59 @@
+/*
+ * mixedLevels.c
+ *
+ * This unit test checks that parts of a program can be protected at a
+ *  different level than the rest of it.
+ * The filter over the data buffer only needs errors to be detected, so it is
+ *  marked with __DWC, while the control code is protected with TMR.
+ * The data buffer is written by the DWC function and read by the TMR code.
+ *
+ * Run with the TMR pass.
+ * It is also run with -tmrFns=nextState and -dwcSignature or -correctionLog, so
+ *  each of those options only applies to one of the levels, whichever pass it is.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+#define COAST_TELEMETRY_IMPLEMENTATION
+#include "COAST_telemetry.h"
+
+
+#define DATA_SIZE 64
+
+__DWC uint32_t samples[DATA_SIZE];
+uint32_t state = 0;
+
+
+__DWC
+void filterSamples(uint32_t seed) {
+    for (int i = 0; i < DATA_SIZE; i++) {
+        samples[i] = (seed * (i + 1)) >> 2;
+    }
+}
+
+
+uint32_t nextState(uint32_t sum) {
+    state = (state << 1) ^ (sum & 0xFF);
+    return state;
+}
+
+
+int main() {
+    uint32_t sum = 0;
+
+    filterSamples(7);
+    for (int i = 0; i < DATA_SIZE; i++) {
+        sum += samples[i];
+    }
+    nextState(sum);
+
+    if ( (sum != 3616) || (state != 32) ) {
+        printf("Error: %u %u\n", sum, state);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
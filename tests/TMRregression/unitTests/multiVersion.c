@@ -0,0 +1,82 @@
+/*
+ * multiVersion.c
+ *
+ * This unit test checks that a function can have an unprotected version, and
+ *  that protection can be turned on and off between calls.  stepFilter() is
+ *  marked with __xMR_MULTI_VERSION, and calls smooth(), which writes to a
+ *  global through its argument.  After each call to the unprotected version,
+ *  the copies of the globals it wrote have to be brought up to date, or the
+ *  protected code that reads them afterwards would see copies that don't
+ *  match.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define SAMPLES 32
+
+static int32_t samples[SAMPLES];
+static int32_t filtered[SAMPLES];
+static uint32_t steps = 0;
+
+
+void smooth(int32_t* out, const int32_t* in, uint32_t len) {
+    int32_t window[3];
+    for (uint32_t i = 0; i < len; i++) {
+        window[0] = in[(i + len - 1) % len];
+        window[1] = in[i];
+        window[2] = in[(i + 1) % len];
+        out[i] = (window[0] + 2 * window[1] + window[2]) / 4;
+    }
+}
+
+__xMR_MULTI_VERSION
+uint32_t stepFilter(uint32_t round) {
+    uint32_t hash = round;
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        samples[i] = (samples[i] * 5 + (int32_t)(round * 7 + i)) % 1009 - 64;
+    }
+    smooth(filtered, samples, SAMPLES);
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        hash = hash * 31 + (uint32_t)filtered[i];
+    }
+    steps++;
+    return hash;
+}
+
+uint32_t checkFiltered() {
+    uint32_t hash = 0;
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        hash = hash * 17 + (uint32_t)(filtered[i] ^ samples[i]);
+    }
+    return hash;
+}
+
+
+int main() {
+    uint32_t result = 0;
+
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        samples[i] = (int32_t)(i * 13) - 200;
+    }
+
+    // protected, unprotected, and back again
+    for (uint32_t round = 0; round < 12; round++) {
+        COAST_SET_PROTECTION((round / 4) != 1);
+        result ^= stepFilter(round);
+        result += checkFiltered();
+    }
+    COAST_SET_PROTECTION(1);
+    printf("%u %u\n", result, steps);
+
+    if ((result == 1087463483u) && (steps == 12)) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
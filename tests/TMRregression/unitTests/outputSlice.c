@@ -0,0 +1,60 @@
+/*
+ * outputSlice.c
+ *
+ * This unit test checks that COAST only replicates the code which can
+ *  affect the marked outputs.
+ * The filtered result is an output, while the statistics kept about the
+ *  samples are not, so they should be left out of the replication scope.
+ * Use -verbose to see what was left out.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 64
+
+__xMR_OUTPUT uint32_t result = 0;
+
+uint32_t minSeen = 0xFFFFFFFF;
+uint32_t maxSeen = 0;
+uint32_t numSamples = 0;
+
+
+void updateStats(uint32_t sample) {
+    if (sample < minSeen) {
+        minSeen = sample;
+    }
+    if (sample > maxSeen) {
+        maxSeen = sample;
+    }
+    numSamples++;
+}
+
+
+uint32_t filter(uint32_t sample, uint32_t last) {
+    return (sample + 3 * last) >> 2;
+}
+
+
+int main() {
+    uint32_t last = 0;
+
+    for (int i = 0; i < DATA_SIZE; i++) {
+        uint32_t sample = (i * 37) % 101;
+        updateStats(sample);
+        last = filter(sample, last);
+    }
+    result = last;
+
+    if ( (result != 46) || (numSamples != DATA_SIZE) ) {
+        printf("Error: %u %u\n", result, numSamples);
+        return 1;
+    }
+
+    printf("Range: %u - %u\n", minSeen, maxSeen);
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * overheadBudget.c
+ *
+ * This unit test checks that COAST can pick its own scope of replication
+ *  when given an overhead budget.
+ * The hot loop in checksum() is much more expensive to protect than the
+ *  bookkeeping functions, so with a small budget it should be left out,
+ *  and the globals it shares with the protected code must stay consistent.
+ *
+ * Run with the command line parameter -overheadBudget=50
+ * The chosen scope is written to functions.budget.config
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 256
+
+static uint32_t data[DATA_SIZE];
+static uint32_t runCount = 0;
+static uint32_t lastResult = 0;
+
+
+void fillData(uint32_t seed) {
+    for (int i = 0; i < DATA_SIZE; i++) {
+        data[i] = seed * (i + 1);
+    }
+}
+
+
+uint32_t checksum() {
+    uint32_t sum = 0;
+    for (int j = 0; j < 16; j++) {
+        for (int i = 0; i < DATA_SIZE; i++) {
+            sum = (sum << 1) ^ (sum >> 31) ^ data[i];
+        }
+    }
+    return sum;
+}
+
+
+void recordResult(uint32_t result) {
+    runCount += 1;
+    lastResult = result;
+}
+
+
+int main() {
+    uint32_t first, second;
+
+    fillData(3);
+    first = checksum();
+    recordResult(first);
+
+    fillData(3);
+    second = checksum();
+    recordResult(second);
+
+    if ( (first != second) || (runCount != 2) || (lastResult != first) ) {
+        printf("Error: %u %u %u\n", first, second, runCount);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
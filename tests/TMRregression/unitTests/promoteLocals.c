@@ -0,0 +1,63 @@
+/*
+ * promoteLocals.c
+ *
+ * This unit test checks that locals can be promoted to registers after they
+ *  are replicated.  The scalars in collatz() should be promoted, but the
+ *  array in histogram() has its address taken, so it should stay on the
+ *  stack, along with its copies.
+ *
+ * Run with the command line parameters -promoteLocals -stackReport
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define NUM_BINS 8
+
+
+uint32_t collatz(uint32_t start) {
+    uint32_t steps = 0;
+    uint32_t n = start;
+    while (n != 1) {
+        if (n % 2)
+            n = 3 * n + 1;
+        else
+            n = n / 2;
+        steps++;
+    }
+    return steps;
+}
+
+void addToBin(uint32_t* bins, uint32_t value) {
+    bins[value % NUM_BINS]++;
+}
+
+uint32_t histogram(uint32_t count) {
+    uint32_t bins[NUM_BINS] = { 0 };
+    uint32_t weighted = 0;
+
+    for (uint32_t i = 1; i <= count; i++) {
+        addToBin(bins, collatz(i));
+    }
+    for (uint32_t i = 0; i < NUM_BINS; i++) {
+        weighted += bins[i] * (i + 1);
+    }
+    return weighted;
+}
+
+
+int main() {
+    uint32_t result = histogram(100);
+    printf("%u\n", result);
+
+    if (result == 418) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * protectedLibc.c
+ *
+ * This unit test checks that calls to the C library can be changed to call
+ *  the protected versions in COAST_libc.h.  The strings are built at run
+ *  time at different alignments, so that the word loops start and stop in
+ *  the middle of words.  bsearch() calls a comparison function through a
+ *  pointer, so the comparison function isn't protected, and its call to
+ *  strcmp() goes to the library.
+ *
+ * Run with the command line parameter -protectedLibc
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "COAST.h"
+#define COAST_LIBC_IMPLEMENTATION
+#include "COAST_libc.h"
+
+
+#define NUM_WORDS 8
+#define WORD_SIZE 24
+
+static const char* syllables[] = {"ra", "di", "a", "tion", "har", "dened", "co", "ast"};
+static char words[NUM_WORDS][WORD_SIZE];
+static char buffer[64];
+
+
+__NO_xMR
+int compareWords(const void* a, const void* b) {
+    return strcmp((const char*)a, (const char*)b);
+}
+
+void buildWords() {
+    for (uint32_t i = 0; i < NUM_WORDS; i++) {
+        memset(words[i], 0, WORD_SIZE);
+        strcpy(words[i], syllables[i]);
+        strcat(words[i], syllables[(i * 3 + 1) % NUM_WORDS]);
+        strcat(words[i], syllables[(i * 5 + 2) % NUM_WORDS]);
+    }
+
+    // insertion sort, so the copies are sorted too
+    for (uint32_t i = 1; i < NUM_WORDS; i++) {
+        char key[WORD_SIZE];
+        uint32_t j = i;
+        memcpy(key, words[i], WORD_SIZE);
+        while ((j > 0) && (strcmp(words[j - 1], key) > 0)) {
+            memcpy(words[j], words[j - 1], WORD_SIZE);
+            j--;
+        }
+        memcpy(words[j], key, WORD_SIZE);
+    }
+}
+
+uint32_t checkStrings() {
+    uint32_t result = 0;
+
+    // every starting alignment
+    for (uint32_t start = 0; start < 8; start++) {
+        memcpy(buffer + start, words[start], WORD_SIZE);
+        result = result * 31 + strlen(buffer + start);
+        result = result * 31 + (strcmp(buffer + start, words[start]) == 0);
+        result = result * 31 + (strncmp(buffer + start, words[(start + 1) % NUM_WORDS], 2) < 0);
+        result = result * 31 + (memcmp(buffer + start, words[start], WORD_SIZE) == 0);
+    }
+    return result;
+}
+
+uint32_t searchWords() {
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < NUM_WORDS; i++) {
+        char* item = (char*) bsearch(words[i], words, NUM_WORDS, WORD_SIZE, compareWords);
+        if (item == words[i])
+            found++;
+    }
+    if (bsearch("zzz", words, NUM_WORDS, WORD_SIZE, compareWords) == NULL)
+        found++;
+    return found;
+}
+
+
+int main() {
+    buildWords();
+    uint32_t strResult = checkStrings();
+    uint32_t found = searchWords();
+    printf("%u %u\n", strResult, found);
+
+    if ((strResult == 2469632615u) && (found == NUM_WORDS + 1)) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * pureCalls.c
+ *
+ * This unit test checks that calls to math and string functions can be
+ *  replicated without a sync point, based on what LLVM knows about them,
+ *  without listing them in functions.config.  printf() isn't known to be
+ *  free of side effects, so it should still be synchronized.
+ *
+ * Run with the command line parameters -inferCalls -callReport
+ * and link with -lm
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "COAST.h"
+
+
+#define NUM_POINTS 64
+
+static double wave[NUM_POINTS];
+static const char* label = "pure function calls";
+
+
+void fillWave() {
+    for (int i = 0; i < NUM_POINTS; i++) {
+        double t = (double)i / NUM_POINTS;
+        wave[i] = sin(2 * M_PI * t) + sqrt(t) * cos(M_PI * t);
+    }
+}
+
+int32_t energy() {
+    double sum = 0.0;
+    for (int i = 0; i < NUM_POINTS; i++) {
+        sum += fabs(wave[i]) * exp(-0.01 * i);
+    }
+    return (int32_t)floor(sum * 1000.0);
+}
+
+
+int main() {
+    fillWave();
+    int32_t e = energy();
+    size_t len = strlen(label);
+    printf("%d %u\n", e, (unsigned)len);
+
+    if ( (e == 47589) && (len == 19) ) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * regions.c
+ *
+ * This unit test checks that only part of a function can be replicated,
+ *  using COAST_xMR_BEGIN() and COAST_xMR_END().
+ * The bookkeeping in main() is not protected, but the loop inside the region
+ *  is, and the results that leave the region are voted on.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 32
+
+
+int main() {
+    uint32_t data[DATA_SIZE];
+    uint32_t sum = 0;
+    uint32_t maxVal = 0;
+
+    for (int i = 0; i < DATA_SIZE; i++) {
+        data[i] = (i * 7) % 13;
+    }
+
+    COAST_xMR_BEGIN();
+    for (int i = 0; i < DATA_SIZE; i++) {
+        sum += data[i] * data[i];
+        if (data[i] > maxVal) {
+            maxVal = data[i];
+        }
+    }
+    COAST_xMR_END();
+
+    if ( (sum != 1499) || (maxVal != 12) ) {
+        printf("Error: %u %u\n", sum, maxVal);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * replicaBanks.c
+ *
+ * This unit test checks that the copies of large globals can be placed in
+ *  their own sections, using the linker script that COAST writes.
+ * The small global should stay where it is.
+ *
+ * Run with the command line parameters
+ *  -replicaBanks=,.coast_bank1,.coast_bank2 -replicaBankMinSize=256
+ * and link with -Wl,-T,coast.banks.ld
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+#include "COAST_banks.h"
+
+
+#define BUF_SIZE 512
+
+static uint32_t samples[BUF_SIZE];
+static uint32_t filtered[BUF_SIZE];
+static uint32_t gain = 3;
+
+
+void fillSamples() {
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        samples[i] = (i * 37) % 101;
+    }
+}
+
+void filter() {
+    filtered[0] = samples[0] * gain;
+    for (uint32_t i = 1; i < BUF_SIZE; i++) {
+        filtered[i] = (samples[i] + samples[i - 1]) * gain;
+    }
+}
+
+uint32_t total() {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        sum += filtered[i];
+    }
+    return sum;
+}
+
+
+int main() {
+    fillSamples();
+    filter();
+    uint32_t sum = total();
+    printf("%u\n", sum);
+
+    // the DWC copies should be in their own bank
+    if ( (__COAST_bank1_start == NULL) || (__COAST_bank1_end - __COAST_bank1_start < 2 * BUF_SIZE * 4) ) {
+        printf("Error! The copies were not placed in the bank\n");
+        return 1;
+    }
+
+    if (sum == 153072) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,81 @@
+/*
+ * replicaMalloc.c
+ *
+ * This unit test checks that the copies of a wrapped malloc() call can be
+ *  served by one call to the replica-aware heap in COAST_malloc.h.
+ * A linked list is built, freed, and built again, so the second list
+ *  reuses the blocks that were freed.
+ *
+ * Run with the command line parameter -replicaMalloc
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "COAST.h"
+#define COAST_MALLOC_IMPLEMENTATION
+#include "COAST_malloc.h"
+
+MALLOC_WRAPPER_REGISTER(malloc);
+void GENERIC_COAST_WRAPPER(free)(void* ptr);
+
+
+#define FIRST_LEN 20
+#define SECOND_LEN 10
+
+typedef struct node_t {
+    uint32_t value;
+    struct node_t* next;
+} node;
+
+
+node* buildList(uint32_t len) {
+    node* head = NULL;
+    for (uint32_t i = 0; i < len; i++) {
+        node* n = (node*)MALLOC_WRAPPER_CALL(malloc, sizeof(node));
+        if (n == NULL)
+            return head;
+        n->value = i * i;
+        n->next = head;
+        head = n;
+    }
+    return head;
+}
+
+uint32_t sumList(node* head) {
+    uint32_t sum = 0;
+    while (head != NULL) {
+        sum += head->value;
+        head = head->next;
+    }
+    return sum;
+}
+
+void freeList(node* head) {
+    while (head != NULL) {
+        node* next = head->next;
+        GENERIC_COAST_WRAPPER(free)(head);
+        head = next;
+    }
+}
+
+
+int main() {
+    node* list = buildList(FIRST_LEN);
+    uint32_t first = sumList(list);
+    freeList(list);
+
+    list = buildList(SECOND_LEN);
+    uint32_t second = sumList(list);
+    freeList(list);
+
+    printf("%u %u\n", first, second);
+    if ( (first == 2470) && (second == 285) ) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * replicaOffset.c
+ *
+ * This unit test checks that the copies of globals can be found by adding
+ *  a fixed offset, instead of passing extra pointer arguments.
+ * The list nodes and the array being sorted are only ever reached through
+ *  pointers to globals, so none of these functions should need clones of
+ *  their pointer arguments.
+ *
+ * Run with the command line parameter -replicaOffset=0x10000, and link
+ *  with the generated linker script (-Wl,-T,coast.replicas.ld)
+ * Use -verbose to see which arguments are found by offset.
+ */
+
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 16
+
+struct node {
+    int value;
+    struct node* next;
+};
+
+static int numbers[DATA_SIZE] = { 9, 3, 7, 1, 8, 2, 6, 4, 5, 0, 15, 11, 13, 10, 14, 12 };
+static struct node pool[DATA_SIZE];
+static struct node* head = NULL;
+
+
+void swap(int* a, int* b) {
+    int tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+
+void quicksort(int* arr, int lo, int hi) {
+    if (lo >= hi)
+        return;
+
+    int pivot = arr[hi];
+    int i = lo;
+    for (int j = lo; j < hi; j++) {
+        if (arr[j] < pivot) {
+            swap(&arr[i], &arr[j]);
+            i++;
+        }
+    }
+    swap(&arr[i], &arr[hi]);
+
+    quicksort(arr, lo, i - 1);
+    quicksort(arr, i + 1, hi);
+}
+
+
+void push(struct node* n, int value) {
+    n->value = value;
+    n->next = head;
+    head = n;
+}
+
+
+int weightedSum(const int* arr, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += (i + 1) * arr[i];
+    }
+    return sum;
+}
+
+
+int main() {
+    int listSum = 0;
+    int position = 0;
+
+    quicksort(numbers, 0, DATA_SIZE - 1);
+    for (int i = 0; i < DATA_SIZE; i++) {
+        push(&pool[i], numbers[i]);
+    }
+
+    for (struct node* n = head; n != NULL; n = n->next) {
+        listSum += position * n->value;
+        position++;
+    }
+
+    if ( (weightedSum(numbers, DATA_SIZE) != 1360) || (listSum != 560) ) {
+        printf("Error: %d %d\n", weightedSum(numbers, DATA_SIZE), listSum);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
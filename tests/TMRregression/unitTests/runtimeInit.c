@@ -0,0 +1,67 @@
+/*
+ * runtimeInit.c
+ *
+ * This unit test checks that the copies of initialized globals are filled
+ *  in correctly at startup, instead of having their own initial values.
+ * There are globals of different types and sizes, including one that isn't
+ *  a whole number of words long.
+ *
+ * Run with the command line parameter -runtimeInitAll
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+struct config {
+    uint16_t id;
+    uint8_t flags;
+    int32_t gain;
+    float scale;
+};
+
+static uint32_t coeffs[8] = { 3, 1, 4, 1, 5, 9, 2, 6 };
+static struct config cfg = { 7, 0x5, -12, 0.5f };
+static char message[] = "COAST";
+static int64_t offset = 1000;
+static uint32_t zeros[4];
+
+
+uint32_t checksum() {
+    uint32_t sum = 0;
+    for (int i = 0; i < 8; i++) {
+        sum += coeffs[i] * (i + 1);
+    }
+    sum += cfg.id + cfg.flags + (int32_t)(cfg.gain * cfg.scale);
+    for (int i = 0; message[i] != '\0'; i++) {
+        sum += message[i];
+    }
+    sum += (uint32_t)offset;
+    for (int i = 0; i < 4; i++) {
+        sum += zeros[i];
+    }
+    return sum;
+}
+
+
+int main() {
+    uint32_t first = checksum();
+
+    coeffs[3] = 10;
+    cfg.gain = 20;
+    message[0] = 'c';
+    offset -= 500;
+    zeros[2] = 1;
+    uint32_t second = checksum();
+
+    printf("%u %u\n", first, second);
+    if ( (first == 1546) && (second == 1131) ) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * scrubMemory.c
+ *
+ * This unit test checks that the copies of the globals can be scrubbed in
+ *  the background without changing the program.  The scrubbing function is
+ *  called between each step, with a small chunk size, so that it stops in
+ *  the middle of the arrays.  The odd-sized array has bytes left over at the
+ *  end that don't make up a whole word.
+ * Without any faults, nothing should need to be repaired.
+ *
+ * Run with the command line parameter -scrubChunk=64
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define TABLE_SIZE 200
+#define NAME_SIZE 13
+
+static uint32_t table[TABLE_SIZE];
+static uint8_t name[NAME_SIZE] = "scrub memory";
+static uint32_t steps = 0;
+
+
+void fillTable() {
+    for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+        table[i] = (i * 2654435761u) >> 20;
+    }
+}
+
+void mixName(uint32_t round) {
+    for (uint32_t i = 0; i < NAME_SIZE; i++) {
+        name[i] ^= (uint8_t)(table[(i + round) % TABLE_SIZE]);
+    }
+    steps++;
+}
+
+uint32_t checksum() {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+        sum += table[i];
+    }
+    for (uint32_t i = 0; i < NAME_SIZE; i++) {
+        sum = (sum << 1) + name[i];
+    }
+    return sum + steps;
+}
+
+
+int main() {
+    unsigned repaired = 0;
+
+    fillTable();
+    for (uint32_t round = 0; round < 50; round++) {
+        mixName(round);
+        repaired += COAST_SCRUB_MEMORY();
+    }
+
+    uint32_t sum = checksum();
+    printf("%u %u\n", sum, repaired);
+
+    if ( (sum == 3351840826u) && (repaired == 0) ) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
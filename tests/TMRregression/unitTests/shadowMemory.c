@@ -0,0 +1,64 @@
+/*
+ * shadowMemory.c
+ *
+ * This unit test checks that memory can be protected with a shadow of
+ *  check bits instead of copies.
+ * The stores are a mix of sizes, so some of them only change part of a
+ *  word, and the shadow of that word must still match afterwards.
+ *
+ * Run with the command line parameter -shadowMem=secded (or parity)
+ * Use -verbose to see how much memory the shadow takes.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 32
+
+static uint32_t words[DATA_SIZE] = { 1, 2, 3, 4 };
+static uint8_t bytes[DATA_SIZE];
+static uint64_t total = 0;
+
+
+void fill(uint32_t seed) {
+    for (int i = 0; i < DATA_SIZE; i++) {
+        words[i] += seed * i;
+        bytes[i] = (uint8_t)(words[i] ^ 0x5A);
+    }
+}
+
+
+uint32_t mix() {
+    uint16_t halves[DATA_SIZE];
+    uint32_t result = 0;
+
+    for (int i = 0; i < DATA_SIZE; i++) {
+        halves[i] = (uint16_t)(bytes[i] << 4) | (words[i] & 0xF);
+    }
+    for (int i = 0; i < DATA_SIZE; i++) {
+        result = (result << 3) ^ (result >> 29) ^ halves[i];
+    }
+    total += result;
+    return result;
+}
+
+
+int main() {
+    uint32_t first, second;
+
+    fill(7);
+    first = mix();
+    fill(0);
+    second = mix();
+
+    if ( (first != 0x294C5202) || (first != second) || (total != 2ULL * first) ) {
+        printf("Error: %08X %08X\n", first, second);
+        return 1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * syncCounts.c
+ *
+ * This unit test checks the counts of how many times each sync point is
+ *  reached.  With TMR, the loop in sumSquares() has sync points that are
+ *  reached every time around, so something has to be counted, and with
+ *  -syncSampleRate=4 every count goes up by 4 at a time.  Without -countSyncs,
+ *  or with DWC, nothing is counted, and only the result is checked.
+ *
+ * Run with the command line parameters -countErrors -countSyncs -syncSampleRate=4
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+#define COAST_TELEMETRY_IMPLEMENTATION
+#include "COAST_telemetry.h"
+
+
+#define DATA_SIZE 64
+#define SAMPLE_RATE 4
+
+uint32_t values[DATA_SIZE];
+
+
+uint32_t sumSquares(uint32_t rounds) {
+    uint32_t sum = 0;
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < DATA_SIZE; i++) {
+            values[i] = values[i] * 3 + r;
+            sum += values[i] * values[i];
+        }
+    }
+    return sum;
+}
+
+__NO_xMR
+int checkCounts() {
+    uint64_t total = 0;
+
+    // not compiled with -countSyncs
+    if (!&__COAST_sync_sites)
+        return 1;
+
+    for (uint32_t id = 0; id < __COAST_sync_sites; id++) {
+        if (__COAST_sync_counts[id] % SAMPLE_RATE)
+            return 0;
+        total += __COAST_sync_counts[id];
+    }
+    unsigned printed = COAST_DUMP_SYNC_COUNTS();
+    printf("%u sync points, %llu counted\n", printed, (unsigned long long)total);
+    // DWC doesn't vote, so nothing is counted
+    return (printed > 0) || (__COAST_sync_sites == 0);
+}
+
+
+int main() {
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        values[i] = i;
+    }
+    uint32_t sum = sumSquares(10);
+    int counted = checkCounts();
+    printf("%u %d\n", sum, counted);
+
+    if ((sum == 1272377536u) && counted) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * syncLevel.c
+ *
+ * This unit test checks that sync points can be left out with -syncLevel.
+ *  The whole file is protected at the boundary level, so most of it only
+ *  syncs on return values and calls to printf().  checkRange() is marked to
+ *  keep all of its sync points, and its branches are synchronized, and
+ *  fillTable() keeps the ones on memory.  Leaving out sync points shouldn't
+ *  change the result.
+ *
+ * Run with the command line parameter -syncLevel=boundary
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define TABLE_SIZE 40
+
+static uint32_t table[TABLE_SIZE];
+
+
+__xMR_SYNC_MEMORY
+void fillTable(uint32_t seed) {
+    for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        table[i] = seed >> 8;
+    }
+}
+
+__xMR_SYNC_ALL
+int checkRange(uint32_t x, uint32_t low, uint32_t high) {
+    if (x < low)
+        return -1;
+    else if (x > high)
+        return 1;
+    return 0;
+}
+
+uint32_t sumRange(uint32_t low, uint32_t high) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < TABLE_SIZE; i++) {
+        switch (checkRange(table[i], low, high)) {
+            case -1:
+                sum += 1;
+                break;
+            case 1:
+                sum += table[i] & 0xff;
+                break;
+            default:
+                sum += table[i];
+                break;
+        }
+    }
+    return sum;
+}
+
+
+int main() {
+    fillTable(2024);
+    uint32_t sum = sumRange(0x200000, 0xc00000);
+    printf("%u\n", sum);
+
+    if (sum == 166386183u) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}
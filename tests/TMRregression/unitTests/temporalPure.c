@@ -0,0 +1,90 @@
+/*
+ * temporalPure.c
+ *
+ * This unit test checks that functions which only use their own locals and
+ *  read through their arguments can be called once for each copy, instead
+ *  of being replicated.  isqrt() and checksum() should be called again for
+ *  each copy.  scaleInto() writes through its argument and countCall() uses a
+ *  global, so calling them again would change the result, and they should be
+ *  protected like normal.
+ *
+ * Run with the command line parameters -temporalPure -callReport
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "COAST.h"
+
+
+#define DATA_SIZE 64
+
+static uint8_t data[DATA_SIZE];
+static uint32_t scaled[DATA_SIZE];
+static uint32_t calls = 0;
+
+
+uint32_t isqrt(uint32_t n) {
+    uint32_t root = 0;
+    uint32_t bit = 1u << 30;
+
+    while (bit > n)
+        bit >>= 2;
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+uint32_t checksum(const uint8_t* buf, uint32_t len) {
+    uint32_t sums[2] = {1, 0};
+    for (uint32_t i = 0; i < len; i++) {
+        sums[0] = (sums[0] + buf[i]) % 65521;
+        sums[1] = (sums[1] + sums[0]) % 65521;
+    }
+    return (sums[1] << 16) | sums[0];
+}
+
+void scaleInto(uint32_t* out, const uint8_t* in, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        out[i] = in[i] * 3 + 1;
+    }
+}
+
+uint32_t countCall(uint32_t x) {
+    calls++;
+    return x + calls;
+}
+
+
+int main() {
+    uint32_t result = 0;
+
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        data[i] = (uint8_t)(i * 37 + 11);
+    }
+    for (uint32_t i = 0; i < DATA_SIZE; i++) {
+        result += isqrt(data[i] * 1000u + i);
+    }
+    scaleInto(scaled, data, DATA_SIZE);
+    result ^= checksum(data, DATA_SIZE);
+    result ^= checksum((const uint8_t*)scaled, sizeof(scaled));
+    for (uint32_t i = 0; i < 4; i++) {
+        result = countCall(result);
+    }
+    printf("%u %u\n", result, calls);
+
+    if ((result == 2271636147u) && (calls == 4)) {
+        printf("Success!\n");
+        return 0;
+    } else {
+        printf("Error!\n");
+        return 1;
+    }
+}